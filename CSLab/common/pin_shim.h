@@ -0,0 +1,63 @@
+#ifndef PIN_SHIM_H
+#define PIN_SHIM_H
+
+/**
+ * The part of pin.H used by the simulated structures (caches, TLBs,
+ * predictors): basic types, assertions and string helpers. Including this
+ * instead of pin.H builds them into standalone programs (benchmarks, trace
+ * replay) without the Pin kit. Never include both.
+ **/
+
+#include <cassert>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdint.h>
+#include <string>
+
+using namespace std;
+
+typedef uint8_t UINT8;
+typedef uint16_t UINT16;
+typedef uint32_t UINT32;
+typedef uint64_t UINT64;
+typedef int8_t INT8;
+typedef int16_t INT16;
+typedef int32_t INT32;
+typedef int64_t INT64;
+typedef uintptr_t ADDRINT;
+typedef bool BOOL;
+typedef double FLT64;
+#define VOID void
+
+#define ASSERTX(x) assert(x)
+#define ASSERT(x, msg) assert(x)
+
+// Left-justifies `s` in a field of `width` characters
+static inline string ljstr(const string &s, UINT32 width) {
+    string out(s);
+    if (out.size() < width)
+        out.append(width - out.size(), ' ');
+    return out;
+}
+
+static inline string fltstr(double value, UINT32 precision = 2,
+                            UINT32 width = 0) {
+    ostringstream o;
+    o << fixed << setprecision(precision) << setw(width) << value;
+    return o.str();
+}
+
+static inline string decstr(INT64 value, UINT32 width = 0) {
+    ostringstream o;
+    o << setw(width) << value;
+    return o.str();
+}
+
+static inline string hexstr(UINT64 value, UINT32 width = 0) {
+    ostringstream o;
+    o << hex << setw(width) << value;
+    return o.str();
+}
+
+#endif // PIN_SHIM_H
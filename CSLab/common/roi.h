@@ -0,0 +1,123 @@
+#ifndef ROI_H
+#define ROI_H
+
+/**
+ * Region-of-interest control shared by the pintools.
+ *
+ * A run goes through the following phases:
+ *   ROI_WAIT     waiting for __parsec_roi_begin (only with markers enabled),
+ *                nothing but the marker routines is instrumented
+ *   ROI_FFWD     fast-forwarding `ffwd` instructions, counted per BBL
+ *   ROI_SIMULATE the tool's own instrumentation is active, at most `maxins`
+ *                instructions (0 for no limit) are simulated
+ *   ROI_DONE     statistics have been reported and Pin has detached
+ *
+ * The tools register their instrumentation functions once and return early
+ * from them unless `Simulating()`. Every phase change flushes the code cache
+ * with PIN_RemoveInstrumentation(), so code executed before the ROI carries
+ * no simulation callbacks at all and code executed in it carries no phase
+ * checks. The run ends with PIN_Detach() at __parsec_roi_end or once
+ * `maxins` instructions have been simulated; since Pin does not call Fini
+ * functions after a detach, the tool's Fini is called explicitly.
+ **/
+class ROI {
+  public:
+    typedef enum { ROI_WAIT, ROI_FFWD, ROI_SIMULATE, ROI_DONE } PHASE;
+
+    ROI(UINT64 ffwd, UINT64 maxins, bool markers, FINI_CALLBACK fini)
+        : _ffwd(ffwd), _maxins(maxins), _markers(markers), _fini(fini),
+          _phase(ROI_WAIT), _count(0), _limit(0) {
+        if (!_markers)
+            Enter(ROI_FFWD);
+    }
+
+    // Registers the ROI's own instrumentation; call before PIN_StartProgram()
+    VOID Instrument() {
+        if (_markers)
+            RTN_AddInstrumentFunction(Routine, this);
+        TRACE_AddInstrumentFunction(Trace, this);
+    }
+
+    bool Simulating() const { return _phase == ROI_SIMULATE; }
+    PHASE Phase() const { return _phase; }
+
+  private:
+    UINT64 _ffwd, _maxins;
+    bool _markers;
+    FINI_CALLBACK _fini;
+    PHASE _phase;
+    UINT64 _count, _limit;
+
+    // Sets up the instruction budget of `phase`, skipping an empty ffwd.
+    VOID Enter(PHASE phase) {
+        if (phase == ROI_FFWD && _ffwd == 0)
+            phase = ROI_SIMULATE;
+        _phase = phase;
+        _count = 0;
+        _limit = (phase == ROI_FFWD) ? _ffwd : _maxins;
+    }
+
+    VOID Switch(PHASE phase) {
+        Enter(phase);
+        PIN_RemoveInstrumentation();
+    }
+
+    VOID Stop() {
+        if (_phase == ROI_DONE)
+            return;
+        _phase = ROI_DONE;
+        _fini(0, 0);
+        PIN_Detach();
+    }
+
+    static ADDRINT PIN_FAST_ANALYSIS_CALL Count(ROI *roi, UINT32 numIns) {
+        roi->_count += numIns;
+        return roi->_count >= roi->_limit;
+    }
+
+    static VOID LimitReached(ROI *roi) {
+        if (roi->_phase == ROI_FFWD)
+            roi->Switch(ROI_SIMULATE);
+        else if (roi->_phase == ROI_SIMULATE)
+            roi->Stop();
+    }
+
+    static VOID Begin(ROI *roi) {
+        if (roi->_phase == ROI_WAIT)
+            roi->Switch(ROI_FFWD);
+    }
+
+    static VOID End(ROI *roi) { roi->Stop(); }
+
+    static VOID Trace(TRACE trace, VOID *v) {
+        ROI *roi = (ROI *)v;
+
+        // Only a budgeted phase needs counting
+        if (roi->_phase == ROI_WAIT || roi->_phase == ROI_DONE ||
+            roi->_limit == 0)
+            return;
+        for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl);
+             bbl = BBL_Next(bbl)) {
+            BBL_InsertIfCall(bbl, IPOINT_BEFORE, (AFUNPTR)Count,
+                             IARG_FAST_ANALYSIS_CALL, IARG_PTR, roi,
+                             IARG_UINT32, BBL_NumIns(bbl), IARG_END);
+            BBL_InsertThenCall(bbl, IPOINT_BEFORE, (AFUNPTR)LimitReached,
+                               IARG_PTR, roi, IARG_END);
+        }
+    }
+
+    static VOID Routine(RTN rtn, VOID *v) {
+        ROI *roi = (ROI *)v;
+
+        RTN_Open(rtn);
+        if (RTN_Name(rtn) == "__parsec_roi_begin")
+            RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR)Begin, IARG_PTR, roi,
+                           IARG_END);
+        if (RTN_Name(rtn) == "__parsec_roi_end")
+            RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR)End, IARG_PTR, roi,
+                           IARG_END);
+        RTN_Close(rtn);
+    }
+};
+
+#endif // ROI_H
@@ -0,0 +1,197 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <cstring> // memcpy()
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * Binary snapshots of simulated microarchitectural state (cache/TLB sets,
+ * predictor tables, RAS contents). Statistics are never saved, so a run
+ * restored from a snapshot starts warm but with zeroed counters.
+ *
+ * A snapshot is a sequence of keyed sections:
+ *     "CSLBSNAP" | version | #sections | { key | size | payload }*
+ * Components pick a key that encodes their geometry (e.g. "L2:262144:64:8"),
+ * so a different configuration restoring the same file simply does not find
+ * its section and starts cold, while the components it shares with the
+ * snapshotted configuration start warm.
+ **/
+
+static const char SNAPSHOT_MAGIC[8] = {'C', 'S', 'L', 'B', 'S', 'N', 'A', 'P'};
+static const UINT32 SNAPSHOT_VERSION = 1;
+
+class SNAPSHOT_WRITER {
+  public:
+    SNAPSHOT_WRITER() : _inSection(false) {}
+
+    VOID BeginSection(const std::string &key) {
+        ASSERTX(!_inSection);
+        _keys.push_back(key);
+        _payloads.push_back(std::string());
+        _inSection = true;
+    }
+    VOID EndSection() { _inSection = false; }
+
+    template <class T> VOID Put(const T &value) {
+        ASSERTX(_inSection);
+        _payloads.back().append(reinterpret_cast<const char *>(&value),
+                                sizeof(T));
+    }
+
+    // Vectors of plain data (tags, counters) are stored as length + bytes.
+    template <class T> VOID PutVector(const std::vector<T> &v) {
+        Put(UINT64(v.size()));
+        if (!v.empty())
+            _payloads.back().append(reinterpret_cast<const char *>(&v[0]),
+                                    v.size() * sizeof(T));
+    }
+    VOID PutVector(const std::vector<bool> &v) {
+        Put(UINT64(v.size()));
+        for (size_t i = 0; i < v.size(); i++)
+            Put(UINT8(v[i]));
+    }
+    template <class T> VOID PutArray(const T *a, UINT64 n) {
+        Put(n);
+        _payloads.back().append(reinterpret_cast<const char *>(a),
+                                n * sizeof(T));
+    }
+
+    bool Write(const std::string &filename) const {
+        std::ofstream out(filename.c_str(), std::ios::out | std::ios::binary);
+        if (!out)
+            return false;
+        out.write(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+        WriteRaw(out, SNAPSHOT_VERSION);
+        WriteRaw(out, UINT32(_keys.size()));
+        for (size_t i = 0; i < _keys.size(); i++) {
+            WriteRaw(out, UINT32(_keys[i].size()));
+            out.write(_keys[i].data(), _keys[i].size());
+            WriteRaw(out, UINT64(_payloads[i].size()));
+            out.write(_payloads[i].data(), _payloads[i].size());
+        }
+        return out.good();
+    }
+
+  private:
+    std::vector<std::string> _keys;
+    std::vector<std::string> _payloads;
+    bool _inSection;
+
+    template <class T> static VOID WriteRaw(std::ofstream &out, T value) {
+        out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+    }
+};
+
+class SNAPSHOT_READER {
+  public:
+    SNAPSHOT_READER() : _current(NULL), _pos(0), _ok(false) {}
+
+    // Reads the whole snapshot in memory. Returns false on a bad file.
+    bool Read(const std::string &filename) {
+        std::ifstream in(filename.c_str(), std::ios::in | std::ios::binary);
+        char magic[sizeof(SNAPSHOT_MAGIC)];
+        UINT32 version, sections;
+
+        if (!in.read(magic, sizeof(magic)) ||
+            memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) != 0)
+            return false;
+        if (!ReadRaw(in, version) || version != SNAPSHOT_VERSION)
+            return false;
+        if (!ReadRaw(in, sections))
+            return false;
+        for (UINT32 i = 0; i < sections; i++) {
+            UINT32 keySize;
+            UINT64 size;
+            if (!ReadRaw(in, keySize))
+                return false;
+            std::string key(keySize, '\0');
+            if (!in.read(&key[0], keySize) || !ReadRaw(in, size))
+                return false;
+            std::string &payload = _sections[key];
+            payload.resize(size);
+            if (size && !in.read(&payload[0], size))
+                return false;
+        }
+        return true;
+    }
+
+    // Selects the section `key`. Returns false if the snapshot lacks it.
+    bool OpenSection(const std::string &key) {
+        std::map<std::string, std::string>::const_iterator it =
+            _sections.find(key);
+        if (it == _sections.end()) {
+            _current = NULL;
+            return false;
+        }
+        _current = &it->second;
+        _pos = 0;
+        _ok = true;
+        return true;
+    }
+
+    // False if any Get on the current section ran past its end.
+    bool Ok() const { return _ok && _current && _pos == _current->size(); }
+
+    template <class T> VOID Get(T &value) {
+        if (!Consume(sizeof(T)))
+            return;
+        memcpy(&value, _current->data() + _pos - sizeof(T), sizeof(T));
+    }
+
+    template <class T> VOID GetVector(std::vector<T> &v) {
+        UINT64 n = 0;
+        Get(n);
+        if (!Consume(n * sizeof(T)))
+            return;
+        v.resize(n);
+        if (n)
+            memcpy(&v[0], _current->data() + _pos - n * sizeof(T),
+                   n * sizeof(T));
+    }
+    VOID GetVector(std::vector<bool> &v) {
+        UINT64 n = 0;
+        Get(n);
+        v.resize(n);
+        for (UINT64 i = 0; i < n && _ok; i++) {
+            UINT8 b = 0;
+            Get(b);
+            v[i] = b;
+        }
+    }
+    // Arrays must have been saved with the same number of elements.
+    template <class T> VOID GetArray(T *a, UINT64 n) {
+        UINT64 saved = 0;
+        Get(saved);
+        if (saved != n) {
+            _ok = false;
+            return;
+        }
+        if (!Consume(n * sizeof(T)))
+            return;
+        memcpy(a, _current->data() + _pos - n * sizeof(T), n * sizeof(T));
+    }
+
+  private:
+    std::map<std::string, std::string> _sections;
+    const std::string *_current;
+    size_t _pos;
+    bool _ok;
+
+    bool Consume(size_t bytes) {
+        if (!_ok || !_current || _pos + bytes > _current->size()) {
+            _ok = false;
+            return false;
+        }
+        _pos += bytes;
+        return true;
+    }
+
+    template <class T> static bool ReadRaw(std::ifstream &in, T &value) {
+        return bool(in.read(reinterpret_cast<char *>(&value), sizeof(T)));
+    }
+};
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,130 @@
+#ifndef STATS_WRITER_H
+#define STATS_WRITER_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * `STATS_WRITER` serializes counters as flat records, either one JSON object
+ * per line (JSON Lines) or CSV with a single header line.
+ *
+ * Every record of a tool has the same columns, named "<group>.<field>", so a
+ * whole results directory loads with one columnar read, e.g.
+ *     pd.concat(pd.read_json(f, lines=True) for f in files)
+ *
+ * Counters are collected as (group, field, value) triples pointing straight
+ * at the stat arrays' values, so no strings are built while collecting.
+ * Groups and fields must outlive the writer (literals, or names cached by
+ * the caller at initialization time).
+ **/
+class STATS_WRITER {
+  public:
+    typedef enum { FORMAT_TEXT = 0, FORMAT_JSON, FORMAT_CSV } FORMAT;
+
+    static FORMAT ParseFormat(const std::string &format) {
+        if (format == "json")
+            return FORMAT_JSON;
+        if (format == "csv")
+            return FORMAT_CSV;
+        return FORMAT_TEXT;
+    }
+
+    STATS_WRITER(FORMAT format) : _format(format), _headerWritten(false) {}
+
+    FORMAT Format() const { return _format; }
+
+    VOID Clear() { _fields.clear(); }
+
+    VOID Add(const char *group, const char *field, UINT64 value) {
+        FIELD f = {group, field, FIELD_UINT, {value}};
+        _fields.push_back(f);
+    }
+    VOID Add(const char *group, const char *field, double value) {
+        FIELD f = {group, field, FIELD_DOUBLE, {0}};
+        f.value.d = value;
+        _fields.push_back(f);
+    }
+    VOID Add(const char *group, const char *field, const char *value) {
+        FIELD f = {group, field, FIELD_STRING, {0}};
+        f.value.s = value;
+        _fields.push_back(f);
+    }
+
+    // Writes the collected fields as one record.
+    VOID Write(std::ostream &out) {
+        if (_format == FORMAT_JSON) {
+            out << '{';
+            for (size_t i = 0; i < _fields.size(); i++) {
+                if (i)
+                    out << ", ";
+                out << '"';
+                WriteKey(out, _fields[i]);
+                out << "\": ";
+                WriteValue(out, _fields[i]);
+            }
+            out << "}\n";
+        } else if (_format == FORMAT_CSV) {
+            if (!_headerWritten) {
+                for (size_t i = 0; i < _fields.size(); i++) {
+                    if (i)
+                        out << ',';
+                    WriteKey(out, _fields[i]);
+                }
+                out << '\n';
+                _headerWritten = true;
+            }
+            for (size_t i = 0; i < _fields.size(); i++) {
+                if (i)
+                    out << ',';
+                WriteValue(out, _fields[i]);
+            }
+            out << '\n';
+        }
+        out.flush();
+    }
+
+  private:
+    typedef enum { FIELD_UINT, FIELD_DOUBLE, FIELD_STRING } FIELD_TYPE;
+
+    typedef struct {
+        const char *group;
+        const char *field;
+        FIELD_TYPE type;
+        union {
+            UINT64 u;
+            double d;
+            const char *s;
+        } value;
+    } FIELD;
+
+    FORMAT _format;
+    bool _headerWritten;
+    std::vector<FIELD> _fields;
+
+    static VOID WriteKey(std::ostream &out, const FIELD &f) {
+        if (f.group && f.group[0])
+            out << f.group << '.';
+        out << f.field;
+    }
+
+    static VOID WriteValue(std::ostream &out, const FIELD &f) {
+        switch (f.type) {
+        case FIELD_UINT:
+            out << f.value.u;
+            break;
+        case FIELD_DOUBLE:
+            // NaN/inf are not valid JSON numbers
+            if (f.value.d == f.value.d && f.value.d - f.value.d == 0)
+                out << f.value.d;
+            else
+                out << "null";
+            break;
+        case FIELD_STRING:
+            out << '"' << f.value.s << '"';
+            break;
+        }
+    }
+};
+
+#endif // STATS_WRITER_H
@@ -0,0 +1,107 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstdlib> // free()
+#include <cstring> // memset()
+#include <new>     // placement new
+#include <sys/mman.h>
+
+#include "globals.h"
+
+/**
+ * `SET_ARENA` is one contiguous, cache-line aligned block holding a whole
+ * cache (or Tlb) level: first the array of set objects, then the tags and
+ * replacement state every set points into. A level thus costs a single
+ * allocation, and the tags of neighbouring sets are neighbours in memory.
+ *
+ * With UseHugePages() the block is mmap-ed and advised to be backed by
+ * transparent huge pages, which takes the TLB misses of the simulator itself
+ * off the table for multi-MB levels. Arenas smaller than a huge page, and
+ * hosts without huge pages, get regular aligned memory.
+ **/
+class SET_ARENA {
+  public:
+    static const size_t ALIGNMENT = 64; // host cache line
+
+    // Applies to the arenas created afterwards
+    static bool &UseHugePages() {
+        static bool hugePages = false;
+        return hugePages;
+    }
+
+    SET_ARENA(size_t bytes) : _used(0), _huge(UseHugePages()) {
+        _bytes = RoundUp(bytes, ALIGNMENT);
+        _base = NULL;
+#ifdef MADV_HUGEPAGE
+        // Smaller arenas would waste most of a huge page
+        const size_t HUGE_PAGE = 2 * MEGA;
+        if (_huge && _bytes >= HUGE_PAGE) {
+            _bytes = RoundUp(_bytes, HUGE_PAGE);
+            void *base = mmap(NULL, _bytes, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (base != MAP_FAILED) {
+                madvise(base, _bytes, MADV_HUGEPAGE);
+                _base = (char *)base;
+            }
+        }
+#endif
+        if (_base == NULL) {
+            void *base = NULL;
+            _huge = false;
+            if (posix_memalign(&base, ALIGNMENT, _bytes) != 0)
+                base = NULL;
+            ASSERT(base != NULL, "Could not allocate the set arena");
+            _base = (char *)base;
+        }
+        memset(_base, 0, _bytes);
+    }
+
+    ~SET_ARENA() {
+        if (_huge)
+            munmap(_base, _bytes);
+        else
+            free(_base);
+    }
+
+    // Carves `bytes` out of the arena, 8-byte aligned
+    VOID *Allocate(size_t bytes) {
+        VOID *p = _base + _used;
+        _used += RoundUp(bytes, 8);
+        ASSERTX(_used <= _bytes);
+        return p;
+    }
+
+    size_t Bytes() const { return _bytes; }
+    bool HugePages() const { return _huge; }
+
+  private:
+    char *_base;
+    size_t _bytes;
+    size_t _used;
+    bool _huge;
+
+    static size_t RoundUp(size_t n, size_t to) {
+        return (n + to - 1) / to * to;
+    }
+};
+
+/**
+ * Builds the `numSets` sets of a level, and the arena holding them. SET is a
+ * trivially destructible view that tells how much storage it needs
+ * (StorageBytes) and points into it once attached (Attach).
+ **/
+template <class SET>
+SET *NewSetArray(SET_ARENA *&arena, UINT32 numSets, UINT32 associativity) {
+    const size_t setBytes = (sizeof(SET) + 7) / 8 * 8;
+    const size_t storageBytes = (SET::StorageBytes(associativity) + 7) / 8 * 8;
+
+    arena = new SET_ARENA(numSets * (setBytes + storageBytes));
+    SET *sets = (SET *)arena->Allocate(numSets * setBytes);
+    for (UINT32 i = 0; i < numSets; i++) {
+        new (&sets[i]) SET();
+        sets[i].Attach(arena->Allocate(storageBytes), associativity);
+    }
+    return sets;
+}
+
+#endif // ARENA_H
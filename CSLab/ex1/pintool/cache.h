@@ -1,8 +1,15 @@
 #ifndef CACHE_H
 #define CACHE_H
 
-#include <cstdlib>  // rand()
-#include <iostream> // std::cout ...
+#include <algorithm> // std::min, std::max
+#include <cmath>     // sqrt()
+#include <cstdlib>   // rand()
+#include <iostream>  // std::cout ...
+#include <set>
+
+#include "arena.h"
+#include "dram.h"
+#include "lru_table.h"
 
 /*****************************************************************************/
 /* Policy about L2 inclusion of L1's content                                 */
@@ -43,31 +50,43 @@ CACHE_TAG INVALID_TAG(-1);
  **/
 namespace CACHE_SET {
 
+/**
+ * Sets are views into the arena of their level (see SET_ARENA): the tags of
+ * a set live in the `associativity` entries given to Attach(), in
+ * LRU -> MRU order, the first `_size` of them valid.
+ **/
 class LRU {
   protected:
-    std::vector<CACHE_TAG> _tags;
+    CACHE_TAG *_tags;
+    UINT32 _size;
     UINT32 _associativity;
 
   public:
-    LRU(UINT32 associativity = 8) {
-        _associativity = associativity;
-        _tags.clear();
+    LRU() : _tags(NULL), _size(0), _associativity(0) {}
+
+    static size_t StorageBytes(UINT32 associativity) {
+        return associativity * sizeof(CACHE_TAG);
+    }
+    VOID Attach(VOID *storage, UINT32 associativity) {
+        _tags = (CACHE_TAG *)storage;
+        SetAssociativity(associativity);
     }
 
+    // Empties the set; `associativity` cannot exceed the attached storage
     VOID SetAssociativity(UINT32 associativity) {
         _associativity = associativity;
-        _tags.clear();
+        _size = 0;
     }
     UINT32 GetAssociativity() { return _associativity; }
 
     string Name() { return "LRU"; }
 
     UINT32 Find(CACHE_TAG tag) {
-        for (std::vector<CACHE_TAG>::iterator it = _tags.begin();
-             it != _tags.end(); ++it) {
-            if (*it == tag) { // Tag found, lets make it MRU
-                _tags.erase(it);
-                _tags.push_back(tag);
+        for (UINT32 i = 0; i < _size; i++) {
+            if (_tags[i] == tag) { // Tag found, lets make it MRU
+                for (; i + 1 < _size; i++)
+                    _tags[i] = _tags[i + 1];
+                _tags[_size - 1] = tag;
                 return true;
             }
         }
@@ -77,27 +96,187 @@ class LRU {
 
     CACHE_TAG Replace(CACHE_TAG tag) {
         CACHE_TAG ret = INVALID_TAG;
-        _tags.push_back(tag);
-        if (_tags.size() > _associativity) {
-            ret = *_tags.begin();
-            _tags.erase(_tags.begin());
+        if (_size == _associativity) {
+            ret = _tags[0];
+            for (UINT32 i = 1; i < _size; i++)
+                _tags[i - 1] = _tags[i];
+            _size--;
         }
+        _tags[_size++] = tag;
         return ret;
     }
 
     VOID DeleteIfPresent(CACHE_TAG tag) {
-        for (std::vector<CACHE_TAG>::iterator it = _tags.begin();
-             it != _tags.end(); ++it) {
-            if (*it == tag) { // Tag found
-                _tags.erase(it);
+        for (UINT32 i = 0; i < _size; i++) {
+            if (_tags[i] == tag) { // Tag found
+                for (; i + 1 < _size; i++)
+                    _tags[i] = _tags[i + 1];
+                _size--;
                 break;
             }
         }
     }
+
+    // Brings the tags into the host caches ahead of a Find()
+    VOID Prefetch() const { __builtin_prefetch(_tags); }
+
+    // Tags are kept in LRU -> MRU order, so they are the whole state
+    VOID Save(SNAPSHOT_WRITER &s) const { s.PutArray(_tags, _size); }
+    VOID Load(SNAPSHOT_READER &s) {
+        std::vector<CACHE_TAG> tags;
+        s.GetVector(tags);
+        // Only the MRU entries fit, should the snapshot be corrupt
+        size_t first = 0;
+        if (tags.size() > _associativity)
+            first = tags.size() - _associativity;
+        _size = 0;
+        for (size_t i = first; i < tags.size(); i++)
+            _tags[_size++] = tags[i];
+    }
 };
 
+// Same policy, with a cost independent of the associativity (see LRU_TABLE)
+typedef LRU_TABLE<CACHE_TAG> FA_LRU;
+
 } // namespace CACHE_SET
 
+/*****************************************************************************/
+/* L2 set index functions                                                    */
+/*****************************************************************************/
+typedef enum {
+    L2_INDEX_MODULO = 0, // low bits of the line address
+    L2_INDEX_XOR,        // low bits XOR-ed with the folded tag
+    L2_INDEX_PRIME,      // line address modulo the largest prime <= #sets
+    L2_INDEX_SKEWED      // a different XOR hash per way (skewed-associative)
+} L2_INDEX;
+
+static const char *L2_INDEX_NAMES[] = {"modulo", "xor", "prime", "skewed"};
+
+static inline L2_INDEX ParseL2Index(const std::string &name) {
+    for (UINT32 i = 0; i <= L2_INDEX_SKEWED; i++)
+        if (name == L2_INDEX_NAMES[i])
+            return L2_INDEX(i);
+    ASSERT(false, "Unknown L2 index function " + name);
+    return L2_INDEX_MODULO;
+}
+
+static inline bool IsPrime(UINT32 n) {
+    for (UINT32 d = 2; d * d <= n; d++)
+        if (n % d == 0)
+            return false;
+    return n >= 2;
+}
+
+// XOR of the `bits`-wide chunks of `tag`
+static inline ADDRINT FoldTag(ADDRINT tag, UINT32 bits) {
+    ADDRINT fold = 0;
+    if (bits == 0)
+        return 0;
+    for (; tag; tag >>= bits)
+        fold ^= tag;
+    return fold & ((ADDRINT(1) << bits) - 1);
+}
+
+/**
+ * Skewed-associative tag array (Seznec; the per-way hashing of ZCache).
+ * Way `w` indexes line `l` with tag `t = l >> indexBits` at
+ *     (l ^ Hash(w, t)) mod #sets
+ * so blocks that conflict in one way are spread over different sets in the
+ * others. Since the hash only depends on the stored tag, the full address of
+ * a victim is rebuilt from its way, set and tag. Replacement picks the least
+ * recently used of the candidate positions; there are no relocation walks.
+ **/
+class SKEWED_ARRAY {
+  private:
+    UINT32 _ways;
+    UINT32 _indexBits;
+    ADDRINT _setIndexMask;
+    std::vector<ADDRINT> _tags;   // [way * #sets + set]
+    std::vector<UINT64> _stamps; // last use; 0 marks an empty position
+    UINT64 _clock;
+
+    ADDRINT Hash(UINT32 way, ADDRINT tag) const {
+        UINT64 h = (UINT64(tag) + way) * 0x9E3779B97F4A7C15ULL;
+        return _indexBits ? ADDRINT(h >> (64 - _indexBits)) : 0;
+    }
+    UINT32 Slot(UINT32 way, ADDRINT line) const {
+        ADDRINT set = (line ^ Hash(way, line >> _indexBits)) & _setIndexMask;
+        return way * (_setIndexMask + 1) + set;
+    }
+
+  public:
+    SKEWED_ARRAY(UINT32 sets, UINT32 ways)
+        : _ways(ways), _indexBits(FloorLog2(sets)), _setIndexMask(sets - 1),
+          _tags(sets * ways, 0), _stamps(sets * ways, 0), _clock(0) {}
+
+    string Name() const { return "LRU-skewed"; }
+    size_t Bytes() const {
+        return _tags.size() * sizeof(ADDRINT) + _stamps.size() * sizeof(UINT64);
+    }
+
+    bool Find(ADDRINT line) {
+        const ADDRINT tag = line >> _indexBits;
+        for (UINT32 w = 0; w < _ways; w++) {
+            UINT32 slot = Slot(w, line);
+            if (_stamps[slot] && _tags[slot] == tag) {
+                _stamps[slot] = ++_clock;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Inserts `line`. Returns true and sets `victim` if a line was evicted.
+    bool Replace(ADDRINT line, ADDRINT &victim) {
+        UINT32 way = 0, slot = Slot(0, line);
+        for (UINT32 w = 1; w < _ways && _stamps[slot]; w++) {
+            UINT32 candidate = Slot(w, line);
+            if (_stamps[candidate] < _stamps[slot]) {
+                way = w;
+                slot = candidate;
+            }
+        }
+
+        bool evicted = _stamps[slot] != 0;
+        if (evicted) {
+            ADDRINT tag = _tags[slot];
+            ADDRINT set = slot - way * (_setIndexMask + 1);
+            victim = (tag << _indexBits) |
+                     ((set ^ Hash(way, tag)) & _setIndexMask);
+        }
+        _tags[slot] = line >> _indexBits;
+        _stamps[slot] = ++_clock;
+        return evicted;
+    }
+
+    VOID DeleteIfPresent(ADDRINT line) {
+        const ADDRINT tag = line >> _indexBits;
+        for (UINT32 w = 0; w < _ways; w++) {
+            UINT32 slot = Slot(w, line);
+            if (_stamps[slot] && _tags[slot] == tag) {
+                _stamps[slot] = 0;
+                return;
+            }
+        }
+    }
+
+    VOID Save(SNAPSHOT_WRITER &s) const {
+        s.Put(_clock);
+        s.PutVector(_tags);
+        s.PutVector(_stamps);
+    }
+    VOID Load(SNAPSHOT_READER &s) {
+        s.Get(_clock);
+        s.GetVector(_tags);
+        s.GetVector(_stamps);
+    }
+    VOID Clear() {
+        _tags.assign(_tags.size(), 0);
+        _stamps.assign(_stamps.size(), 0);
+        _clock = 0;
+    }
+};
+
 template <class SET> class TWO_LEVEL_CACHE {
   public:
     typedef enum {
@@ -108,15 +287,32 @@ template <class SET> class TWO_LEVEL_CACHE {
 
   private:
     enum { HIT_L1 = 0, HIT_L2, MISS_L2, ACCESS_RESULT_NUM };
+    // Where the cycles below L1 go (see L2Cycles() ...)
+    enum { CYCLES_L2 = 0, CYCLES_MEMORY, CYCLES_PREFETCH, CYCLES_NUM };
 
     static const UINT32 HIT_MISS_NUM = 2;
     CACHE_STATS _l1_access[ACCESS_TYPE_NUM][HIT_MISS_NUM];
     CACHE_STATS _l2_access[ACCESS_TYPE_NUM][HIT_MISS_NUM];
+    CACHE_STATS _cycles[CYCLES_NUM];
+    CACHE_STATS _l1_splits; // accesses crossing an L1 line boundary
 
     UINT32 _latencies[ACCESS_RESULT_NUM];
 
     SET *_l1_sets;
     SET *_l2_sets;
+    SET_ARENA *_l1_arena; // storage of the sets of each level
+    SET_ARENA *_l2_arena; // NULL with a skewed L2
+
+    // optional L1 instruction cache, sharing L2 with the data side
+    SET *_l1i_sets;
+    SET_ARENA *_l1i_arena;
+    UINT32 _l1i_cacheSize;
+    UINT32 _l1i_blockSize;
+    UINT32 _l1i_associativity;
+    UINT32 _l1i_lineShift;
+    UINT32 _l1i_setIndexMask;
+    CACHE_STATS _l1i_access[HIT_MISS_NUM];
+    CACHE_STATS _l2_fetch_access[HIT_MISS_NUM];
 
     const std::string _name;
     const UINT32 _l1_cacheSize;
@@ -135,6 +331,56 @@ template <class SET> class TWO_LEVEL_CACHE {
     // how many lines ahead to prefetch in L2 (0 disables prefetching)
     const UINT32 _l2_prefetch_lines;
 
+    // L1 data line of the last access, if it is still cached. It is then the
+    // MRU line of its set, so repeating it is a hit that changes no state.
+    // Cleared when the line is back-invalidated.
+    ADDRINT _l1_lastLine;
+
+    // main memory model behind L2 (NULL uses the fixed L2 miss latency)
+    DRAM *_dram;
+
+    // L2 set index function (see L2_INDEX)
+    L2_INDEX _l2_index;
+    UINT32 _l2_prime;             // #sets used by L2_INDEX_PRIME
+    SKEWED_ARRAY *_l2_skewed;     // replaces _l2_sets for L2_INDEX_SKEWED
+
+    // L2 set sampling: only sets with _l2_sample_slot >= 0 are modeled
+    UINT32 _l2_sample_ratio; // 1 models every set
+    UINT32 _l2_sampled_sets;
+    std::vector<INT32> _l2_sample_slot;
+    std::vector<CACHE_STATS> _l2_set_misses; // data misses per sampled set
+    CACHE_STATS _l2_unmodeled_access[ACCESS_TYPE_NUM];
+    CACHE_STATS _l2_unmodeled_fetches;
+    CACHE_STATS _l2_unmodeled_prefetches;
+    UINT64 _l2_sampled_cycles; // cycles spent below L1 in sampled sets
+
+    // optional fully-associative victim cache of L1D, holding the line
+    // addresses of L1D evictions
+    typedef LRU_TABLE<CACHE_TAG> VICTIM_CACHE;
+    VICTIM_CACHE *_vc;
+    SET_ARENA *_vc_arena;
+    UINT32 _vc_entries;
+    UINT32 _vc_latency;
+    CACHE_STATS _vc_access[HIT_MISS_NUM];
+
+    // Software prefetches (see SoftwarePrefetch())
+    CACHE_STATS _swpf_issued[2];   // into L1 (and L2), into L2 only
+    CACHE_STATS _swpf_redundant;   // line already at the target level
+    CACHE_STATS _swpf_filled;      // line brought into L1 or L2
+    CACHE_STATS _swpf_useful;      // line used by a demand access
+    CACHE_STATS _swpf_unused;      // line left L2 before any use
+    std::set<ADDRINT> _swpf_lines; // L2 lines brought in, not used yet
+
+    // Write-combining buffers of the non-temporal stores, oldest first
+    UINT32 _wc_entries;
+    std::vector<ADDRINT> _wc_lines;
+    std::vector<UINT64> _wc_masks; // bytes written, _wc_mask_words per line
+    UINT32 _wc_mask_words;
+    CACHE_STATS _wc_stores;
+    CACHE_STATS _wc_merges;         // stores into an already open buffer
+    CACHE_STATS _wc_flushes;
+    CACHE_STATS _wc_partial_flushes; // flushes of a partly written line
+
     CACHE_STATS L1SumAccess(bool hit) const {
         CACHE_STATS sum = 0;
         for (UINT32 accessType = 0; accessType < ACCESS_TYPE_NUM; accessType++)
@@ -170,6 +416,186 @@ template <class SET> class TWO_LEVEL_CACHE {
         tag = tag >> FloorLog2(setIndexMask + 1);
     }
 
+    VOID BackInvalidate(ADDRINT replacedAddr);
+
+    // Allocates `tag` in L1D set `setIndex`; the victim goes to the victim
+    // cache, if any.
+    VOID L1Replace(CACHE_TAG tag, UINT32 setIndex) {
+        CACHE_TAG replaced = _l1_sets[setIndex].Replace(tag);
+        if (replaced == INVALID_TAG ||
+            (!_vc && (!L2Sampling() || _swpf_lines.empty())))
+            return;
+        const UINT32 indexBits = FloorLog2(L1NumSets());
+        const ADDRINT line = (ADDRINT(replaced) << indexBits) | setIndex;
+        if (_vc)
+            _vc->Replace(CACHE_TAG(line));
+        if (L2Sampling() && !_swpf_lines.empty())
+            L1EvictedUnmodeled(line << L1LineShift());
+    }
+    // A prefetched line of an unmodeled L2 set only lives in L1, so it goes
+    // unused when it leaves L1
+    VOID L1EvictedUnmodeled(ADDRINT addr) {
+        CACHE_TAG l2Tag;
+        UINT32 l2SetIndex;
+        L2SplitAddress(addr, l2Tag, l2SetIndex);
+        if (!L2Modeled(l2SetIndex) &&
+            _swpf_lines.erase(addr >> L2LineShift()))
+            _swpf_unused++;
+    }
+    VOID FlushWriteCombining(UINT32 entry, UINT64 now);
+    VOID StoreNonTemporalLine(ADDRINT addr, UINT32 size, UINT64 byteMask,
+                              UINT64 now);
+    bool WriteCombiningFull(UINT32 entry) const {
+        const UINT64 full = L1BlockSize() >= 64
+                                ? ~UINT64(0)
+                                : (UINT64(1) << L1BlockSize()) - 1;
+        for (UINT32 w = 0; w < _wc_mask_words; w++)
+            if (_wc_masks[entry * _wc_mask_words + w] != full)
+                return false;
+        return true;
+    }
+    VOID InvalidateLine(ADDRINT addr);
+
+    UINT32 AccessHierarchy(ADDRINT addr, ACCESS_TYPE accessType, UINT64 now);
+
+    // Accesses simulated per AccessBatch() step: large enough to overlap
+    // the host cache misses of a step, small enough to stay in L1.
+    static const UINT32 BATCH_STEP = 32;
+
+    // Splits `addr` into L2 tag and set according to the index function.
+    // With skewing the set depends on the way, so the tag is the whole line
+    // address and the set is only meaningful to set sampling (unsupported).
+    VOID L2SplitAddress(const ADDRINT addr, CACHE_TAG &tag,
+                        UINT32 &setIndex) const {
+        const ADDRINT line = addr >> L2LineShift();
+        const UINT32 indexBits = FloorLog2(L2NumSets());
+        switch (_l2_index) {
+        case L2_INDEX_XOR:
+            tag = line >> indexBits;
+            setIndex = (line ^ FoldTag(tag, indexBits)) & L2SetIndexMask();
+            break;
+        case L2_INDEX_PRIME:
+            tag = line / _l2_prime;
+            setIndex = line % _l2_prime;
+            break;
+        case L2_INDEX_SKEWED:
+            tag = line;
+            setIndex = 0;
+            break;
+        default:
+            SplitAddress(addr, L2LineShift(), L2SetIndexMask(), tag, setIndex);
+        }
+    }
+    // Inverse of L2SplitAddress(): the address of a (replaced) L2 line
+    ADDRINT L2LineAddress(CACHE_TAG tag, UINT32 setIndex) const {
+        const UINT32 indexBits = FloorLog2(L2NumSets());
+        ADDRINT line;
+        switch (_l2_index) {
+        case L2_INDEX_XOR:
+            line = (ADDRINT(tag) << indexBits) |
+                   ((setIndex ^ FoldTag(tag, indexBits)) & L2SetIndexMask());
+            break;
+        case L2_INDEX_PRIME:
+            line = ADDRINT(tag) * _l2_prime + setIndex;
+            break;
+        case L2_INDEX_SKEWED:
+            line = tag;
+            break;
+        default:
+            line = (ADDRINT(tag) << indexBits) | setIndex;
+        }
+        return line << L2LineShift();
+    }
+
+    bool L2Find(CACHE_TAG tag, UINT32 setIndex) {
+        if (_l2_skewed)
+            return _l2_skewed->Find(tag);
+        return _l2_sets[setIndex].Find(tag);
+    }
+    VOID L2DeleteIfPresent(CACHE_TAG tag, UINT32 setIndex) {
+        if (_l2_skewed)
+            _l2_skewed->DeleteIfPresent(tag);
+        else
+            _l2_sets[setIndex].DeleteIfPresent(tag);
+    }
+    // Allocates a line in L2; with inclusion the victim also leaves the L1s.
+    VOID L2Replace(CACHE_TAG tag, UINT32 setIndex) {
+        ADDRINT replacedLine;
+        if (_l2_skewed) {
+            if (!_l2_skewed->Replace(tag, replacedLine))
+                return;
+            replacedLine <<= L2LineShift();
+        } else {
+            CACHE_TAG replaced = _l2_sets[setIndex].Replace(tag);
+            if (replaced == INVALID_TAG)
+                return;
+            replacedLine = L2LineAddress(replaced, setIndex);
+        }
+        if (L2_INCLUSIVE == 1)
+            BackInvalidate(replacedLine);
+        if (!_swpf_lines.empty() &&
+            _swpf_lines.erase(replacedLine >> L2LineShift()))
+            _swpf_unused++;
+    }
+
+    // Serves an L2 miss
+    UINT32 MemoryAccess(ADDRINT addr, UINT64 now) {
+        if (_dram == NULL) {
+            _cycles[CYCLES_MEMORY] += _latencies[MISS_L2];
+            return _latencies[MISS_L2];
+        }
+        const UINT32 latency = _dram->Access(addr, now);
+        const UINT32 delay = _dram->PrefetchDelay();
+        _cycles[CYCLES_PREFETCH] += delay;
+        _cycles[CYCLES_MEMORY] += latency - delay;
+        return latency;
+    }
+
+    bool L2Modeled(UINT32 l2SetIndex) const {
+        return _l2_sample_ratio == 1 || _l2_sample_slot[l2SetIndex] >= 0;
+    }
+    // Cycles charged to an access to a set that is not modeled: the mean
+    // cost below L1 observed in the sampled sets so far.
+    UINT32 L2UnmodeledLatency() const {
+        CACHE_STATS sampled = L2Accesses() + L2FetchHits() + L2FetchMisses();
+        if (sampled == 0)
+            return _latencies[HIT_L2];
+        return UINT32(_l2_sampled_cycles / sampled);
+    }
+    // Charges that estimate: up to an L2 hit on L2, the rest on memory
+    UINT32 L2Unmodeled() {
+        const UINT32 cycles = L2UnmodeledLatency();
+        const UINT32 l2 = std::min(cycles, _latencies[HIT_L2]);
+        _cycles[CYCLES_L2] += l2;
+        _cycles[CYCLES_MEMORY] += cycles - l2;
+        return cycles;
+    }
+
+    static std::string SnapshotKey(const char *level, UINT32 size,
+                                   UINT32 block, UINT32 assoc,
+                                   std::string policy) {
+        std::ostringstream key;
+        key << level << ":" << size << ":" << block << ":" << assoc << ":"
+            << policy;
+        return key.str();
+    }
+    // Sampled L2 contents differ from full ones, keep them apart
+    std::string L2SetsName() const {
+        std::string name = _l2_skewed ? _l2_skewed->Name() : _l2_sets[0].Name();
+        if (_l2_index != L2_INDEX_MODULO)
+            name += std::string(":") + L2_INDEX_NAMES[_l2_index];
+        if (L2Sampling())
+            name += ":S" + decstr(_l2_sample_ratio);
+        return name;
+    }
+    // Any set type: the L1/L2 SETs, or the victim cache
+    template <class S>
+    static VOID SaveSets(SNAPSHOT_WRITER &s, const std::string &key,
+                         const S *sets, UINT32 numSets);
+    template <class S>
+    static bool LoadSets(SNAPSHOT_READER &s, const std::string &key, S *sets,
+                         UINT32 numSets, UINT32 associativity);
+
   public:
     // constructors/destructors
     TWO_LEVEL_CACHE(std::string name, UINT32 l1CacheSize, UINT32 l1BlockSize,
@@ -177,6 +603,20 @@ template <class SET> class TWO_LEVEL_CACHE {
                     UINT32 l2BlockSize, UINT32 l2Associativity,
                     UINT32 l2PrefetchLines, UINT32 l1HitLatency = 1,
                     UINT32 l2HitLatency = 20, UINT32 l2MissLatency = 200);
+    ~TWO_LEVEL_CACHE() {
+        delete _l1_arena; // the sets live in the arenas
+        delete _l2_arena;
+        delete _l1i_arena;
+        delete _vc_arena;
+        delete _l2_skewed;
+    }
+
+    // Host memory holding the tags and replacement state of all levels
+    size_t SetBytes() const {
+        return _l1_arena->Bytes() + (_l2_arena ? _l2_arena->Bytes() : 0) +
+               (_l1i_arena ? _l1i_arena->Bytes() : 0) +
+               (_l2_skewed ? _l2_skewed->Bytes() : 0);
+    }
 
     // Stats
     CACHE_STATS L1Hits(ACCESS_TYPE accessType) const {
@@ -202,12 +642,95 @@ template <class SET> class TWO_LEVEL_CACHE {
     CACHE_STATS L1Misses() const { return L1SumAccess(false); }
     CACHE_STATS L2Misses() const { return L2SumAccess(false); }
     CACHE_STATS L1Accesses() const { return L1Hits() + L1Misses(); }
+    CACHE_STATS L1Splits() const { return _l1_splits; }
     CACHE_STATS L2Accesses() const { return L2Hits() + L2Misses(); }
+    CACHE_STATS L1IHits() const { return _l1i_access[true]; }
+    CACHE_STATS L1IMisses() const { return _l1i_access[false]; }
+    CACHE_STATS L1IAccesses() const { return L1IHits() + L1IMisses(); }
+    CACHE_STATS L2FetchHits() const { return _l2_fetch_access[true]; }
+    CACHE_STATS L2FetchMisses() const { return _l2_fetch_access[false]; }
+    bool HasInstructionCache() const { return _l1i_sets != NULL; }
+    CACHE_STATS VictimHits() const { return _vc_access[true]; }
+    CACHE_STATS VictimMisses() const { return _vc_access[false]; }
+    bool HasVictimCache() const { return _vc != NULL; }
+
+    // Cycle accounting: L1 hit latency of every data access, L1 misses
+    // served by the victim cache or L2, L2 misses served by memory and, with
+    // the DRAM model, the part of the latter spent behind prefetches.
+    UINT64 L1Cycles() const { return L1Accesses() * _latencies[HIT_L1]; }
+    UINT64 L2Cycles() const { return _cycles[CYCLES_L2]; }
+    UINT64 MemoryCycles() const { return _cycles[CYCLES_MEMORY]; }
+    UINT64 PrefetchCycles() const { return _cycles[CYCLES_PREFETCH]; }
+
+    // With set sampling the L2 counters above only cover the sampled sets.
+    // The estimates below scale them to the whole cache.
+    bool L2Sampling() const { return _l2_sample_ratio > 1; }
+    double L2SampleScale() const {
+        return (double)L2NumSets() / (double)_l2_sampled_sets;
+    }
+    double L2EstimatedMisses() const { return L2Misses() * L2SampleScale(); }
+    double L2EstimatedMissesError() const;
 
     string StatsLong(string prefix = "") const;
     string PrintCache(string prefix = "") const;
-
-    UINT32 Access(ADDRINT addr, ACCESS_TYPE accessType);
+    VOID Export(STATS_WRITER &w) const;
+
+    // Checkpointing of the cache contents (not the stats)
+    VOID Save(SNAPSHOT_WRITER &s) const;
+    bool Load(SNAPSHOT_READER &s);
+
+    VOID AttachMemory(DRAM *dram) { _dram = dram; }
+    VOID SampleL2Sets(UINT32 ratio);
+    VOID SetL2Index(L2_INDEX index);
+    VOID AttachInstructionCache(UINT32 cacheSize, UINT32 blockSize,
+                                UINT32 associativity);
+    VOID AttachVictimCache(UINT32 entries, UINT32 latency);
+
+    // `now` is the current CPU cycle, only used by the main memory model.
+    UINT32 Access(ADDRINT addr, ACCESS_TYPE accessType, UINT64 now = 0) {
+        if ((addr >> _l1_lineShift) == _l1_lastLine) {
+            _l1_access[accessType][true]++;
+            return _latencies[HIT_L1];
+        }
+        return AccessHierarchy(addr, accessType, now);
+    }
+    // Access to the `size` bytes at `addr`. One that crosses L1 lines is
+    // split into an access per line, each issued when the previous completes.
+    UINT32 AccessRange(ADDRINT addr, UINT32 size, ACCESS_TYPE accessType,
+                       UINT64 now = 0) {
+        const ADDRINT firstLine = addr >> _l1_lineShift;
+        const ADDRINT lastLine = (addr + size - 1) >> _l1_lineShift;
+        UINT32 cycles = Access(addr, accessType, now);
+        if (size > 1 && lastLine != firstLine) {
+            _l1_splits++;
+            for (ADDRINT line = firstLine + 1; line <= lastLine; line++)
+                cycles += Access(line << _l1_lineShift, accessType,
+                                 now + cycles);
+        }
+        return cycles;
+    }
+    // Same as `n` calls to Access(), with `now` advancing by the cycles of
+    // each access. Returns the total cycles.
+    UINT64 AccessBatch(const ADDRINT *addrs, const ACCESS_TYPE *types,
+                       size_t n, UINT64 now = 0);
+    // Software prefetch of the line of `addr` into L1 and L2, or into L2
+    // only. It does not stall: no cycles are returned.
+    VOID SoftwarePrefetch(ADDRINT addr, bool toL1, UINT64 now = 0);
+    // Non-temporal store: no allocation, the data goes to memory through a
+    // write-combining buffer. Posted, so it costs no cycles. Bit i of
+    // `byteMask` clear means byte i is not written (masked stores).
+    VOID StoreNonTemporal(ADDRINT addr, UINT32 size, UINT64 now = 0,
+                          UINT64 byteMask = ~UINT64(0));
+    VOID SetWriteCombiningBuffers(UINT32 entries);
+    // Writes the open write-combining buffers to memory, e.g. at the end
+    // of the simulation
+    VOID DrainWriteCombining(UINT64 now = 0) {
+        while (!_wc_lines.empty())
+            FlushWriteCombining(0, now);
+    }
+    // Instruction fetch of the line containing `addr`. Returns the stall
+    // cycles on top of a (pipelined) L1I hit, i.e. 0 on a hit.
+    UINT32 Fetch(ADDRINT addr, UINT64 now = 0);
 };
 
 template <class SET>
@@ -223,7 +746,7 @@ TWO_LEVEL_CACHE<SET>::TWO_LEVEL_CACHE(
       _l2_lineShift(FloorLog2(l2BlockSize)),
       _l1_setIndexMask((l1CacheSize / (l1Associativity * l1BlockSize)) - 1),
       _l2_setIndexMask((l2CacheSize / (l2Associativity * l2BlockSize)) - 1),
-      _l2_prefetch_lines(l2PrefetchLines) {
+      _l2_prefetch_lines(l2PrefetchLines), _dram(NULL) {
 
     // They all need to be power of 2
     ASSERTX(IsPowerOf2(_l1_blockSize));
@@ -236,24 +759,183 @@ TWO_LEVEL_CACHE<SET>::TWO_LEVEL_CACHE(
     ASSERTX(_l1_blockSize <= _l2_blockSize);
 
     // Allocate space for L1 and L2 sets
-    _l1_sets = new SET[L1NumSets()];
-    _l2_sets = new SET[L2NumSets()];
+    _l1_sets = NewSetArray<SET>(_l1_arena, L1NumSets(), _l1_associativity);
+    _l2_sets = NewSetArray<SET>(_l2_arena, L2NumSets(), _l2_associativity);
+    _l1i_sets = NULL;
+    _l1i_arena = NULL;
+    _vc = NULL;
+    _vc_arena = NULL;
+    _vc_entries = _vc_latency = 0;
+    _vc_access[false] = _vc_access[true] = 0;
+    _l1_lastLine = ~ADDRINT(0);
 
     _latencies[HIT_L1] = l1HitLatency;
     _latencies[HIT_L2] = l2HitLatency;
     _latencies[MISS_L2] = l2MissLatency;
 
-    for (UINT32 i = 0; i < L1NumSets(); i++)
-        _l1_sets[i].SetAssociativity(_l1_associativity);
-    for (UINT32 i = 0; i < L2NumSets(); i++)
-        _l2_sets[i].SetAssociativity(_l2_associativity);
-
     for (UINT32 accessType = 0; accessType < ACCESS_TYPE_NUM; accessType++) {
         _l1_access[accessType][false] = 0;
         _l1_access[accessType][true] = 0;
         _l2_access[accessType][false] = 0;
         _l2_access[accessType][true] = 0;
     }
+    _l1i_access[false] = _l1i_access[true] = 0;
+    for (UINT32 i = 0; i < CYCLES_NUM; i++)
+        _cycles[i] = 0;
+    _l2_fetch_access[false] = _l2_fetch_access[true] = 0;
+    _l1_splits = 0;
+
+    _swpf_issued[0] = _swpf_issued[1] = 0;
+    _swpf_redundant = _swpf_filled = _swpf_useful = _swpf_unused = 0;
+    _wc_entries = 4;
+    _wc_mask_words = std::max(1U, l1BlockSize / 64);
+    _wc_stores = _wc_merges = _wc_flushes = _wc_partial_flushes = 0;
+
+    _l2_index = L2_INDEX_MODULO;
+    _l2_prime = L2NumSets();
+    _l2_skewed = NULL;
+
+    _l2_sample_ratio = 1;
+    _l2_sampled_sets = L2NumSets();
+    _l2_unmodeled_access[ACCESS_TYPE_LOAD] = 0;
+    _l2_unmodeled_access[ACCESS_TYPE_STORE] = 0;
+    _l2_unmodeled_fetches = 0;
+    _l2_unmodeled_prefetches = 0;
+    _l2_sampled_cycles = 0;
+}
+
+/**
+ * Models only about 1/ratio of the L2 sets. A set is picked by hashing its
+ * index, so that sampled sets are spread over the index space rather than
+ * aligned with power-of-two strides. Accesses to other sets still update L1
+ * (which stays exact), but are charged the mean L2 cost of the sampled sets
+ * and never cause back-invalidations.
+ **/
+template <class SET>
+VOID TWO_LEVEL_CACHE<SET>::SampleL2Sets(UINT32 ratio) {
+    ASSERTX(ratio >= 1);
+    ASSERT(ratio == 1 || !_l2_skewed, "L2 set sampling needs a set index");
+    _l2_sample_ratio = ratio;
+    if (ratio == 1)
+        return;
+
+    _l2_sampled_sets = 0;
+    _l2_sample_slot.assign(L2NumSets(), -1);
+    for (UINT32 i = 0; i < L2NumSets(); i++) {
+        UINT32 h = i * 0x9E3779B1u; // Fibonacci hashing
+        h ^= h >> 16;
+        if (h % ratio == 0)
+            _l2_sample_slot[i] = _l2_sampled_sets++;
+    }
+    if (_l2_sampled_sets == 0)
+        _l2_sample_slot[0] = _l2_sampled_sets++;
+    _l2_set_misses.assign(_l2_sampled_sets, 0);
+}
+
+/**
+ * Selects the L2 set index function; must be called before any access.
+ * Prime-modulo indexing leaves the sets above the largest prime unused.
+ **/
+template <class SET> VOID TWO_LEVEL_CACHE<SET>::SetL2Index(L2_INDEX index) {
+    _l2_index = index;
+    if (index == L2_INDEX_PRIME) {
+        _l2_prime = L2NumSets();
+        while (_l2_prime > 2 && !IsPrime(_l2_prime))
+            _l2_prime--;
+    }
+    if (index == L2_INDEX_SKEWED && !_l2_skewed) {
+        ASSERT(!L2Sampling(), "L2 set sampling needs a set index");
+        _l2_skewed = new SKEWED_ARRAY(L2NumSets(), _l2_associativity);
+        delete _l2_arena; // the skewed array holds the L2 tags instead
+        _l2_arena = NULL;
+        _l2_sets = NULL;
+    }
+    if (index != L2_INDEX_SKEWED && _l2_skewed) {
+        delete _l2_skewed;
+        _l2_skewed = NULL;
+        _l2_sets = NewSetArray<SET>(_l2_arena, L2NumSets(), _l2_associativity);
+    }
+}
+
+// Half-width of the 95% confidence interval of L2EstimatedMisses(), treating
+// the per-set miss counts of the sampled sets as a simple random sample
+// (without replacement) of all sets.
+template <class SET>
+double TWO_LEVEL_CACHE<SET>::L2EstimatedMissesError() const {
+    const double k = _l2_sampled_sets;
+    const double n = L2NumSets();
+    if (!L2Sampling() || k < 2)
+        return 0.0;
+
+    double sum = 0.0, sumSq = 0.0;
+    for (UINT32 i = 0; i < _l2_sampled_sets; i++) {
+        sum += _l2_set_misses[i];
+        sumSq += (double)_l2_set_misses[i] * _l2_set_misses[i];
+    }
+    double mean = sum / k;
+    double variance = (sumSq - k * mean * mean) / (k - 1);
+    if (variance < 0.0)
+        variance = 0.0;
+    return 1.96 * n * sqrt(variance / k) * sqrt(1.0 - k / n);
+}
+
+template <class SET>
+VOID TWO_LEVEL_CACHE<SET>::AttachInstructionCache(UINT32 cacheSize,
+                                                  UINT32 blockSize,
+                                                  UINT32 associativity) {
+    _l1i_cacheSize = cacheSize;
+    _l1i_blockSize = blockSize;
+    _l1i_associativity = associativity;
+    _l1i_lineShift = FloorLog2(blockSize);
+    _l1i_setIndexMask = (cacheSize / (associativity * blockSize)) - 1;
+
+    ASSERTX(IsPowerOf2(_l1i_blockSize));
+    ASSERTX(IsPowerOf2(_l1i_setIndexMask + 1));
+    ASSERTX(_l1i_cacheSize <= _l2_cacheSize);
+    ASSERTX(_l1i_blockSize <= _l2_blockSize);
+
+    _l1i_sets = NewSetArray<SET>(_l1i_arena, _l1i_setIndexMask + 1,
+                                 _l1i_associativity);
+}
+
+/**
+ * Adds a fully-associative LRU victim cache of `entries` L1D lines. It is
+ * filled by L1D evictions and looked up on L1D misses; a hit costs `latency`
+ * cycles on top of the L1 latency and swaps the line back into L1. With an
+ * inclusive L2 its lines are back-invalidated like the L1 ones.
+ **/
+template <class SET>
+VOID TWO_LEVEL_CACHE<SET>::AttachVictimCache(UINT32 entries, UINT32 latency) {
+    ASSERTX(entries > 0);
+    _vc_entries = entries;
+    _vc_latency = latency;
+    _vc = NewSetArray<VICTIM_CACHE>(_vc_arena, 1, entries);
+}
+
+// Removes all L1 (data and instruction) blocks of an evicted L2 block.
+template <class SET>
+VOID TWO_LEVEL_CACHE<SET>::BackInvalidate(ADDRINT replacedAddr) {
+    CACHE_TAG l1Tag;
+    UINT32 l1SetIndex;
+
+    for (UINT32 i = 0; i < L2BlockSize(); i += L1BlockSize()) {
+        ADDRINT newAddr = replacedAddr | i;
+        SplitAddress(newAddr, L1LineShift(), L1SetIndexMask(), l1Tag,
+                     l1SetIndex);
+        _l1_sets[l1SetIndex].DeleteIfPresent(l1Tag);
+        if (_vc)
+            _vc->DeleteIfPresent(CACHE_TAG(newAddr >> L1LineShift()));
+        if ((newAddr >> L1LineShift()) == _l1_lastLine)
+            _l1_lastLine = ~ADDRINT(0);
+    }
+    if (_l1i_sets) {
+        for (UINT32 i = 0; i < L2BlockSize(); i += _l1i_blockSize) {
+            ADDRINT newAddr = replacedAddr | i;
+            SplitAddress(newAddr, _l1i_lineShift, _l1i_setIndexMask, l1Tag,
+                         l1SetIndex);
+            _l1i_sets[l1SetIndex].DeleteIfPresent(l1Tag);
+        }
+    }
 }
 
 template <class SET>
@@ -304,8 +986,25 @@ string TWO_LEVEL_CACHE<SET>::StatsLong(string prefix) const {
     out += prefix + ljstr("L1-Total-Accesses:  ", headerWidth) +
            dec2str(L1Accesses(), numberWidth) + "  " +
            fltstr(100.0 * L1Accesses() / L1Accesses(), 2, 6) + "%\n";
+
+    out += prefix + ljstr("L1-Line-Splits:     ", headerWidth) +
+           dec2str(L1Splits(), numberWidth) + "\n";
     out += "\n";
 
+    if (HasVictimCache()) {
+        const CACHE_STATS lookups = VictimHits() + VictimMisses();
+        out += prefix + "Victim Cache Stats:" + "\n";
+        out += prefix + ljstr("VC-Hits:            ", headerWidth) +
+               dec2str(VictimHits(), numberWidth) + "  " +
+               fltstr(lookups ? 100.0 * VictimHits() / lookups : 0.0, 2, 6) +
+               "%\n";
+        out += prefix + ljstr("VC-Misses:          ", headerWidth) +
+               dec2str(VictimMisses(), numberWidth) + "  " +
+               fltstr(lookups ? 100.0 * VictimMisses() / lookups : 0.0, 2, 6) +
+               "%\n";
+        out += "\n";
+    }
+
     // L2 Stats now.
     out += prefix + "L2 Cache Stats:" + "\n";
 
@@ -349,6 +1048,82 @@ string TWO_LEVEL_CACHE<SET>::StatsLong(string prefix) const {
            fltstr(100.0 * L2Accesses() / L2Accesses(), 2, 6) + "%\n";
     out += prefix + "\n";
 
+    if (L2Sampling()) {
+        out += prefix + ljstr("L2-Sampled-Sets:    ", headerWidth) +
+               dec2str(_l2_sampled_sets, numberWidth) + "  of " +
+               dec2str(L2NumSets(), 0) + "\n";
+        out += prefix + ljstr("L2-Unmodeled:       ", headerWidth) +
+               dec2str(_l2_unmodeled_access[ACCESS_TYPE_LOAD] +
+                           _l2_unmodeled_access[ACCESS_TYPE_STORE] +
+                           _l2_unmodeled_fetches + _l2_unmodeled_prefetches,
+                       numberWidth) +
+               "\n";
+        out += prefix + ljstr("L2-Est-Misses:      ", headerWidth) +
+               fltstr(L2EstimatedMisses(), 0, numberWidth) + "  +- " +
+               fltstr(L2EstimatedMissesError(), 0) + " (95%)\n";
+        out += prefix + "\n";
+    }
+
+    // Instruction side, if simulated
+    if (HasInstructionCache()) {
+        out += prefix + "L1I Cache Stats:" + "\n";
+
+        out += prefix + ljstr("L1I-Fetch-Hits:     ", headerWidth) +
+               dec2str(L1IHits(), numberWidth) + "  " +
+               fltstr(100.0 * L1IHits() / L1IAccesses(), 2, 6) + "%\n";
+
+        out += prefix + ljstr("L1I-Fetch-Misses:   ", headerWidth) +
+               dec2str(L1IMisses(), numberWidth) + "  " +
+               fltstr(100.0 * L1IMisses() / L1IAccesses(), 2, 6) + "%\n";
+
+        out += prefix + ljstr("L1I-Fetch-Accesses: ", headerWidth) +
+               dec2str(L1IAccesses(), numberWidth) + "  " +
+               fltstr(100.0 * L1IAccesses() / L1IAccesses(), 2, 6) + "%\n";
+
+        out += prefix + ljstr("L2-Fetch-Hits:      ", headerWidth) +
+               dec2str(L2FetchHits(), numberWidth) + "\n";
+
+        out += prefix + ljstr("L2-Fetch-Misses:    ", headerWidth) +
+               dec2str(L2FetchMisses(), numberWidth) + "\n";
+        out += prefix + "\n";
+    }
+
+    // Software prefetches, usefulness over the ones that brought a line
+    const CACHE_STATS swpfIssued = _swpf_issued[0] + _swpf_issued[1];
+    if (swpfIssued) {
+        const CACHE_STATS filled = _swpf_filled;
+        out += prefix + "Software Prefetch Stats:" + "\n";
+        out += prefix + ljstr("SWPF-Issued-L1:     ", headerWidth) +
+               dec2str(_swpf_issued[0], numberWidth) + "\n";
+        out += prefix + ljstr("SWPF-Issued-L2:     ", headerWidth) +
+               dec2str(_swpf_issued[1], numberWidth) + "\n";
+        out += prefix + ljstr("SWPF-Redundant:     ", headerWidth) +
+               dec2str(_swpf_redundant, numberWidth) + "  " +
+               fltstr(100.0 * _swpf_redundant / swpfIssued, 2, 6) + "%\n";
+        out += prefix + ljstr("SWPF-Useful:        ", headerWidth) +
+               dec2str(_swpf_useful, numberWidth) + "  " +
+               fltstr(filled ? 100.0 * _swpf_useful / filled : 0.0, 2, 6) +
+               "%\n";
+        out += prefix + ljstr("SWPF-Unused:        ", headerWidth) +
+               dec2str(_swpf_unused, numberWidth) + "  " +
+               fltstr(filled ? 100.0 * _swpf_unused / filled : 0.0, 2, 6) +
+               "%\n";
+        out += prefix + "\n";
+    }
+
+    if (_wc_stores) {
+        out += prefix + "Write-Combining Stats:" + "\n";
+        out += prefix + ljstr("WC-NT-Stores:       ", headerWidth) +
+               dec2str(_wc_stores, numberWidth) + "\n";
+        out += prefix + ljstr("WC-Merges:          ", headerWidth) +
+               dec2str(_wc_merges, numberWidth) + "\n";
+        out += prefix + ljstr("WC-Flushes:         ", headerWidth) +
+               dec2str(_wc_flushes, numberWidth) + "\n";
+        out += prefix + ljstr("WC-Partial-Flushes: ", headerWidth) +
+               dec2str(_wc_partial_flushes, numberWidth) + "\n";
+        out += prefix + "\n";
+    }
+
     return out;
 }
 
@@ -377,10 +1152,20 @@ string TWO_LEVEL_CACHE<SET>::PrintCache(string prefix) const {
     out += prefix +
            "    Associativity:  " + dec2str(this->L2Associativity(), 5) + "\n";
     out += prefix + "\n";
+    if (HasInstructionCache()) {
+        out += prefix + "  L1-Instruction Cache:\n";
+        out += prefix + "    Size(KB):       " +
+               dec2str(_l1i_cacheSize / KILO, 5) + "\n";
+        out += prefix + "    Block Size(B):  " + dec2str(_l1i_blockSize, 5) +
+               "\n";
+        out += prefix + "    Associativity:  " +
+               dec2str(_l1i_associativity, 5) + "\n";
+        out += prefix + "\n";
+    }
 
     out += prefix + "Latencies: " + dec2str(_latencies[HIT_L1], 4) + " " +
            dec2str(_latencies[HIT_L2], 4) + " " +
-           dec2str(_latencies[MISS_L2], 4) + "\n";
+           (_dram ? string("DRAM") : dec2str(_latencies[MISS_L2], 4)) + "\n";
     // out += prefix + "L1-Sets: " + this->_l1_sets[0].Name() + " assoc: " +
     out += prefix + "L1-Sets: " + dec2str(this->L1NumSets(), 4) + " - " +
            this->_l1_sets[0].Name() +
@@ -388,9 +1173,15 @@ string TWO_LEVEL_CACHE<SET>::PrintCache(string prefix) const {
            "\n";
     // out += prefix + "L2-Sets: " + this->_l2_sets[0].Name() + " assoc: " +
     out += prefix + "L2-Sets: " + dec2str(this->L2NumSets(), 4) + " - " +
-           this->_l2_sets[0].Name() +
-           " - assoc: " + dec2str(this->_l2_sets[0].GetAssociativity(), 3) +
-           "\n";
+           (_l2_skewed ? _l2_skewed->Name() : this->_l2_sets[0].Name()) +
+           " - assoc: " + dec2str(this->L2Associativity(), 3) + "\n";
+    out += prefix + "L2-Index: " + L2_INDEX_NAMES[_l2_index];
+    if (_l2_index == L2_INDEX_PRIME)
+        out += " (" + dec2str(_l2_prime, 0) + " sets used)";
+    out += "\n";
+    if (L2Sampling())
+        out += prefix + "L2-Set-Sampling: 1/" + dec2str(_l2_sample_ratio, 0) +
+               " (" + dec2str(_l2_sampled_sets, 0) + " sets modeled)\n";
     out += prefix + "Store_allocation: " +
            (STORE_ALLOCATION == STORE_ALLOCATE ? "Yes" : "No") + "\n";
     out +=
@@ -400,14 +1191,172 @@ string TWO_LEVEL_CACHE<SET>::PrintCache(string prefix) const {
                 ? "No"
                 : "Yes (" + dec2str(_l2_prefetch_lines, 3) + ")") +
            "\n";
+    out += prefix + "Victim_cache: " +
+           (HasVictimCache() ? "Yes (" + dec2str(_vc_entries, 0) +
+                                   " entries, " + dec2str(_vc_latency, 0) +
+                                   " cycles)"
+                             : std::string("No")) +
+           "\n";
     out += "\n";
 
     return out;
 }
 
+template <class SET>
+VOID TWO_LEVEL_CACHE<SET>::Export(STATS_WRITER &w) const {
+    static const char *fields[ACCESS_TYPE_NUM][HIT_MISS_NUM] = {
+        {"Load-Misses", "Load-Hits"}, {"Store-Misses", "Store-Hits"}};
+
+    w.Add("L1", "Size", UINT64(_l1_cacheSize));
+    w.Add("L1", "Block", UINT64(_l1_blockSize));
+    w.Add("L1", "Assoc", UINT64(_l1_associativity));
+    for (UINT32 t = 0; t < ACCESS_TYPE_NUM; t++)
+        for (UINT32 h = 0; h < HIT_MISS_NUM; h++)
+            w.Add("L1", fields[t][h], _l1_access[t][h]);
+    w.Add("L1", "Line-Splits", _l1_splits);
+    if (HasVictimCache()) {
+        w.Add("VC", "Entries", UINT64(_vc_entries));
+        w.Add("VC", "Latency", UINT64(_vc_latency));
+        w.Add("VC", "Hits", _vc_access[true]);
+        w.Add("VC", "Misses", _vc_access[false]);
+    }
+
+    w.Add("L2", "Size", UINT64(_l2_cacheSize));
+    w.Add("L2", "Block", UINT64(_l2_blockSize));
+    w.Add("L2", "Assoc", UINT64(_l2_associativity));
+    w.Add("L2", "Prefetch-Lines", UINT64(_l2_prefetch_lines));
+    w.Add("L2", "Index", L2_INDEX_NAMES[_l2_index]);
+    for (UINT32 t = 0; t < ACCESS_TYPE_NUM; t++)
+        for (UINT32 h = 0; h < HIT_MISS_NUM; h++)
+            w.Add("L2", fields[t][h], _l2_access[t][h]);
+    if (L2Sampling()) {
+        w.Add("L2", "Sample-Ratio", UINT64(_l2_sample_ratio));
+        w.Add("L2", "Sampled-Sets", UINT64(_l2_sampled_sets));
+        w.Add("L2", "Est-Misses", L2EstimatedMisses());
+        w.Add("L2", "Est-Misses-Err", L2EstimatedMissesError());
+    }
+
+    if (HasInstructionCache()) {
+        w.Add("L1I", "Size", UINT64(_l1i_cacheSize));
+        w.Add("L1I", "Block", UINT64(_l1i_blockSize));
+        w.Add("L1I", "Assoc", UINT64(_l1i_associativity));
+        w.Add("L1I", "Fetch-Misses", _l1i_access[false]);
+        w.Add("L1I", "Fetch-Hits", _l1i_access[true]);
+        w.Add("L2", "Fetch-Misses", _l2_fetch_access[false]);
+        w.Add("L2", "Fetch-Hits", _l2_fetch_access[true]);
+    }
+
+    w.Add("SWPF", "Issued-L1", _swpf_issued[0]);
+    w.Add("SWPF", "Issued-L2", _swpf_issued[1]);
+    w.Add("SWPF", "Redundant", _swpf_redundant);
+    w.Add("SWPF", "Useful", _swpf_useful);
+    w.Add("SWPF", "Unused", _swpf_unused);
+    w.Add("WC", "Buffers", UINT64(_wc_entries));
+    w.Add("WC", "NT-Stores", _wc_stores);
+    w.Add("WC", "Merges", _wc_merges);
+    w.Add("WC", "Flushes", _wc_flushes);
+    w.Add("WC", "Partial-Flushes", _wc_partial_flushes);
+}
+
+template <class SET>
+template <class S>
+VOID TWO_LEVEL_CACHE<SET>::SaveSets(SNAPSHOT_WRITER &s, const std::string &key,
+                                    const S *sets, UINT32 numSets) {
+    s.BeginSection(key);
+    for (UINT32 i = 0; i < numSets; i++)
+        sets[i].Save(s);
+    s.EndSection();
+}
+
+// Loads all sets of one level, or leaves the level cold if the snapshot
+// does not match it.
+template <class SET>
+template <class S>
+bool TWO_LEVEL_CACHE<SET>::LoadSets(SNAPSHOT_READER &s, const std::string &key,
+                                    S *sets, UINT32 numSets,
+                                    UINT32 associativity) {
+    if (!s.OpenSection(key))
+        return false;
+    for (UINT32 i = 0; i < numSets; i++)
+        sets[i].Load(s);
+    if (s.Ok())
+        return true;
+    for (UINT32 i = 0; i < numSets; i++)
+        sets[i].SetAssociativity(associativity);
+    return false;
+}
+
+template <class SET> VOID TWO_LEVEL_CACHE<SET>::Save(SNAPSHOT_WRITER &s) const {
+    SaveSets(s,
+             SnapshotKey("L1D", _l1_cacheSize, _l1_blockSize,
+                         _l1_associativity, _l1_sets[0].Name()),
+             _l1_sets, L1NumSets());
+    const std::string l2Key = SnapshotKey(
+        "L2", _l2_cacheSize, _l2_blockSize, _l2_associativity, L2SetsName());
+    if (_l2_skewed) {
+        s.BeginSection(l2Key);
+        _l2_skewed->Save(s);
+        s.EndSection();
+    } else {
+        SaveSets(s, l2Key, _l2_sets, L2NumSets());
+    }
+    if (HasInstructionCache())
+        SaveSets(s,
+                 SnapshotKey("L1I", _l1i_cacheSize, _l1i_blockSize,
+                             _l1i_associativity, _l1i_sets[0].Name()),
+                 _l1i_sets, _l1i_setIndexMask + 1);
+    if (HasVictimCache())
+        SaveSets(s,
+                 SnapshotKey("VC", _vc_entries * _l1_blockSize, _l1_blockSize,
+                             _vc_entries, _vc->Name()),
+                 _vc, 1);
+}
+
+// Returns true if every level was restored. L1s are only restored on top of
+// a restored L2, so that inclusion holds after a partial restore.
+template <class SET> bool TWO_LEVEL_CACHE<SET>::Load(SNAPSHOT_READER &s) {
+    _l1_lastLine = ~ADDRINT(0);
+    const std::string l2Key = SnapshotKey(
+        "L2", _l2_cacheSize, _l2_blockSize, _l2_associativity, L2SetsName());
+    bool ok;
+    if (_l2_skewed) {
+        ok = s.OpenSection(l2Key);
+        if (ok) {
+            _l2_skewed->Load(s);
+            ok = s.Ok();
+            if (!ok)
+                _l2_skewed->Clear();
+        }
+    } else {
+        ok = LoadSets(s, l2Key, _l2_sets, L2NumSets(), _l2_associativity);
+    }
+    if (!ok)
+        return false;
+
+    ok = LoadSets(s,
+                  SnapshotKey("L1D", _l1_cacheSize, _l1_blockSize,
+                              _l1_associativity, _l1_sets[0].Name()),
+                  _l1_sets, L1NumSets(), _l1_associativity);
+    if (HasInstructionCache())
+        ok = LoadSets(s,
+                      SnapshotKey("L1I", _l1i_cacheSize, _l1i_blockSize,
+                                  _l1i_associativity, _l1i_sets[0].Name()),
+                      _l1i_sets, _l1i_setIndexMask + 1, _l1i_associativity) &&
+             ok;
+    if (HasVictimCache())
+        ok = LoadSets(s,
+                      SnapshotKey("VC", _vc_entries * _l1_blockSize,
+                                  _l1_blockSize, _vc_entries, _vc->Name()),
+                      _vc, 1, _vc_entries) &&
+             ok;
+    return ok;
+}
+
 // Returns the cycles to serve the request.
 template <class SET>
-UINT32 TWO_LEVEL_CACHE<SET>::Access(ADDRINT addr, ACCESS_TYPE accessType) {
+UINT32 TWO_LEVEL_CACHE<SET>::AccessHierarchy(ADDRINT addr,
+                                             ACCESS_TYPE accessType,
+                                             UINT64 now) {
     CACHE_TAG l1Tag, l2Tag;
     UINT32 l1SetIndex, l2SetIndex;
     bool l1Hit = 0, l2Hit = 0;
@@ -420,72 +1369,303 @@ UINT32 TWO_LEVEL_CACHE<SET>::Access(ADDRINT addr, ACCESS_TYPE accessType) {
     _l1_access[accessType][l1Hit]++;
     cycles = _latencies[HIT_L1];
 
+    // First demand use of a line brought by a software prefetch
+    if (!_swpf_lines.empty() && _swpf_lines.erase(addr >> L2LineShift()))
+        _swpf_useful++;
+
+    if (l1Hit)
+        _l1_lastLine = addr >> L1LineShift();
+
     if (!l1Hit) {
         // On miss, loads always allocate, stores optionally
-        if (accessType == ACCESS_TYPE_LOAD ||
-            STORE_ALLOCATION == STORE_ALLOCATE)
-            l1Set.Replace(l1Tag);
+        const bool allocate = accessType == ACCESS_TYPE_LOAD ||
+                              STORE_ALLOCATION == STORE_ALLOCATE;
+
+        // A victim cache hit swaps the line back into L1, L2 is not accessed
+        if (_vc) {
+            const CACHE_TAG line(addr >> L1LineShift());
+            const bool vcHit = _vc->Find(line);
+            _vc_access[vcHit]++;
+            if (vcHit) {
+                if (allocate) {
+                    _vc->DeleteIfPresent(line);
+                    L1Replace(l1Tag, l1SetIndex);
+                    _l1_lastLine = addr >> L1LineShift();
+                }
+                _cycles[CYCLES_L2] += _vc_latency;
+                return cycles + _vc_latency;
+            }
+        }
+
+        if (allocate) {
+            L1Replace(l1Tag, l1SetIndex);
+            _l1_lastLine = addr >> L1LineShift();
+        }
 
         // Let's check L2 now
-        SplitAddress(addr, L2LineShift(), L2SetIndexMask(), l2Tag, l2SetIndex);
-        SET &l2Set = _l2_sets[l2SetIndex];
-        l2Hit = l2Set.Find(l2Tag);
+        L2SplitAddress(addr, l2Tag, l2SetIndex);
+        if (!L2Modeled(l2SetIndex)) {
+            _l2_unmodeled_access[accessType]++;
+            return cycles + L2Unmodeled();
+        }
+        l2Hit = L2Find(l2Tag, l2SetIndex);
         _l2_access[accessType][l2Hit]++;
         cycles += _latencies[HIT_L2];
+        _cycles[CYCLES_L2] += _latencies[HIT_L2];
 
-        // L2 always allocates loads and stores
+        // L2 always allocates loads and stores. If L2 is inclusive and a TAG
+        // has been replaced L2Replace() removes all evicted blocks from L1.
         if (!l2Hit) {
-            CACHE_TAG l2_replaced = l2Set.Replace(l2Tag);
-            cycles += _latencies[MISS_L2];
-
-            // If L2 is inclusive and a TAG has been replaced we need to remove
-            // all evicted blocks from L1.
-            if ((L2_INCLUSIVE == 1) && !(l2_replaced == INVALID_TAG)) {
-                ADDRINT replacedAddr = ADDRINT(l2_replaced)
-                                       << FloorLog2(L2NumSets());
-                replacedAddr = replacedAddr | l2SetIndex;
-                replacedAddr = replacedAddr << L2LineShift();
-                for (UINT32 i = 0; i < L2BlockSize(); i += L1BlockSize()) {
-                    ADDRINT newAddr = replacedAddr | i;
-                    SplitAddress(newAddr, L1LineShift(), L1SetIndexMask(),
-                                 l1Tag, l1SetIndex);
-                    l1Set = _l1_sets[l1SetIndex];
-                    l1Set.DeleteIfPresent(l1Tag);
-                }
-            }
+            L2Replace(l2Tag, l2SetIndex);
+            const UINT64 missCycle = now + cycles;
+            cycles += MemoryAccess(addr, missCycle);
+
+            if (L2Sampling())
+                _l2_set_misses[_l2_sample_slot[l2SetIndex]]++;
+
             // PREFETCHING
             ADDRINT prefetch_addr = addr;
             for (UINT32 i = 0; i < _l2_prefetch_lines; i++) {
                 prefetch_addr += L2BlockSize();
                 /* .......................... */
                 /* Add here prefetching code. */
-                SplitAddress(prefetch_addr, L2LineShift(), L2SetIndexMask(),
-                             l2Tag, l2SetIndex);
-                SET &l2Set = _l2_sets[l2SetIndex];
-                l2Hit = l2Set.Find(l2Tag);
+                L2SplitAddress(prefetch_addr, l2Tag, l2SetIndex);
+                if (!L2Modeled(l2SetIndex))
+                    continue;
+                l2Hit = L2Find(l2Tag, l2SetIndex);
 
                 if (!l2Hit) {
-                    l2_replaced = l2Set.Replace(l2Tag);
-
-                    if ((L2_INCLUSIVE == 1) && !(l2_replaced == INVALID_TAG)) {
-                        ADDRINT replacedAddr = ADDRINT(l2_replaced)
-                                               << FloorLog2(L2NumSets());
-                        replacedAddr = replacedAddr | l2SetIndex;
-                        replacedAddr = replacedAddr << L2LineShift();
-                        for (UINT32 i = 0; i < L2BlockSize();
-                             i += L1BlockSize()) {
-                            ADDRINT newAddr = replacedAddr | i;
-                            SplitAddress(newAddr, L1LineShift(),
-                                         L1SetIndexMask(), l1Tag, l1SetIndex);
-                            SET &l1Set = _l1_sets[l1SetIndex];
-                            l1Set.DeleteIfPresent(l1Tag);
-                        }
-                    }
+                    L2Replace(l2Tag, l2SetIndex);
+                    if (_dram)
+                        _dram->Prefetch(prefetch_addr, missCycle);
                 }
                 /* .......................... */
             }
         }
+        if (L2Sampling())
+            _l2_sampled_cycles += cycles - _latencies[HIT_L1];
+    }
+
+    return cycles;
+}
+
+/**
+ * With large simulated caches the L2 sets of consecutive accesses are far
+ * apart in host memory, and each Access() that reaches L2 stalls on the host
+ * cache misses of its set. Here the accesses are simulated in steps: the L2
+ * set objects of a whole step are prefetched first, then the tag storage
+ * they point to, and only then the accesses are simulated in order, so the
+ * host misses of a step overlap. Prefetching has no effect on the simulated
+ * state.
+ **/
+template <class SET>
+UINT64 TWO_LEVEL_CACHE<SET>::AccessBatch(const ADDRINT *addrs,
+                                         const ACCESS_TYPE *types, size_t n,
+                                         UINT64 now) {
+    UINT32 l2Sets[BATCH_STEP];
+    UINT64 cycles = 0;
+    ADDRINT lastLine = _l1_lastLine;
+
+    for (size_t base = 0; base < n; base += BATCH_STEP) {
+        const UINT32 step = UINT32(std::min<size_t>(BATCH_STEP, n - base));
+        UINT32 misses = 0;
+        CACHE_TAG tag;
+
+        // Runs of accesses to one line cost a single lookup. The L1 sets are
+        // few and stay in the host caches, so only L2 sets are prefetched.
+        if (_l2_skewed == NULL) {
+            for (UINT32 i = 0; i < step; i++) {
+                const ADDRINT line = addrs[base + i] >> L1LineShift();
+                if (line == lastLine)
+                    continue;
+                lastLine = line;
+                L2SplitAddress(addrs[base + i], tag, l2Sets[misses]);
+                if (L2Modeled(l2Sets[misses]))
+                    __builtin_prefetch(&_l2_sets[l2Sets[misses++]]);
+            }
+            for (UINT32 i = 0; i < misses; i++)
+                _l2_sets[l2Sets[i]].Prefetch();
+        }
+        for (UINT32 i = 0; i < step; i++)
+            cycles += Access(addrs[base + i], types[base + i], now + cycles);
+    }
+
+    return cycles;
+}
+
+template <class SET>
+VOID TWO_LEVEL_CACHE<SET>::SoftwarePrefetch(ADDRINT addr, bool toL1,
+                                            UINT64 now) {
+    CACHE_TAG l1Tag, l2Tag;
+    UINT32 l1SetIndex, l2SetIndex;
+    bool filled = false;
+
+    _swpf_issued[toL1 ? 0 : 1]++;
+
+    SplitAddress(addr, L1LineShift(), L1SetIndexMask(), l1Tag, l1SetIndex);
+    L2SplitAddress(addr, l2Tag, l2SetIndex);
+    const bool l2Modeled = L2Modeled(l2SetIndex);
+    SET &l1Set = _l1_sets[l1SetIndex];
+    if (toL1) {
+        // The L1 set changes, so its MRU line may no longer be the last one
+        _l1_lastLine = ~ADDRINT(0);
+        if (l1Set.Find(l1Tag)) {
+            _swpf_redundant++;
+            return;
+        }
+    }
+
+    // With L2 sampling, L1 is still filled (it stays exact)
+    if (!l2Modeled) {
+        _l2_unmodeled_prefetches++;
+    } else if (!L2Find(l2Tag, l2SetIndex)) {
+        L2Replace(l2Tag, l2SetIndex);
+        if (_dram)
+            _dram->Prefetch(addr, now);
+        filled = true;
+    }
+    if (toL1) {
+        if (_vc)
+            _vc->DeleteIfPresent(CACHE_TAG(addr >> L1LineShift()));
+        L1Replace(l1Tag, l1SetIndex);
+        filled = true;
+    }
+
+    if (filled) {
+        _swpf_filled++;
+        _swpf_lines.insert(addr >> L2LineShift());
+    } else if (l2Modeled) {
+        _swpf_redundant++;
+    }
+}
+
+template <class SET>
+VOID TWO_LEVEL_CACHE<SET>::SetWriteCombiningBuffers(UINT32 entries) {
+    ASSERTX(entries > 0);
+    _wc_entries = entries;
+}
+
+// Writes buffer `entry` to memory and frees it.
+template <class SET>
+VOID TWO_LEVEL_CACHE<SET>::FlushWriteCombining(UINT32 entry, UINT64 now) {
+    _wc_flushes++;
+    if (!WriteCombiningFull(entry))
+        _wc_partial_flushes++;
+    if (_dram)
+        _dram->Write(_wc_lines[entry] << L1LineShift(), now);
+    _wc_lines.erase(_wc_lines.begin() + entry);
+    _wc_masks.erase(_wc_masks.begin() + entry * _wc_mask_words,
+                    _wc_masks.begin() + (entry + 1) * _wc_mask_words);
+}
+
+// Drops every cached copy of the L1 line of `addr`: a non-temporal store
+// makes them stale. With inclusion the L2 line goes with all its L1 lines.
+template <class SET>
+VOID TWO_LEVEL_CACHE<SET>::InvalidateLine(ADDRINT addr) {
+    CACHE_TAG l1Tag, l2Tag;
+    UINT32 l1SetIndex, l2SetIndex;
+
+    SplitAddress(addr, L1LineShift(), L1SetIndexMask(), l1Tag, l1SetIndex);
+    _l1_sets[l1SetIndex].DeleteIfPresent(l1Tag);
+    if (_vc)
+        _vc->DeleteIfPresent(CACHE_TAG(addr >> L1LineShift()));
+    if ((addr >> L1LineShift()) == _l1_lastLine)
+        _l1_lastLine = ~ADDRINT(0);
+
+    L2SplitAddress(addr, l2Tag, l2SetIndex);
+    if (!L2Modeled(l2SetIndex))
+        return;
+    L2DeleteIfPresent(l2Tag, l2SetIndex);
+    if (L2_INCLUSIVE == 1)
+        BackInvalidate(addr & ~ADDRINT(L2BlockSize() - 1));
+    if (!_swpf_lines.empty() && _swpf_lines.erase(addr >> L2LineShift()))
+        _swpf_unused++;
+}
+
+/**
+ * Stores to the same line combine in one buffer, which is written to memory
+ * once every byte of the line is written, or when a buffer is needed for
+ * another line (the oldest one goes). A store crossing lines is split as
+ * in AccessRange(). Cached copies of the line are invalidated.
+ **/
+template <class SET>
+VOID TWO_LEVEL_CACHE<SET>::StoreNonTemporal(ADDRINT addr, UINT32 size,
+                                            UINT64 now, UINT64 byteMask) {
+    _wc_stores++;
+    for (UINT32 done = 0; done < size;) {
+        const ADDRINT offset = (addr + done) & (L1BlockSize() - 1);
+        const UINT32 len = std::min(size - done, UINT32(L1BlockSize() - offset));
+        StoreNonTemporalLine(addr + done, len,
+                             done < 64 ? byteMask >> done : ~UINT64(0), now);
+        done += len;
+    }
+}
+
+template <class SET>
+VOID TWO_LEVEL_CACHE<SET>::StoreNonTemporalLine(ADDRINT addr, UINT32 size,
+                                                UINT64 byteMask, UINT64 now) {
+    const ADDRINT line = addr >> L1LineShift();
+    const UINT32 offset = addr & (L1BlockSize() - 1);
+    UINT32 entry = 0;
+
+    ASSERTX(size <= 64);
+    InvalidateLine(addr);
+
+    while (entry < _wc_lines.size() && _wc_lines[entry] != line)
+        entry++;
+    if (entry < _wc_lines.size()) {
+        _wc_merges++;
+    } else {
+        if (_wc_lines.size() == _wc_entries)
+            FlushWriteCombining(0, now);
+        entry = _wc_lines.size();
+        _wc_lines.push_back(line);
+        _wc_masks.resize(_wc_masks.size() + _wc_mask_words, 0);
+    }
+
+    // Bytes [offset, offset + size) of the line, at most two mask words
+    const UINT64 bytes =
+        (size < 64 ? (UINT64(1) << size) - 1 : ~UINT64(0)) & byteMask;
+    UINT64 *mask = &_wc_masks[entry * _wc_mask_words + offset / 64];
+    mask[0] |= bytes << (offset % 64);
+    if (offset % 64 && offset % 64 + size > 64)
+        mask[1] |= bytes >> (64 - offset % 64);
+
+    if (WriteCombiningFull(entry))
+        FlushWriteCombining(entry, now);
+}
+
+template <class SET>
+UINT32 TWO_LEVEL_CACHE<SET>::Fetch(ADDRINT addr, UINT64 now) {
+    CACHE_TAG l1Tag, l2Tag;
+    UINT32 l1SetIndex, l2SetIndex;
+    UINT32 cycles = 0;
+
+    SplitAddress(addr, _l1i_lineShift, _l1i_setIndexMask, l1Tag, l1SetIndex);
+    SET &l1Set = _l1i_sets[l1SetIndex];
+    bool l1Hit = l1Set.Find(l1Tag);
+    _l1i_access[l1Hit]++;
+    if (l1Hit)
+        return 0;
+
+    l1Set.Replace(l1Tag);
+
+    L2SplitAddress(addr, l2Tag, l2SetIndex);
+    if (!L2Modeled(l2SetIndex)) {
+        _l2_unmodeled_fetches++;
+        return L2Unmodeled();
+    }
+    bool l2Hit = L2Find(l2Tag, l2SetIndex);
+    _l2_fetch_access[l2Hit]++;
+    cycles += _latencies[HIT_L2];
+    _cycles[CYCLES_L2] += _latencies[HIT_L2];
+
+    if (!l2Hit) {
+        L2Replace(l2Tag, l2SetIndex);
+        cycles += MemoryAccess(addr, now + cycles);
     }
+    if (L2Sampling())
+        _l2_sampled_cycles += cycles;
 
     return cycles;
 }
@@ -0,0 +1,97 @@
+#ifndef CPI_STACK_H
+#define CPI_STACK_H
+
+#include "globals.h"
+
+/**
+ * `CPI_STACK` splits the simulated cycles by where they were spent, so that
+ * the CPI reads as a sum of contributions:
+ *   Base      1 cycle per instruction, plus the L1 and Tlb hit latencies
+ *   Tlb       Tlb and ITlb misses
+ *   L1-L2     L1 (data and instruction) misses served by the victim cache
+ *             or L2
+ *   L2-Mem    L2 misses served by main memory
+ *   Prefetch  time demand misses wait for prefetches serviced ahead of them
+ * The components fill it from their own counters; subtracting two stacks
+ * gives the stack of the interval between them.
+ **/
+class CPI_STACK {
+  public:
+    typedef enum {
+        CPI_BASE = 0,
+        CPI_TLB,
+        CPI_L2,
+        CPI_MEMORY,
+        CPI_PREFETCH,
+        CPI_NUM
+    } COMPONENT;
+
+  private:
+    UINT64 _cycles[CPI_NUM];
+    UINT64 _instructions;
+
+    static const char *Name(UINT32 c) {
+        static const char *names[CPI_NUM] = {"Base", "Tlb", "L1-L2", "L2-Mem",
+                                             "Prefetch"};
+        return names[c];
+    }
+    double Cpi(UINT32 c) const {
+        return _instructions ? (double)_cycles[c] / _instructions : 0.0;
+    }
+
+  public:
+    CPI_STACK() : _instructions(0) {
+        for (UINT32 c = 0; c < CPI_NUM; c++)
+            _cycles[c] = 0;
+    }
+
+    UINT64 &Cycles(COMPONENT c) { return _cycles[c]; }
+    UINT64 &Instructions() { return _instructions; }
+    UINT64 TotalCycles() const {
+        UINT64 total = 0;
+        for (UINT32 c = 0; c < CPI_NUM; c++)
+            total += _cycles[c];
+        return total;
+    }
+
+    CPI_STACK operator-(const CPI_STACK &earlier) const {
+        CPI_STACK d;
+        for (UINT32 c = 0; c < CPI_NUM; c++)
+            d._cycles[c] = _cycles[c] - earlier._cycles[c];
+        d._instructions = _instructions - earlier._instructions;
+        return d;
+    }
+
+    // Side by side with the stack of the last interval
+    string StatsLong(string prefix, const CPI_STACK &interval) const {
+        const UINT32 headerWidth = 19;
+        const UINT32 numberWidth = 12;
+        const double total = TotalCycles() ? (double)TotalCycles() : 1.0;
+        const double last =
+            interval.TotalCycles() ? (double)interval.TotalCycles() : 1.0;
+
+        string out;
+        out += prefix + ljstr("CPI Stack:", headerWidth) +
+               "      Cycles     CPI    Share  Interval-CPI/Share\n";
+        for (UINT32 c = 0; c < CPI_NUM; c++)
+            out += prefix + ljstr(string("CPI-") + Name(c) + ":", headerWidth) +
+                   dec2str(_cycles[c], numberWidth) + "  " +
+                   fltstr(Cpi(c), 3, 6) + "  " +
+                   fltstr(100.0 * _cycles[c] / total, 2, 6) + "%  " +
+                   fltstr(interval.Cpi(c), 3, 6) + "  " +
+                   fltstr(100.0 * interval._cycles[c] / last, 2, 6) + "%\n";
+        return out;
+    }
+
+    VOID Export(STATS_WRITER &w, const CPI_STACK &interval) const {
+        static const char *intervalNames[CPI_NUM] = {
+            "Interval-Base", "Interval-Tlb", "Interval-L1-L2",
+            "Interval-L2-Mem", "Interval-Prefetch"};
+        for (UINT32 c = 0; c < CPI_NUM; c++)
+            w.Add("CPI", Name(c), Cpi(c));
+        for (UINT32 c = 0; c < CPI_NUM; c++)
+            w.Add("CPI", intervalNames[c], interval.Cpi(c));
+    }
+};
+
+#endif // CPI_STACK_H
@@ -0,0 +1,437 @@
+#ifndef DRAM_H
+#define DRAM_H
+
+#include <algorithm> // std::min
+#include <iostream>  // std::cout ...
+#include <vector>
+
+#include "globals.h"
+
+typedef UINT64 DRAM_STATS; // type of dram counters
+
+/*****************************************************************************/
+/* Row buffer management policy                                              */
+/*****************************************************************************/
+enum { DRAM_OPEN_PAGE = 0, DRAM_CLOSED_PAGE };
+/*****************************************************************************/
+
+/**
+ * DDR timing parameters, expressed in DRAM clock cycles.
+ * `cpuRatio` is the number of CPU cycles per DRAM clock and `overhead` the
+ * fixed controller + interconnect latency in CPU cycles, so that all latencies
+ * returned by `DRAM::Access` are in CPU cycles.
+ * Defaults correspond to DDR4-2400 (16-16-16-39, BL8) behind a ~3.6GHz core.
+ **/
+struct DRAM_TIMING {
+    UINT32 tCL;    // column access (CAS) latency
+    UINT32 tRCD;   // activate to column command
+    UINT32 tRP;    // precharge
+    UINT32 tRAS;   // activate to precharge
+    UINT32 tBURST; // data burst on the bus (BL8 -> 4 clocks)
+    UINT32 cpuRatio;
+    UINT32 overhead;
+
+    DRAM_TIMING(UINT32 cl = 16, UINT32 rcd = 16, UINT32 rp = 16,
+                UINT32 ras = 39, UINT32 burst = 4, UINT32 ratio = 3,
+                UINT32 ovh = 40)
+        : tCL(cl), tRCD(rcd), tRP(rp), tRAS(ras), tBURST(burst),
+          cpuRatio(ratio), overhead(ovh) {}
+};
+
+/**
+ * `DRAM` models main memory as channels x ranks x banks with one row buffer
+ * per bank, and an FR-FCFS controller queue per system.
+ *
+ * Time is given by the caller (the simulated CPU cycle) on every request.
+ * Demand requests block the caller, so a demand is serviced immediately
+ * together with every older queued request that FR-FCFS would pick before it.
+ * Prefetch requests are only queued and get serviced when a later demand
+ * arrives or when the queue is full, so they compete with demands for banks
+ * and data bus. Posted writes (write-combining flushes) are queued the same
+ * way.
+ **/
+class DRAM {
+  private:
+    typedef struct {
+        ADDRINT lineAddr;
+        UINT64 arrival;
+        UINT32 bank; // flattened channel/rank/bank index
+        UINT32 channel;
+        UINT64 row;
+        bool demand;
+        bool write;
+    } REQUEST;
+
+    typedef struct {
+        UINT64 openRow;
+        bool isOpen;
+        UINT64 readyAt;    // next cycle a command can be issued
+        UINT64 activateAt; // cycle of the last ACT (for tRAS)
+    } BANK;
+
+    enum { ROW_HIT = 0, ROW_EMPTY, ROW_CONFLICT, ROW_RESULT_NUM };
+    enum { REQ_DEMAND = 0, REQ_PREFETCH, REQ_WRITE, REQ_TYPE_NUM };
+
+    const std::string _name;
+    const UINT32 _channels;
+    const UINT32 _ranks;
+    const UINT32 _banks;
+    const UINT32 _rowSize;
+    const UINT32 _lineSize;
+    const UINT32 _policy;
+    const UINT32 _queueSize;
+    const DRAM_TIMING _timing;
+
+    // computed params
+    const UINT32 _lineShift;
+    const UINT32 _linesPerRow;
+
+    std::vector<BANK> _bankState;
+    std::vector<UINT64> _busFreeAt; // per channel data bus
+    std::vector<REQUEST> _queue;
+
+    // Stats
+    DRAM_STATS _requests[REQ_TYPE_NUM];
+    DRAM_STATS _rowResults[ROW_RESULT_NUM];
+    DRAM_STATS _bankBusy; // requests that found their bank busy
+    DRAM_STATS _demandLatency;
+    DRAM_STATS _queueDelay;
+    DRAM_STATS _bytes;
+    UINT64 _firstArrival;
+    UINT64 _lastDone;
+    UINT32 _prefetchDelay; // of the last demand
+
+    UINT32 NumBanks() const { return _channels * _ranks * _banks; }
+    UINT64 Cpu(UINT32 dramCycles) const {
+        return UINT64(dramCycles) * _timing.cpuRatio;
+    }
+
+    // Row:Rank:Bank:Channel:Column interleaving, so that consecutive lines
+    // share a row buffer and consecutive rows spread over channels and banks.
+    VOID Decode(ADDRINT lineAddr, REQUEST &req) const {
+        UINT64 a = lineAddr / _linesPerRow;
+        req.channel = a % _channels;
+        a /= _channels;
+        UINT32 bank = a % _banks;
+        a /= _banks;
+        UINT32 rank = a % _ranks;
+        a /= _ranks;
+        req.row = a;
+        req.bank = (req.channel * _ranks + rank) * _banks + bank;
+    }
+    UINT32 Channel(ADDRINT lineAddr) const {
+        return (lineAddr / _linesPerRow) % _channels;
+    }
+
+    bool IsRowHit(const REQUEST &req) const {
+        const BANK &b = _bankState[req.bank];
+        return b.isOpen && b.openRow == req.row;
+    }
+
+    size_t PickNext() const;
+    UINT64 Service(const REQUEST &req, UINT64 &wait);
+    VOID Post(const REQUEST &req);
+
+  public:
+    DRAM(std::string name, UINT32 channels, UINT32 ranks, UINT32 banks,
+         UINT32 rowSize, UINT32 lineSize, UINT32 policy = DRAM_OPEN_PAGE,
+         UINT32 queueSize = 32, DRAM_TIMING timing = DRAM_TIMING());
+
+    // Stats
+    DRAM_STATS Reads() const {
+        return _requests[REQ_DEMAND] + _requests[REQ_PREFETCH];
+    }
+    DRAM_STATS Writes() const { return _requests[REQ_WRITE]; }
+    DRAM_STATS RowHits() const { return _rowResults[ROW_HIT]; }
+    DRAM_STATS RowEmpty() const { return _rowResults[ROW_EMPTY]; }
+    DRAM_STATS RowConflicts() const { return _rowResults[ROW_CONFLICT]; }
+    DRAM_STATS BankBusy() const { return _bankBusy; }
+    DRAM_STATS Bytes() const { return _bytes; }
+
+    string StatsLong(string prefix = "") const;
+    string PrintDetails(string prefix = "") const;
+    VOID Export(STATS_WRITER &w) const;
+
+    // Demand read issued at CPU cycle `now`. Returns its latency.
+    UINT32 Access(ADDRINT addr, UINT64 now);
+    // Part of the latency of the last Access() spent behind prefetches that
+    // were serviced ahead of it on its channel.
+    UINT32 PrefetchDelay() const { return _prefetchDelay; }
+    // Non-blocking read (prefetch) issued at CPU cycle `now`.
+    VOID Prefetch(ADDRINT addr, UINT64 now);
+    // Posted write of the line of `addr`, issued at CPU cycle `now`.
+    VOID Write(ADDRINT addr, UINT64 now);
+};
+
+inline DRAM::DRAM(std::string name, UINT32 channels, UINT32 ranks,
+                  UINT32 banks, UINT32 rowSize, UINT32 lineSize, UINT32 policy,
+                  UINT32 queueSize, DRAM_TIMING timing)
+    : _name(name), _channels(channels), _ranks(ranks), _banks(banks),
+      _rowSize(rowSize), _lineSize(lineSize), _policy(policy),
+      _queueSize(queueSize), _timing(timing), _lineShift(FloorLog2(lineSize)),
+      _linesPerRow(rowSize / lineSize) {
+
+    ASSERTX(IsPowerOf2(_lineSize));
+    ASSERTX(_rowSize >= _lineSize);
+    ASSERTX(_channels > 0 && _ranks > 0 && _banks > 0);
+    ASSERTX(_queueSize > 0);
+
+    BANK closed = {0, false, 0, 0};
+    _bankState.assign(NumBanks(), closed);
+    _busFreeAt.assign(_channels, 0);
+    _queue.reserve(_queueSize + 1);
+
+    for (UINT32 i = 0; i < REQ_TYPE_NUM; i++)
+        _requests[i] = 0;
+    for (UINT32 i = 0; i < ROW_RESULT_NUM; i++)
+        _rowResults[i] = 0;
+    _bankBusy = _demandLatency = _queueDelay = _bytes = 0;
+    _firstArrival = _lastDone = 0;
+    _prefetchDelay = 0;
+}
+
+// FR-FCFS: oldest row hit first, otherwise the oldest request.
+// The queue is kept in arrival order.
+inline size_t DRAM::PickNext() const {
+    for (size_t i = 0; i < _queue.size(); i++)
+        if (IsRowHit(_queue[i]))
+            return i;
+    return 0;
+}
+
+// Issues all commands for `req` and returns the CPU cycle its data is ready.
+// `wait` is set to the cycles spent waiting for the bank and the data bus.
+inline UINT64 DRAM::Service(const REQUEST &req, UINT64 &wait) {
+    BANK &bank = _bankState[req.bank];
+    UINT64 start = req.arrival;
+    UINT64 column;
+
+    wait = 0;
+    if (bank.readyAt > start) {
+        _bankBusy++;
+        wait = bank.readyAt - start;
+        start = bank.readyAt;
+    }
+
+    if (bank.isOpen && bank.openRow == req.row) {
+        _rowResults[ROW_HIT]++;
+        column = start;
+    } else {
+        if (bank.isOpen) {
+            // Precharge the open row, respecting tRAS
+            _rowResults[ROW_CONFLICT]++;
+            if (bank.activateAt + Cpu(_timing.tRAS) > start)
+                start = bank.activateAt + Cpu(_timing.tRAS);
+            start += Cpu(_timing.tRP);
+        } else {
+            _rowResults[ROW_EMPTY]++;
+        }
+        bank.activateAt = start;
+        bank.openRow = req.row;
+        bank.isOpen = true;
+        column = start + Cpu(_timing.tRCD);
+    }
+
+    UINT64 dataStart = column + Cpu(_timing.tCL);
+    if (_busFreeAt[req.channel] > dataStart) {
+        wait += _busFreeAt[req.channel] - dataStart;
+        dataStart = _busFreeAt[req.channel];
+    }
+    UINT64 done = dataStart + Cpu(_timing.tBURST);
+    _busFreeAt[req.channel] = done;
+
+    if (_policy == DRAM_CLOSED_PAGE) {
+        // Auto-precharge after the burst
+        UINT64 pre = done;
+        if (bank.activateAt + Cpu(_timing.tRAS) > pre)
+            pre = bank.activateAt + Cpu(_timing.tRAS);
+        bank.isOpen = false;
+        bank.readyAt = pre + Cpu(_timing.tRP);
+    } else {
+        bank.readyAt = column + Cpu(_timing.tBURST);
+    }
+
+    _requests[req.demand ? REQ_DEMAND
+                         : (req.write ? REQ_WRITE : REQ_PREFETCH)]++;
+    _bytes += _lineSize;
+    if (Reads() + Writes() == 1)
+        _firstArrival = req.arrival;
+    if (done > _lastDone)
+        _lastDone = done;
+
+    return done + _timing.overhead;
+}
+
+inline UINT32 DRAM::Access(ADDRINT addr, UINT64 now) {
+    const ADDRINT lineAddr = addr >> _lineShift;
+    bool queued = false;
+    UINT64 prefetchDone = now; // end of the last prefetch on our channel
+
+    // A demand to a line with a pending prefetch takes over that request
+    for (size_t i = 0; i < _queue.size(); i++) {
+        if (_queue[i].lineAddr == lineAddr && !_queue[i].write) {
+            _queue[i].demand = true;
+            queued = true;
+            break;
+        }
+    }
+    if (!queued) {
+        REQUEST req;
+        req.lineAddr = lineAddr;
+        req.arrival = now;
+        req.demand = true;
+        req.write = false;
+        Decode(req.lineAddr, req);
+        _queue.push_back(req);
+    }
+
+    // Service everything FR-FCFS schedules ahead of this demand
+    while (true) {
+        size_t next = PickNext();
+        REQUEST r = _queue[next];
+        _queue.erase(_queue.begin() + next);
+
+        UINT64 wait;
+        UINT64 done = Service(r, wait);
+        if (r.demand && r.lineAddr == lineAddr) {
+            UINT32 latency = done > now ? UINT32(done - now) : 0;
+            if (latency < _timing.overhead)
+                latency = _timing.overhead;
+            _demandLatency += latency;
+            _queueDelay += wait;
+            _prefetchDelay =
+                UINT32(std::min<UINT64>(latency, prefetchDone - now));
+            return latency;
+        }
+        if (!r.demand && !r.write && r.channel == Channel(lineAddr) &&
+            done - _timing.overhead > prefetchDone)
+            prefetchDone = done - _timing.overhead;
+    }
+}
+
+inline VOID DRAM::Prefetch(ADDRINT addr, UINT64 now) {
+    REQUEST req;
+    req.lineAddr = addr >> _lineShift;
+    req.arrival = now;
+    req.demand = false;
+    req.write = false;
+    Decode(req.lineAddr, req);
+    Post(req);
+}
+
+inline VOID DRAM::Write(ADDRINT addr, UINT64 now) {
+    REQUEST req;
+    req.lineAddr = addr >> _lineShift;
+    req.arrival = now;
+    req.demand = false;
+    req.write = true;
+    Decode(req.lineAddr, req);
+    Post(req);
+}
+
+// Queues a non-blocking request, servicing one if the queue overflows.
+inline VOID DRAM::Post(const REQUEST &req) {
+    for (size_t i = 0; i < _queue.size(); i++)
+        if (_queue[i].lineAddr == req.lineAddr &&
+            _queue[i].write == req.write)
+            return; // already in flight
+
+    _queue.push_back(req);
+    if (_queue.size() > _queueSize) {
+        size_t next = PickNext();
+        REQUEST r = _queue[next];
+        _queue.erase(_queue.begin() + next);
+        UINT64 wait;
+        Service(r, wait);
+    }
+}
+
+template <class T> static inline double SafeDiv(T num, T den) {
+    return den == 0 ? 0.0 : double(num) / double(den);
+}
+
+inline string DRAM::StatsLong(string prefix) const {
+    const UINT32 headerWidth = 25;
+    const UINT32 numberWidth = 12;
+    const DRAM_STATS rowAccesses = RowHits() + RowEmpty() + RowConflicts();
+    const UINT64 elapsed = _lastDone - _firstArrival;
+
+    string out;
+
+    out += prefix + "DRAM Stats:" + "\n";
+    out += prefix + ljstr("DRAM-Demand-Reads:", headerWidth) +
+           dec2str(_requests[REQ_DEMAND], numberWidth) + "\n";
+    out += prefix + ljstr("DRAM-Prefetch-Reads:", headerWidth) +
+           dec2str(_requests[REQ_PREFETCH], numberWidth) + "\n";
+    out += prefix + ljstr("DRAM-Writes:", headerWidth) +
+           dec2str(_requests[REQ_WRITE], numberWidth) + "\n";
+    out += prefix + ljstr("DRAM-Row-Hits:", headerWidth) +
+           dec2str(RowHits(), numberWidth) + "  " +
+           fltstr(100.0 * SafeDiv(RowHits(), rowAccesses), 2, 6) + "%\n";
+    out += prefix + ljstr("DRAM-Row-Empty:", headerWidth) +
+           dec2str(RowEmpty(), numberWidth) + "  " +
+           fltstr(100.0 * SafeDiv(RowEmpty(), rowAccesses), 2, 6) + "%\n";
+    out += prefix + ljstr("DRAM-Row-Conflicts:", headerWidth) +
+           dec2str(RowConflicts(), numberWidth) + "  " +
+           fltstr(100.0 * SafeDiv(RowConflicts(), rowAccesses), 2, 6) + "%\n";
+    out += prefix + ljstr("DRAM-Bank-Busy:", headerWidth) +
+           dec2str(BankBusy(), numberWidth) + "\n";
+    out += prefix + ljstr("DRAM-Avg-Demand-Latency:", headerWidth) +
+           fltstr(SafeDiv(_demandLatency, _requests[REQ_DEMAND]), 2, 12) +
+           "\n";
+    out += prefix + ljstr("DRAM-Avg-Queue-Delay:", headerWidth) +
+           fltstr(SafeDiv(_queueDelay, _requests[REQ_DEMAND]), 2, 12) + "\n";
+    out += prefix + ljstr("DRAM-Bytes:", headerWidth) +
+           dec2str(Bytes(), numberWidth) + "\n";
+    out += prefix + ljstr("DRAM-Bandwidth(B/cycle):", headerWidth) +
+           fltstr(SafeDiv(Bytes(), elapsed), 4, 12) + "\n";
+    out += prefix + "\n";
+
+    return out;
+}
+
+inline VOID DRAM::Export(STATS_WRITER &w) const {
+    w.Add("DRAM", "Channels", UINT64(_channels));
+    w.Add("DRAM", "Ranks", UINT64(_ranks));
+    w.Add("DRAM", "Banks", UINT64(_banks));
+    w.Add("DRAM", "RowSize", UINT64(_rowSize));
+    w.Add("DRAM", "Policy", _policy == DRAM_OPEN_PAGE ? "open" : "closed");
+    w.Add("DRAM", "Demand-Reads", _requests[REQ_DEMAND]);
+    w.Add("DRAM", "Prefetch-Reads", _requests[REQ_PREFETCH]);
+    w.Add("DRAM", "Writes", _requests[REQ_WRITE]);
+    w.Add("DRAM", "Row-Hits", _rowResults[ROW_HIT]);
+    w.Add("DRAM", "Row-Empty", _rowResults[ROW_EMPTY]);
+    w.Add("DRAM", "Row-Conflicts", _rowResults[ROW_CONFLICT]);
+    w.Add("DRAM", "Bank-Busy", _bankBusy);
+    w.Add("DRAM", "Demand-Latency", _demandLatency);
+    w.Add("DRAM", "Queue-Delay", _queueDelay);
+    w.Add("DRAM", "Bytes", _bytes);
+    w.Add("DRAM", "Busy-Cycles", _lastDone - _firstArrival);
+}
+
+inline string DRAM::PrintDetails(string prefix) const {
+    string out;
+
+    out += prefix + "--------\n";
+    out += prefix + _name + "\n";
+    out += prefix + "--------\n";
+    out += prefix + "  Main Memory:\n";
+    out += prefix + "    Channels:       " + dec2str(_channels, 5) + "\n";
+    out += prefix + "    Ranks:          " + dec2str(_ranks, 5) + "\n";
+    out += prefix + "    Banks:          " + dec2str(_banks, 5) + "\n";
+    out += prefix + "    Row Size(B):    " + dec2str(_rowSize, 5) + "\n";
+    out += prefix + "    Page Policy:    " +
+           (_policy == DRAM_OPEN_PAGE ? "open" : "closed") + "\n";
+    out += prefix + "    Queue Size:     " + dec2str(_queueSize, 5) + "\n";
+    out += prefix + "\n";
+    out += prefix + "Timings(tCL-tRCD-tRP-tRAS-tBURST): " +
+           dec2str(_timing.tCL, 0) + "-" + dec2str(_timing.tRCD, 0) + "-" +
+           dec2str(_timing.tRP, 0) + "-" + dec2str(_timing.tRAS, 0) + "-" +
+           dec2str(_timing.tBURST, 0) + " x" + dec2str(_timing.cpuRatio, 0) +
+           " +" + dec2str(_timing.overhead, 0) + "\n";
+    out += "\n";
+
+    return out;
+}
+
+#endif // DRAM_H
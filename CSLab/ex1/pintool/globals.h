@@ -3,6 +3,9 @@
 
 #include <sstream> // ostringstream type
 
+#include "../../common/snapshot.h"
+#include "../../common/stats_writer.h"
+
 #define KILO 1024
 #define MEGA (KILO * KILO)
 #define GIGA (KILO * MEGA)
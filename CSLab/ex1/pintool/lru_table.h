@@ -0,0 +1,197 @@
+#ifndef LRU_TABLE_H
+#define LRU_TABLE_H
+
+#include <vector> // Save()/Load() buffers
+
+#include "globals.h"
+
+/**
+ * `LRU_TABLE` is an LRU set whose Find/Replace/DeleteIfPresent cost does not
+ * depend on its associativity. Tags live in a node pool, chained in an
+ * intrusive doubly-linked LRU -> MRU list and indexed by an open-addressing
+ * hash table (linear probing with backward-shift deletion, at most half
+ * full). Both are in the storage given to Attach() (see SET_ARENA).
+ *
+ * It behaves exactly like the vector-based LRU sets and saves the same state
+ * (tags in LRU -> MRU order), so the two are interchangeable, snapshots
+ * included. It pays off for highly associative (e.g. fully associative)
+ * configurations, where the vector sets scan and shift every entry.
+ *
+ * `TAG(-1)` must be the invalid tag of the structure (INVALID_TAG,
+ * INVALID_TLB_TAG).
+ **/
+template <class TAG> class LRU_TABLE {
+  protected:
+    typedef struct {
+        TAG tag;
+        INT32 prev, next; // neighbours in the LRU list, or next free node
+    } NODE;
+
+    NODE *_nodes;
+    INT32 *_buckets; // node index, or -1 if empty
+    UINT32 _bucketMask;
+    INT32 _lru, _mru, _free;
+    UINT32 _size;
+    UINT32 _associativity;
+
+    UINT32 Home(TAG tag) const {
+        UINT64 h = UINT64(ADDRINT(tag)) * 0x9E3779B97F4A7C15ULL;
+        return UINT32(h >> 32) & _bucketMask;
+    }
+
+    // Bucket holding `tag`, or -1
+    INT32 Lookup(TAG tag) const {
+        for (UINT32 b = Home(tag); _buckets[b] >= 0; b = (b + 1) & _bucketMask)
+            if (_nodes[_buckets[b]].tag == tag)
+                return b;
+        return -1;
+    }
+
+    VOID Insert(INT32 node) {
+        UINT32 b = Home(_nodes[node].tag);
+        while (_buckets[b] >= 0)
+            b = (b + 1) & _bucketMask;
+        _buckets[b] = node;
+    }
+
+    // Empties bucket `hole`, moving back later entries of its probe run
+    VOID Erase(UINT32 hole) {
+        for (UINT32 b = (hole + 1) & _bucketMask; _buckets[b] >= 0;
+             b = (b + 1) & _bucketMask) {
+            UINT32 home = Home(_nodes[_buckets[b]].tag);
+            // Move the entry unless its home lies cyclically in (hole, b]
+            bool stays = (hole < b) ? (hole < home && home <= b)
+                                    : (hole < home || home <= b);
+            if (!stays) {
+                _buckets[hole] = _buckets[b];
+                hole = b;
+            }
+        }
+        _buckets[hole] = -1;
+    }
+
+    VOID Unlink(INT32 node) {
+        NODE &n = _nodes[node];
+        if (n.prev >= 0)
+            _nodes[n.prev].next = n.next;
+        else
+            _lru = n.next;
+        if (n.next >= 0)
+            _nodes[n.next].prev = n.prev;
+        else
+            _mru = n.prev;
+    }
+
+    VOID PushMRU(INT32 node) {
+        NODE &n = _nodes[node];
+        n.prev = _mru;
+        n.next = -1;
+        if (_mru >= 0)
+            _nodes[_mru].next = node;
+        else
+            _lru = node;
+        _mru = node;
+    }
+
+    VOID Remove(UINT32 bucket) {
+        INT32 node = _buckets[bucket];
+        Erase(bucket);
+        Unlink(node);
+        _nodes[node].next = _free;
+        _free = node;
+        _size--;
+    }
+
+    static UINT32 NumBuckets(UINT32 associativity) {
+        UINT32 buckets = 1;
+        while (buckets < 2 * associativity)
+            buckets <<= 1;
+        return buckets;
+    }
+
+  public:
+    LRU_TABLE() : _nodes(NULL), _buckets(NULL), _associativity(0) {}
+
+    static size_t StorageBytes(UINT32 associativity) {
+        return associativity * sizeof(NODE) +
+               NumBuckets(associativity) * sizeof(INT32);
+    }
+    VOID Attach(VOID *storage, UINT32 associativity) {
+        _nodes = (NODE *)storage;
+        _buckets = (INT32 *)(_nodes + associativity);
+        SetAssociativity(associativity);
+    }
+
+    // Empties the set; `associativity` cannot exceed the attached storage
+    VOID SetAssociativity(UINT32 associativity) {
+        UINT32 buckets = NumBuckets(associativity);
+
+        _associativity = associativity;
+        for (UINT32 b = 0; b < buckets; b++)
+            _buckets[b] = -1;
+        _bucketMask = buckets - 1;
+        _lru = _mru = -1;
+        _size = 0;
+        _free = associativity ? 0 : -1;
+        for (UINT32 i = 0; i < associativity; i++)
+            _nodes[i].next = (i + 1 < associativity) ? INT32(i + 1) : -1;
+    }
+    UINT32 GetAssociativity() { return _associativity; }
+
+    string Name() { return "LRU"; }
+
+    UINT32 Find(TAG tag) {
+        INT32 b = Lookup(tag);
+        if (b < 0)
+            return false;
+        INT32 node = _buckets[b];
+        if (node != _mru) { // Tag found, lets make it MRU
+            Unlink(node);
+            PushMRU(node);
+        }
+        return true;
+    }
+
+    TAG Replace(TAG tag) {
+        TAG ret = TAG(-1);
+        if (_size == _associativity) {
+            ret = _nodes[_lru].tag;
+            Remove(Lookup(ret));
+        }
+        INT32 node = _free;
+        _free = _nodes[node].next;
+        _nodes[node].tag = tag;
+        PushMRU(node);
+        Insert(node);
+        _size++;
+        return ret;
+    }
+
+    VOID DeleteIfPresent(TAG tag) {
+        INT32 b = Lookup(tag);
+        if (b >= 0)
+            Remove(b);
+    }
+
+    // Brings the hash index and the nodes into the host caches
+    VOID Prefetch() const {
+        __builtin_prefetch(_buckets);
+        __builtin_prefetch(_nodes);
+    }
+
+    VOID Save(SNAPSHOT_WRITER &s) const {
+        std::vector<TAG> tags;
+        for (INT32 node = _lru; node >= 0; node = _nodes[node].next)
+            tags.push_back(_nodes[node].tag);
+        s.PutVector(tags);
+    }
+    VOID Load(SNAPSHOT_READER &s) {
+        std::vector<TAG> tags;
+        s.GetVector(tags);
+        SetAssociativity(_associativity);
+        for (size_t i = 0; i < tags.size(); i++)
+            Replace(tags[i]);
+    }
+};
+
+#endif // LRU_TABLE_H
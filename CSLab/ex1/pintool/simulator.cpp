@@ -3,11 +3,15 @@
 #include <cassert>
 #include <fstream>
 #include <iostream>
+#include <map>
 
+#include "../../common/roi.h"
 #include "globals.h"
 #include "tlb.h"
 #define STORE_ALLOCATION STORE_ALLOCATE
 #include "cache.h"
+#include "dram.h"
+#include "cpi_stack.h"
 
 #define MILLION10 10000000
 
@@ -16,6 +20,28 @@
 /* ===================================================================== */
 KNOB<string> KnobOutputFile(KNOB_MODE_WRITEONCE, "pintool", "o",
                             "cslab_cache.out", "specify dcache file name");
+KNOB<string> KnobFormat(KNOB_MODE_WRITEONCE, "pintool", "format", "text",
+                        "output format (text|json|csv)");
+KNOB<UINT32> KnobHugePages(KNOB_MODE_WRITEONCE, "pintool", "hugepages", "0",
+                           "Back the simulated sets with huge pages");
+
+// Region of interest
+KNOB<UINT32> KnobRoiMarkers(KNOB_MODE_WRITEONCE, "pintool", "roi", "1",
+                            "Simulate between __parsec_roi_{begin,end}");
+KNOB<UINT64> KnobFastForward(KNOB_MODE_WRITEONCE, "pintool", "ffwd", "0",
+                             "Instructions to skip before simulating");
+KNOB<UINT64> KnobMaxInstructions(KNOB_MODE_WRITEONCE, "pintool", "maxins",
+                                 "0",
+                                 "Instructions to simulate (0 for no limit)");
+
+// Checkpointing
+KNOB<string> KnobCheckpointIn(KNOB_MODE_WRITEONCE, "pintool", "ckpt_in", "",
+                              "restore the simulated state from this file");
+KNOB<string> KnobCheckpointOut(KNOB_MODE_WRITEONCE, "pintool", "ckpt_out", "",
+                               "save the simulated state to this file");
+KNOB<UINT64> KnobCheckpointAt(KNOB_MODE_WRITEONCE, "pintool", "ckpt_at", "0",
+                              "instruction count at which to save the state "
+                              "(0 for the end of the run)");
 
 // Tlb
 KNOB<UINT32> KnobTlbSizeEntries(KNOB_MODE_WRITEONCE, "pintool", "TLBe", "64",
@@ -43,24 +69,108 @@ KNOB<UINT32>
     KnobL2Associativity(KNOB_MODE_WRITEONCE, "pintool", "L2a", "8",
                         "L2 cache associativity (1 for direct mapped)");
 
+KNOB<string> KnobL2Index(KNOB_MODE_WRITEONCE, "pintool", "L2idx", "modulo",
+                         "L2 set index function (modulo|xor|prime|skewed)");
+KNOB<UINT32> KnobL2SampleRatio(
+    KNOB_MODE_WRITEONCE, "pintool", "L2sample", "1",
+    "Model only 1/N of the L2 sets and scale their misses (1 models all)");
+
 // Prefetcher
 KNOB<UINT32> KnobL2PrefetchLines(
     KNOB_MODE_WRITEONCE, "pintool", "L2prf", "0",
     "Number of lines to prefetch to L2 (0 disables prefetching)");
 
+// Victim cache
+KNOB<UINT32> KnobVictimEntries(KNOB_MODE_WRITEONCE, "pintool", "VCe", "0",
+                               "L1 victim cache entries (0 disables it)");
+KNOB<UINT32> KnobVictimLatency(KNOB_MODE_WRITEONCE, "pintool", "VClat", "2",
+                               "Victim cache hit latency (cycles)");
+
+// Non-temporal stores
+KNOB<UINT32> KnobWriteCombining(KNOB_MODE_WRITEONCE, "pintool", "WCe", "4",
+                                "Write-combining buffers for NT stores");
+
+// Instruction fetch (L1I + ITLB)
+KNOB<UINT32> KnobIFetch(KNOB_MODE_WRITEONCE, "pintool", "IFETCH", "0",
+                        "Simulate instruction fetch through L1I and ITLB");
+KNOB<UINT32> KnobL1ICacheSize(KNOB_MODE_WRITEONCE, "pintool", "L1Ic", "32",
+                              "L1 instruction cache size in kilobytes");
+KNOB<UINT32> KnobL1IBlockSize(KNOB_MODE_WRITEONCE, "pintool", "L1Ib", "64",
+                              "L1 instruction cache block size in bytes");
+KNOB<UINT32> KnobL1IAssociativity(
+    KNOB_MODE_WRITEONCE, "pintool", "L1Ia", "8",
+    "L1 instruction cache associativity (1 for direct mapped)");
+KNOB<UINT32> KnobItlbSizeEntries(KNOB_MODE_WRITEONCE, "pintool", "ITLBe",
+                                 "64", "ITLB size in #entries");
+KNOB<UINT32> KnobItlbAssociativity(KNOB_MODE_WRITEONCE, "pintool", "ITLBa",
+                                   "4",
+                                   "ITLB associativity (1 for direct mapped)");
+
+// Main memory
+KNOB<UINT32> KnobDram(KNOB_MODE_WRITEONCE, "pintool", "DRAM", "0",
+                      "Enable the DRAM model (0 uses a fixed L2 miss latency)");
+KNOB<UINT32> KnobDramChannels(KNOB_MODE_WRITEONCE, "pintool", "DRAMc", "1",
+                              "DRAM channels");
+KNOB<UINT32> KnobDramRanks(KNOB_MODE_WRITEONCE, "pintool", "DRAMr", "1",
+                           "DRAM ranks per channel");
+KNOB<UINT32> KnobDramBanks(KNOB_MODE_WRITEONCE, "pintool", "DRAMb", "16",
+                           "DRAM banks per rank");
+KNOB<UINT32> KnobDramRowSize(KNOB_MODE_WRITEONCE, "pintool", "DRAMrow", "8192",
+                             "DRAM row buffer size in bytes");
+KNOB<string> KnobDramPolicy(KNOB_MODE_WRITEONCE, "pintool", "DRAMpol", "open",
+                            "DRAM row buffer policy (open|closed)");
+KNOB<UINT32> KnobDramQueue(KNOB_MODE_WRITEONCE, "pintool", "DRAMq", "32",
+                           "DRAM controller queue entries");
+KNOB<UINT32> KnobDramTCL(KNOB_MODE_WRITEONCE, "pintool", "tCL", "16",
+                         "DRAM CAS latency (DRAM cycles)");
+KNOB<UINT32> KnobDramTRCD(KNOB_MODE_WRITEONCE, "pintool", "tRCD", "16",
+                          "DRAM RAS to CAS delay (DRAM cycles)");
+KNOB<UINT32> KnobDramTRP(KNOB_MODE_WRITEONCE, "pintool", "tRP", "16",
+                         "DRAM precharge time (DRAM cycles)");
+KNOB<UINT32> KnobDramTRAS(KNOB_MODE_WRITEONCE, "pintool", "tRAS", "39",
+                          "DRAM activate to precharge time (DRAM cycles)");
+KNOB<UINT32> KnobDramTBurst(KNOB_MODE_WRITEONCE, "pintool", "tBURST", "4",
+                            "DRAM data burst time (DRAM cycles)");
+KNOB<UINT32> KnobDramRatio(KNOB_MODE_WRITEONCE, "pintool", "DRAMratio", "3",
+                           "CPU cycles per DRAM cycle");
+KNOB<UINT32> KnobDramOverhead(KNOB_MODE_WRITEONCE, "pintool", "DRAMovh", "40",
+                              "Memory controller overhead (CPU cycles)");
+
 /* ===================================================================== */
 
 /* ===================================================================== */
 /* Global Variables                                                      */
 /* ===================================================================== */
-typedef SINGLE_LEVEL_TLB<TLB_SET::LRU> TLB_T;
+// The Tlb configurations go up to fully associative
+typedef SINGLE_LEVEL_TLB<TLB_SET::FA_LRU> TLB_T;
 TLB_T *tlb;
+TLB_T *itlb;
 
 typedef TWO_LEVEL_CACHE<CACHE_SET::LRU> CACHE_T;
 CACHE_T *two_level_cache;
 
+DRAM *dram;
+
+ROI *roi;
+
 UINT64 total_cycles, total_instructions;
+CPI_STACK last_cpi_stack; // at the previous report
 std::ofstream outFile;
+STATS_WRITER *stats_writer;
+
+/**
+ * The instruction cache lines fetched by a basic block, computed once at
+ * instrumentation time. `newPage[i]` is set when lines[i] is the first line
+ * of a page within the block, i.e. when the ITLB has to be looked up.
+ **/
+typedef struct {
+    UINT32 size;
+    std::vector<ADDRINT> lines;
+    std::vector<bool> newPage;
+} FETCH_BLOCK;
+
+// Fetch blocks are shared among traces that contain the same basic block
+std::map<ADDRINT, FETCH_BLOCK *> fetch_blocks;
 
 /* ===================================================================== */
 
@@ -73,72 +183,109 @@ INT32 Usage() {
 
 /* ===================================================================== */
 
-VOID Load(ADDRINT addr) {
+// Accesses of `size` bytes; those crossing a page or line are split by the
+// Tlb and the cache.
+VOID Load(ADDRINT addr, UINT32 size) {
     // get the address translation from Virtual to Physical address space
     // note: only for timing simulation purpose
     // "addr" is virtual and remains unchanged for accessing the cache hierarchy
-    total_cycles += tlb->Access(addr, TLB_T::ACCESS_TYPE_LOAD);
+    total_cycles += tlb->AccessRange(addr, size, TLB_T::ACCESS_TYPE_LOAD);
     // load the data from the cache hierarchy
-    total_cycles += two_level_cache->Access(addr, CACHE_T::ACCESS_TYPE_LOAD);
+    total_cycles += two_level_cache->AccessRange(
+        addr, size, CACHE_T::ACCESS_TYPE_LOAD, total_cycles);
 }
 
-VOID Store(ADDRINT addr) {
+VOID Store(ADDRINT addr, UINT32 size) {
     // get the address translation from Virtual to Physical address space
     // note: only for timing simulation purpose
     // "addr" is virtual and remains unchanged for accessing the cache hierarchy
-    total_cycles += tlb->Access(addr, TLB_T::ACCESS_TYPE_STORE);
+    total_cycles += tlb->AccessRange(addr, size, TLB_T::ACCESS_TYPE_STORE);
     // store the data to the cache hierarchy
-    total_cycles += two_level_cache->Access(addr, CACHE_T::ACCESS_TYPE_STORE);
+    total_cycles += two_level_cache->AccessRange(
+        addr, size, CACHE_T::ACCESS_TYPE_STORE, total_cycles);
 }
 
-VOID count_instruction() {
-    total_instructions++;
-    total_cycles++;
+VOID SoftwarePrefetch(ADDRINT addr, BOOL toL1) {
+    two_level_cache->SoftwarePrefetch(addr, toL1, total_cycles);
+}
 
-    if (total_instructions % MILLION10 == 0) {
-        outFile << "--------\n";
-        outFile << "Total Statistics\n";
-        outFile << "--------\n";
-        outFile << "Total Instructions: " << total_instructions << "\n";
-        outFile << "Total Cycles: " << total_cycles << "\n";
-        outFile << "IPC: " << (double)total_instructions / (double)total_cycles
-                << "\n";
-        outFile << "\n";
+// MOVNT*: translated as usual, then sent to the write-combining buffers
+VOID StoreNonTemporal(ADDRINT addr, UINT32 size) {
+    total_cycles += tlb->AccessRange(addr, size, TLB_T::ACCESS_TYPE_STORE);
+    two_level_cache->StoreNonTemporal(addr, size, total_cycles);
+}
 
-        // Report Cache configuration + statistics
-        outFile << tlb->PrintDetails("");
-        outFile << tlb->StatsLong("");
-        outFile << "\n\n";
-        outFile << two_level_cache->PrintCache("");
-        outFile << two_level_cache->StatsLong("");
-    }
+// MASKMOV*: only the bytes whose mask byte has its top bit set are written
+VOID MaskedStoreNonTemporal(ADDRINT addr, UINT32 size,
+                            const PIN_REGISTER *mask) {
+    UINT64 written = 0;
+    for (UINT32 i = 0; i < size && i < 64; i++)
+        if (mask->byte[i] & 0x80)
+            written |= UINT64(1) << i;
+    total_cycles += tlb->AccessRange(addr, size, TLB_T::ACCESS_TYPE_STORE);
+    two_level_cache->StoreNonTemporal(addr, size, total_cycles, written);
 }
 
-VOID Instruction(INS ins, void *v) {
-    UINT32 memOperands = INS_MemoryOperandCount(ins);
+// Gathers and scatters: every element whose mask bit is set is an access
+VOID MultiMemAccess(PIN_MULTI_MEM_ACCESS_INFO *info) {
+    for (UINT32 i = 0; i < info->numberOfMemops; i++) {
+        if (!info->memop[i].maskOn)
+            continue;
+        if (info->memop[i].memopType == PIN_MEMOP_LOAD)
+            Load(info->memop[i].memoryAddress, info->memop[i].bytesAccessed);
+        else
+            Store(info->memop[i].memoryAddress, info->memop[i].bytesAccessed);
+    }
+}
 
-    // Instrument each memory operand. If the operand is both read and written
-    // it will be processed twice.
-    // Iterating over memory operands ensures that instructions on IA-32 with
-    // two read operands (such as SCAS and CMPS) are correctly handled.
-    for (UINT32 memOp = 0; memOp < memOperands; memOp++) {
-        if (INS_MemoryOperandIsRead(ins, memOp)) {
-            INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)Load,
-                                     IARG_MEMORYOP_EA, memOp, IARG_END);
-        }
-        if (INS_MemoryOperandIsWritten(ins, memOp)) {
-            INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)Store,
-                                     IARG_MEMORYOP_EA, memOp, IARG_END);
-        }
+// Gathers the cycle accounting of the components. The stack adds up to
+// total_cycles.
+CPI_STACK CurrentCpiStack() {
+    CPI_STACK stack;
+
+    stack.Instructions() = total_instructions;
+    stack.Cycles(CPI_STACK::CPI_BASE) = total_instructions +
+                                        tlb->HitCycles() +
+                                        two_level_cache->L1Cycles();
+    stack.Cycles(CPI_STACK::CPI_TLB) = tlb->MissCycles();
+    if (itlb) {
+        stack.Cycles(CPI_STACK::CPI_BASE) += itlb->HitCycles();
+        stack.Cycles(CPI_STACK::CPI_TLB) += itlb->MissCycles();
     }
+    stack.Cycles(CPI_STACK::CPI_L2) = two_level_cache->L2Cycles();
+    stack.Cycles(CPI_STACK::CPI_MEMORY) = two_level_cache->MemoryCycles();
+    stack.Cycles(CPI_STACK::CPI_PREFETCH) = two_level_cache->PrefetchCycles();
+    return stack;
+}
 
-    // Count each and every instruction
-    INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)count_instruction, IARG_END);
+// One flat record per report; `final` distinguishes the end-of-run record
+// from the periodic ones.
+VOID ExportStatistics(bool final) {
+    STATS_WRITER &w = *stats_writer;
+    const CPI_STACK cpiStack = CurrentCpiStack();
+
+    w.Clear();
+    w.Add("", "Final", UINT64(final));
+    w.Add("", "Total-Instructions", total_instructions);
+    w.Add("", "Total-Cycles", total_cycles);
+    w.Add("", "IPC", (double)total_instructions / (double)total_cycles);
+    cpiStack.Export(w, cpiStack - last_cpi_stack);
+    last_cpi_stack = cpiStack;
+    tlb->Export(w);
+    if (itlb)
+        itlb->Export(w);
+    two_level_cache->Export(w);
+    if (dram)
+        dram->Export(w);
+    w.Write(outFile);
 }
 
-/* ===================================================================== */
+VOID PrintStatistics(bool final) {
+    if (stats_writer->Format() != STATS_WRITER::FORMAT_TEXT) {
+        ExportStatistics(final);
+        return;
+    }
 
-VOID Fini(int code, VOID *v) {
     // Report total instructions and total cycles
     outFile << "--------\n";
     outFile << "Total Statistics\n";
@@ -147,36 +294,259 @@ VOID Fini(int code, VOID *v) {
     outFile << "Total Cycles: " << total_cycles << "\n";
     outFile << "IPC: " << (double)total_instructions / (double)total_cycles
             << "\n";
+    const CPI_STACK cpiStack = CurrentCpiStack();
+    outFile << cpiStack.StatsLong("", cpiStack - last_cpi_stack);
+    last_cpi_stack = cpiStack;
+    if (two_level_cache->L2Sampling()) {
+        const double kilo = (double)total_instructions / 1000.0;
+        outFile << "L2-MPKI (est.): "
+                << two_level_cache->L2EstimatedMisses() / kilo << " +- "
+                << two_level_cache->L2EstimatedMissesError() / kilo
+                << " (95%)\n";
+    }
+    if (itlb) {
+        outFile << "L1I-MPKI: "
+                << two_level_cache->L1IMisses() /
+                       ((double)total_instructions / 1000.0)
+                << "\n";
+        outFile << "ITLB-MPKI: "
+                << itlb->TlbMisses() / ((double)total_instructions / 1000.0)
+                << "\n";
+    }
     outFile << "\n";
 
     // Report Cache configuration + statistics
     outFile << tlb->PrintDetails("");
     outFile << tlb->StatsLong("");
     outFile << "\n\n";
+    if (itlb) {
+        outFile << itlb->PrintDetails("");
+        outFile << itlb->StatsLong("");
+        outFile << "\n\n";
+    }
     outFile << two_level_cache->PrintCache("");
     outFile << two_level_cache->StatsLong("");
 
-    outFile.close();
+    // Report main memory configuration + statistics
+    if (dram) {
+        outFile << dram->PrintDetails("");
+        outFile << dram->StatsLong("");
+    }
 }
 
-VOID roi_begin() { INS_AddInstrumentFunction(Instruction, 0); }
+VOID SaveCheckpoint() {
+    SNAPSHOT_WRITER snapshot;
 
-VOID roi_end() {
-    // We need to manually call Fini here because it is not called by PIN
-    // if PIN_Detach() is encountered.
-    Fini(0, 0);
-    PIN_Detach();
+    tlb->Save(snapshot);
+    if (itlb)
+        itlb->Save(snapshot);
+    two_level_cache->Save(snapshot);
+    if (!snapshot.Write(KnobCheckpointOut.Value()))
+        cerr << "Could not write checkpoint " << KnobCheckpointOut.Value()
+             << endl;
 }
 
-VOID Routine(RTN rtn, void *v) {
-    RTN_Open(rtn);
+BOOL LoadCheckpoint() {
+    SNAPSHOT_READER snapshot;
 
-    if (RTN_Name(rtn) == "__parsec_roi_begin")
-        RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR)roi_begin, IARG_END);
-    if (RTN_Name(rtn) == "__parsec_roi_end")
-        RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR)roi_end, IARG_END);
+    if (!snapshot.Read(KnobCheckpointIn.Value())) {
+        cerr << "Could not read checkpoint " << KnobCheckpointIn.Value()
+             << endl;
+        return false;
+    }
+    // Components whose configuration is not in the snapshot start cold
+    if (!tlb->Load(snapshot))
+        cerr << "Checkpoint: no matching Tlb state, starting cold" << endl;
+    if (itlb && !itlb->Load(snapshot))
+        cerr << "Checkpoint: no matching ITlb state, starting cold" << endl;
+    if (!two_level_cache->Load(snapshot))
+        cerr << "Checkpoint: cache state not (fully) restored" << endl;
+    return true;
+}
+
+VOID count_instruction() {
+    total_instructions++;
+    total_cycles++;
 
-    RTN_Close(rtn);
+    if (total_instructions == KnobCheckpointAt.Value() &&
+        !KnobCheckpointOut.Value().empty())
+        SaveCheckpoint();
+
+    if (total_instructions % MILLION10 == 0) {
+        PrintStatistics(false);
+    }
+}
+
+ADDRINT FirstRepIteration(BOOL first) { return first; }
+
+VOID Fetch(FETCH_BLOCK *fb) {
+    const UINT32 n = fb->lines.size();
+    for (UINT32 i = 0; i < n; i++) {
+        if (fb->newPage[i])
+            total_cycles += itlb->Access(fb->lines[i], TLB_T::ACCESS_TYPE_LOAD);
+        total_cycles += two_level_cache->Fetch(fb->lines[i], total_cycles);
+    }
+}
+
+FETCH_BLOCK *GetFetchBlock(ADDRINT start, UINT32 size) {
+    std::map<ADDRINT, FETCH_BLOCK *>::iterator it = fetch_blocks.find(start);
+    if (it != fetch_blocks.end() && it->second->size == size)
+        return it->second;
+
+    const UINT32 lineShift = FloorLog2(KnobL1IBlockSize.Value());
+    const UINT32 pageShift = FloorLog2(KnobPageSize.Value());
+    const ADDRINT end = start + size - 1;
+
+    FETCH_BLOCK *fb = new FETCH_BLOCK;
+    fb->size = size;
+    for (ADDRINT line = start >> lineShift; line <= (end >> lineShift);
+         line++) {
+        ADDRINT addr = line << lineShift;
+        bool newPage = fb->lines.empty() ||
+                       (addr >> pageShift) != (fb->lines.back() >> pageShift);
+        fb->lines.push_back(addr);
+        fb->newPage.push_back(newPage);
+    }
+    fetch_blocks[start] = fb;
+    return fb;
+}
+
+VOID Trace(TRACE trace, void *v) {
+    if (!roi->Simulating())
+        return;
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl)) {
+        FETCH_BLOCK *fb = GetFetchBlock(BBL_Address(bbl), BBL_Size(bbl));
+        BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)Fetch, IARG_PTR, fb,
+                       IARG_END);
+    }
+}
+
+// PREFETCHT1/T2 only fill L2, the other hints (T0, NTA, W) L1 as well
+static BOOL PrefetchesToL1(INS ins) {
+    switch (INS_Opcode(ins)) {
+    case XED_ICLASS_PREFETCHT1:
+    case XED_ICLASS_PREFETCHT2:
+        return false;
+    default:
+        return true;
+    }
+}
+
+// Their mask is the second register operand
+static BOOL IsMaskedNonTemporalStore(INS ins) {
+    switch (INS_Opcode(ins)) {
+    case XED_ICLASS_MASKMOVQ:
+    case XED_ICLASS_MASKMOVDQU:
+    case XED_ICLASS_VMASKMOVDQU:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static BOOL IsNonTemporalStore(INS ins) {
+    switch (INS_Opcode(ins)) {
+    case XED_ICLASS_MOVNTI:
+    case XED_ICLASS_MOVNTQ:
+    case XED_ICLASS_MOVNTDQ:
+    case XED_ICLASS_MOVNTPS:
+    case XED_ICLASS_MOVNTPD:
+    case XED_ICLASS_MOVNTSS:
+    case XED_ICLASS_MOVNTSD:
+    case XED_ICLASS_VMOVNTDQ:
+    case XED_ICLASS_VMOVNTPS:
+    case XED_ICLASS_VMOVNTPD:
+        return true;
+    default:
+        return IsMaskedNonTemporalStore(ins);
+    }
+}
+
+VOID Instruction(INS ins, void *v) {
+    if (!roi->Simulating())
+        return;
+
+    UINT32 memOperands = INS_MemoryOperandCount(ins);
+
+    // Software prefetches fill the cache without stalling
+    if (INS_IsPrefetch(ins)) {
+        for (UINT32 memOp = 0; memOp < memOperands; memOp++)
+            INS_InsertPredicatedCall(ins, IPOINT_BEFORE,
+                                     (AFUNPTR)SoftwarePrefetch,
+                                     IARG_MEMORYOP_EA, memOp, IARG_BOOL,
+                                     PrefetchesToL1(ins), IARG_END);
+        memOperands = 0;
+    }
+
+    // Gathers and scatters access a vector of addresses, only known at run
+    // time
+    if (INS_HasMemoryVector(ins)) {
+        INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)MultiMemAccess,
+                                 IARG_MULTI_MEMORYACCESS_EA, IARG_END);
+        memOperands = 0;
+    }
+
+    // Instrument each memory operand. If the operand is both read and written
+    // it will be processed twice.
+    // Iterating over memory operands ensures that instructions on IA-32 with
+    // two read operands (such as SCAS and CMPS) are correctly handled.
+    // The calls of REP-prefixed instructions (rep movs, rep stos ...) run
+    // once per iteration, i.e. once per element moved.
+    for (UINT32 memOp = 0; memOp < memOperands; memOp++) {
+        if (INS_MemoryOperandIsRead(ins, memOp)) {
+            INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)Load,
+                                     IARG_MEMORYOP_EA, memOp,
+                                     IARG_MEMORYOP_SIZE, memOp, IARG_END);
+        }
+        if (INS_MemoryOperandIsWritten(ins, memOp) &&
+            IsMaskedNonTemporalStore(ins)) {
+            INS_InsertPredicatedCall(ins, IPOINT_BEFORE,
+                                     (AFUNPTR)MaskedStoreNonTemporal,
+                                     IARG_MEMORYOP_EA, memOp,
+                                     IARG_MEMORYOP_SIZE, memOp,
+                                     IARG_REG_CONST_REFERENCE,
+                                     INS_OperandReg(ins, 1), IARG_END);
+        } else if (INS_MemoryOperandIsWritten(ins, memOp)) {
+            AFUNPTR store = IsNonTemporalStore(ins) ? (AFUNPTR)StoreNonTemporal
+                                                    : (AFUNPTR)Store;
+            INS_InsertPredicatedCall(ins, IPOINT_BEFORE, store,
+                                     IARG_MEMORYOP_EA, memOp,
+                                     IARG_MEMORYOP_SIZE, memOp, IARG_END);
+        }
+    }
+
+    // Count each and every instruction, a REP-prefixed one only once
+    if (INS_HasRealRep(ins)) {
+        INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)FirstRepIteration,
+                         IARG_FIRST_REP_ITERATION, IARG_END);
+        INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)count_instruction,
+                           IARG_END);
+    } else {
+        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)count_instruction,
+                       IARG_END);
+    }
+}
+
+/* ===================================================================== */
+
+//> Without -ckpt_at, -ckpt_out saves the state at the end of the run
+VOID FiniCheckpoint() {
+    if (KnobCheckpointOut.Value().empty())
+        return;
+    if (KnobCheckpointAt.Value() == 0)
+        SaveCheckpoint();
+    else if (total_instructions < KnobCheckpointAt.Value())
+        cerr << "Checkpoint: only " << total_instructions
+             << " instructions ran, " << KnobCheckpointOut.Value()
+             << " not written" << endl;
+}
+
+VOID Fini(int code, VOID *v) {
+    // Their writes belong to the simulated run
+    two_level_cache->DrainWriteCombining(total_cycles);
+    FiniCheckpoint();
+    PrintStatistics(true);
+    outFile.close();
 }
 
 /* ===================================================================== */
@@ -189,19 +559,60 @@ int main(int argc, char *argv[]) {
 
     // Open output file
     outFile.open(KnobOutputFile.Value().c_str());
+    stats_writer =
+        new STATS_WRITER(STATS_WRITER::ParseFormat(KnobFormat.Value()));
+
+    SET_ARENA::UseHugePages() = KnobHugePages.Value();
 
     // Initialize single level Tlb
     tlb = new TLB_T("Single level Tlb hierarchy", KnobTlbSizeEntries.Value(),
                     KnobPageSize.Value(), KnobTlbAssociativity.Value());
+    if (KnobIFetch.Value())
+        itlb = new TLB_T("Single level ITlb hierarchy",
+                         KnobItlbSizeEntries.Value(), KnobPageSize.Value(),
+                         KnobItlbAssociativity.Value(), 0, 100, true);
     // Initialize two level Cache
     two_level_cache =
         new CACHE_T("Two level Cache hierarchy", KnobL1CacheSize.Value() * KILO,
                     KnobL1BlockSize.Value(), KnobL1Associativity.Value(),
                     KnobL2CacheSize.Value() * KILO, KnobL2BlockSize.Value(),
                     KnobL2Associativity.Value(), KnobL2PrefetchLines.Value());
+    two_level_cache->SetL2Index(ParseL2Index(KnobL2Index.Value()));
+    two_level_cache->SetWriteCombiningBuffers(KnobWriteCombining.Value());
+    if (KnobVictimEntries.Value())
+        two_level_cache->AttachVictimCache(KnobVictimEntries.Value(),
+                                           KnobVictimLatency.Value());
+    if (KnobL2SampleRatio.Value() > 1)
+        two_level_cache->SampleL2Sets(KnobL2SampleRatio.Value());
+    if (KnobIFetch.Value())
+        two_level_cache->AttachInstructionCache(KnobL1ICacheSize.Value() * KILO,
+                                                KnobL1IBlockSize.Value(),
+                                                KnobL1IAssociativity.Value());
+    // Initialize main memory behind L2
+    if (KnobDram.Value()) {
+        DRAM_TIMING timing(KnobDramTCL.Value(), KnobDramTRCD.Value(),
+                           KnobDramTRP.Value(), KnobDramTRAS.Value(),
+                           KnobDramTBurst.Value(), KnobDramRatio.Value(),
+                           KnobDramOverhead.Value());
+        dram = new DRAM("Main memory (DRAM)", KnobDramChannels.Value(),
+                        KnobDramRanks.Value(), KnobDramBanks.Value(),
+                        KnobDramRowSize.Value(), KnobL2BlockSize.Value(),
+                        KnobDramPolicy.Value() == "closed" ? DRAM_CLOSED_PAGE
+                                                           : DRAM_OPEN_PAGE,
+                        KnobDramQueue.Value(), timing);
+        two_level_cache->AttachMemory(dram);
+    }
+
+    if (!KnobCheckpointIn.Value().empty() && !LoadCheckpoint())
+        return -1;
 
-    // Instrument function calls in order to catch __parsec_roi_{begin,end}
-    RTN_AddInstrumentFunction(Routine, 0);
+    // Only BBL counting runs outside the region of interest (ROI)
+    roi = new ROI(KnobFastForward.Value(), KnobMaxInstructions.Value(),
+                  KnobRoiMarkers.Value(), Fini);
+    roi->Instrument();
+    INS_AddInstrumentFunction(Instruction, 0);
+    if (KnobIFetch.Value())
+        TRACE_AddInstrumentFunction(Trace, 0);
 
     // Called when the instrumented application finishes its execution
     PIN_AddFiniFunction(Fini, 0);
@@ -4,7 +4,9 @@
 #include <cstdlib>  // rand()
 #include <iostream> // std::cout ...
 
+#include "arena.h"
 #include "globals.h"
+#include "lru_table.h"
 
 typedef UINT64 TLB_STATS; // type of tlb hit/miss counters
 
@@ -28,31 +30,43 @@ TLB_TAG INVALID_TLB_TAG(-1);
  **/
 namespace TLB_SET {
 
+/**
+ * Sets are views into the arena of their level (see SET_ARENA): the tags of
+ * a set live in the `associativity` entries given to Attach(), in
+ * LRU -> MRU order, the first `_size` of them valid.
+ **/
 class LRU {
   protected:
-    std::vector<TLB_TAG> _tags;
+    TLB_TAG *_tags;
+    UINT32 _size;
     UINT32 _associativity;
 
   public:
-    LRU(UINT32 associativity = 8) {
-        _associativity = associativity;
-        _tags.clear();
+    LRU() : _tags(NULL), _size(0), _associativity(0) {}
+
+    static size_t StorageBytes(UINT32 associativity) {
+        return associativity * sizeof(TLB_TAG);
+    }
+    VOID Attach(VOID *storage, UINT32 associativity) {
+        _tags = (TLB_TAG *)storage;
+        SetAssociativity(associativity);
     }
 
+    // Empties the set; `associativity` cannot exceed the attached storage
     VOID SetAssociativity(UINT32 associativity) {
         _associativity = associativity;
-        _tags.clear();
+        _size = 0;
     }
     UINT32 GetAssociativity() { return _associativity; }
 
     string Name() { return "LRU"; }
 
     UINT32 Find(TLB_TAG tag) {
-        for (std::vector<TLB_TAG>::iterator it = _tags.begin();
-             it != _tags.end(); ++it) {
-            if (*it == tag) { // Tag found, lets make it MRU
-                _tags.erase(it);
-                _tags.push_back(tag);
+        for (UINT32 i = 0; i < _size; i++) {
+            if (_tags[i] == tag) { // Tag found, lets make it MRU
+                for (; i + 1 < _size; i++)
+                    _tags[i] = _tags[i + 1];
+                _tags[_size - 1] = tag;
                 return true;
             }
         }
@@ -62,25 +76,45 @@ class LRU {
 
     TLB_TAG Replace(TLB_TAG tag) {
         TLB_TAG ret = INVALID_TLB_TAG;
-        _tags.push_back(tag);
-        if (_tags.size() > _associativity) {
-            ret = *_tags.begin();
-            _tags.erase(_tags.begin());
+        if (_size == _associativity) {
+            ret = _tags[0];
+            for (UINT32 i = 1; i < _size; i++)
+                _tags[i - 1] = _tags[i];
+            _size--;
         }
+        _tags[_size++] = tag;
         return ret;
     }
 
     VOID DeleteIfPresent(TLB_TAG tag) {
-        for (std::vector<TLB_TAG>::iterator it = _tags.begin();
-             it != _tags.end(); ++it) {
-            if (*it == tag) { // Tag found, lets make it MRU
-                _tags.erase(it);
+        for (UINT32 i = 0; i < _size; i++) {
+            if (_tags[i] == tag) { // Tag found
+                for (; i + 1 < _size; i++)
+                    _tags[i] = _tags[i + 1];
+                _size--;
                 break;
             }
         }
     }
+
+    // Tags are kept in LRU -> MRU order, so they are the whole state
+    VOID Save(SNAPSHOT_WRITER &s) const { s.PutArray(_tags, _size); }
+    VOID Load(SNAPSHOT_READER &s) {
+        std::vector<TLB_TAG> tags;
+        s.GetVector(tags);
+        // Only the MRU entries fit, should the snapshot be corrupt
+        size_t first = 0;
+        if (tags.size() > _associativity)
+            first = tags.size() - _associativity;
+        _size = 0;
+        for (size_t i = first; i < tags.size(); i++)
+            _tags[_size++] = tags[i];
+    }
 };
 
+// Same policy, with a cost independent of the associativity (see LRU_TABLE)
+typedef LRU_TABLE<TLB_TAG> FA_LRU;
+
 } // namespace TLB_SET
 
 template <class SET> class SINGLE_LEVEL_TLB {
@@ -96,9 +130,13 @@ template <class SET> class SINGLE_LEVEL_TLB {
 
     static const UINT32 HIT_MISS_NUM = 2;
     TLB_STATS _access[ACCESS_TYPE_NUM][HIT_MISS_NUM];
+    TLB_STATS _splits; // accesses crossing a page boundary
     UINT32 _latencies[ACCESS_RESULT_NUM];
     SET *_sets;
+    SET_ARENA *_arena; // storage of the sets
     const std::string _name;
+    const bool _instruction; // instruction (ITLB) or data TLB
+    const std::string _label;
     const UINT32 _entries;
     const UINT32 _pageSize;
     const UINT32 _associativity;
@@ -107,6 +145,10 @@ template <class SET> class SINGLE_LEVEL_TLB {
     const UINT32 _lineShift;    // i.e., no of page offset bits
     const UINT32 _setIndexMask; // mask applied to get the set index
 
+    // Page of the last access. Every access leaves its page as the MRU entry
+    // of its set, so repeating it is a hit that changes no state.
+    ADDRINT _lastPage;
+
     TLB_STATS SumAccess(bool hit) const {
         TLB_STATS sum = 0;
         for (UINT32 accessType = 0; accessType < ACCESS_TYPE_NUM; accessType++)
@@ -130,11 +172,16 @@ template <class SET> class SINGLE_LEVEL_TLB {
         tag = tag >> FloorLog2(NumSets());
     }
 
+    std::string SnapshotKey() const;
+
+    UINT32 Lookup(ADDRINT addr, ACCESS_TYPE accessType);
+
   public:
     // constructors/destructors
     SINGLE_LEVEL_TLB(std::string name, UINT32 Entries, UINT32 PageSize,
                      UINT32 Associativity, UINT32 HitLatency = 0,
-                     UINT32 MissLatency = 100);
+                     UINT32 MissLatency = 100, bool Instruction = false);
+    ~SINGLE_LEVEL_TLB() { delete _arena; } // the sets live in the arena
 
     // Stats
     TLB_STATS TlbHits(ACCESS_TYPE accessType) const {
@@ -149,18 +196,49 @@ template <class SET> class SINGLE_LEVEL_TLB {
     TLB_STATS TlbHits() const { return SumAccess(true); }
     TLB_STATS TlbMisses() const { return SumAccess(false); }
     TLB_STATS TlbAccesses() const { return TlbHits() + TlbMisses(); }
+    TLB_STATS TlbSplits() const { return _splits; }
+
+    // Cycles spent on hits and on misses
+    UINT64 HitCycles() const { return TlbHits() * _latencies[HIT]; }
+    UINT64 MissCycles() const { return TlbMisses() * _latencies[MISS]; }
 
     string StatsLong(string prefix = "") const;
     string PrintDetails(string prefix = "") const;
+    VOID Export(STATS_WRITER &w) const;
 
-    UINT32 Access(ADDRINT addr, ACCESS_TYPE accessType);
+    // Checkpointing of the TLB contents (not the stats)
+    VOID Save(SNAPSHOT_WRITER &s) const;
+    bool Load(SNAPSHOT_READER &s);
+
+    UINT32 Access(ADDRINT addr, ACCESS_TYPE accessType) {
+        if ((addr >> _lineShift) == _lastPage) {
+            _access[accessType][true]++;
+            return _latencies[HIT];
+        }
+        return Lookup(addr, accessType);
+    }
+    // Translation of the `size` bytes at `addr`: one lookup per page touched
+    UINT32 AccessRange(ADDRINT addr, UINT32 size, ACCESS_TYPE accessType) {
+        const ADDRINT firstPage = addr >> _lineShift;
+        const ADDRINT lastPage = (addr + size - 1) >> _lineShift;
+        UINT32 cycles = Access(addr, accessType);
+        if (size > 1 && lastPage != firstPage) {
+            _splits++;
+            for (ADDRINT page = firstPage + 1; page <= lastPage; page++)
+                cycles += Access(page << _lineShift, accessType);
+        }
+        return cycles;
+    }
 };
 
 template <class SET>
 SINGLE_LEVEL_TLB<SET>::SINGLE_LEVEL_TLB(std::string name, UINT32 Entries,
                                         UINT32 PageSize, UINT32 Associativity,
-                                        UINT32 HitLatency, UINT32 MissLatency)
-    : _name(name), _entries(Entries), _pageSize(PageSize),
+                                        UINT32 HitLatency, UINT32 MissLatency,
+                                        bool Instruction)
+    : _name(name), _instruction(Instruction),
+      _label(Instruction ? "ITlb" : "Tlb"), _entries(Entries),
+      _pageSize(PageSize),
       _associativity(Associativity), _lineShift(FloorLog2(PageSize)),
       _setIndexMask((Entries / Associativity) - 1) {
 
@@ -169,18 +247,17 @@ SINGLE_LEVEL_TLB<SET>::SINGLE_LEVEL_TLB(std::string name, UINT32 Entries,
     ASSERTX(IsPowerOf2(_setIndexMask + 1));
 
     // Allocate space for the sets
-    _sets = new SET[NumSets()];
+    _sets = NewSetArray<SET>(_arena, NumSets(), _associativity);
+    _lastPage = ~ADDRINT(0);
 
     _latencies[HIT] = HitLatency;
     _latencies[MISS] = MissLatency;
 
-    for (UINT32 i = 0; i < NumSets(); i++)
-        _sets[i].SetAssociativity(_associativity);
-
     for (UINT32 accessType = 0; accessType < ACCESS_TYPE_NUM; accessType++) {
         _access[accessType][false] = 0;
         _access[accessType][true] = 0;
     }
+    _splits = 0;
 }
 
 template <class SET>
@@ -191,13 +268,17 @@ string SINGLE_LEVEL_TLB<SET>::StatsLong(string prefix) const {
     string out;
 
     // Tlb stats first
-    out += prefix + "Tlb Stats:" + "\n";
+    out += prefix + _label + " Stats:" + "\n";
 
     for (UINT32 i = 0; i < ACCESS_TYPE_NUM; i++) {
         const ACCESS_TYPE accessType = ACCESS_TYPE(i);
 
-        std::string type(accessType == ACCESS_TYPE_LOAD ? "Tlb-Load"
-                                                        : "Tlb-Store");
+        // An ITLB only sees loads (fetches)
+        if (_instruction && TlbAccesses(accessType) == 0)
+            continue;
+
+        std::string type(_label + (accessType == ACCESS_TYPE_LOAD ? "-Load"
+                                                                  : "-Store"));
 
         out += prefix + ljstr(type + "-Hits:      ", headerWidth) +
                dec2str(TlbHits(accessType), numberWidth) + "  " +
@@ -220,17 +301,20 @@ string SINGLE_LEVEL_TLB<SET>::StatsLong(string prefix) const {
         out += prefix + "\n";
     }
 
-    out += prefix + ljstr("Tlb-Total-Hits:      ", headerWidth) +
+    out += prefix + ljstr(_label + "-Total-Hits:      ", headerWidth) +
            dec2str(TlbHits(), numberWidth) + "  " +
            fltstr(100.0 * TlbHits() / TlbAccesses(), 2, 6) + "%\n";
 
-    out += prefix + ljstr("Tlb-Total-Misses:    ", headerWidth) +
+    out += prefix + ljstr(_label + "-Total-Misses:    ", headerWidth) +
            dec2str(TlbMisses(), numberWidth) + "  " +
            fltstr(100.0 * TlbMisses() / TlbAccesses(), 2, 6) + "%\n";
 
-    out += prefix + ljstr("Tlb-Total-Accesses:  ", headerWidth) +
+    out += prefix + ljstr(_label + "-Total-Accesses:  ", headerWidth) +
            dec2str(TlbAccesses(), numberWidth) + "  " +
            fltstr(100.0 * TlbAccesses() / TlbAccesses(), 2, 6) + "%\n";
+
+    out += prefix + ljstr(_label + "-Page-Splits:     ", headerWidth) +
+           dec2str(TlbSplits(), numberWidth) + "\n";
     out += "\n";
 
     return out;
@@ -243,7 +327,7 @@ string SINGLE_LEVEL_TLB<SET>::PrintDetails(string prefix) const {
     out += prefix + "--------\n";
     out += prefix + _name + "\n";
     out += prefix + "--------\n";
-    out += prefix + "  Data Tlb:\n";
+    out += prefix + (_instruction ? "  Instruction Tlb:\n" : "  Data Tlb:\n");
     out += prefix + "    Entries:       " + dec2str(this->Entries(), 5) + "\n";
     out += prefix + "    Page Size(B):  " + dec2str(this->PageSize(), 5) + "\n";
     out += prefix + "    Associativity:  " + dec2str(this->Associativity(), 5) +
@@ -252,7 +336,7 @@ string SINGLE_LEVEL_TLB<SET>::PrintDetails(string prefix) const {
 
     out += prefix + "Latencies: " + dec2str(_latencies[HIT], 4) + " " +
            dec2str(_latencies[MISS], 4) + "\n";
-    out += prefix + "Tlb-Sets: " + dec2str(this->NumSets(), 4) + " - " +
+    out += prefix + _label + "-Sets: " + dec2str(this->NumSets(), 4) + " - " +
            this->_sets[0].Name() +
            " - assoc: " + dec2str(this->_sets[0].GetAssociativity(), 3) + "\n";
     out += "\n";
@@ -260,9 +344,52 @@ string SINGLE_LEVEL_TLB<SET>::PrintDetails(string prefix) const {
     return out;
 }
 
+template <class SET>
+VOID SINGLE_LEVEL_TLB<SET>::Export(STATS_WRITER &w) const {
+    static const char *fields[ACCESS_TYPE_NUM][HIT_MISS_NUM] = {
+        {"Load-Misses", "Load-Hits"}, {"Store-Misses", "Store-Hits"}};
+    const char *group = _label.c_str();
+
+    w.Add(group, "Entries", UINT64(_entries));
+    w.Add(group, "PageSize", UINT64(_pageSize));
+    w.Add(group, "Assoc", UINT64(_associativity));
+    for (UINT32 t = 0; t < ACCESS_TYPE_NUM; t++)
+        for (UINT32 h = 0; h < HIT_MISS_NUM; h++)
+            w.Add(group, fields[t][h], _access[t][h]);
+    w.Add(group, "Page-Splits", _splits);
+}
+
+template <class SET> std::string SINGLE_LEVEL_TLB<SET>::SnapshotKey() const {
+    std::ostringstream key;
+    key << _label << ":" << _entries << ":" << _pageSize << ":"
+        << _associativity << ":" << _sets[0].Name();
+    return key.str();
+}
+
+template <class SET> VOID SINGLE_LEVEL_TLB<SET>::Save(SNAPSHOT_WRITER &s) const {
+    s.BeginSection(SnapshotKey());
+    for (UINT32 i = 0; i < NumSets(); i++)
+        _sets[i].Save(s);
+    s.EndSection();
+}
+
+// Returns false (and leaves the TLB cold) if the snapshot does not match.
+template <class SET> bool SINGLE_LEVEL_TLB<SET>::Load(SNAPSHOT_READER &s) {
+    _lastPage = ~ADDRINT(0);
+    if (!s.OpenSection(SnapshotKey()))
+        return false;
+    for (UINT32 i = 0; i < NumSets(); i++)
+        _sets[i].Load(s);
+    if (s.Ok())
+        return true;
+    for (UINT32 i = 0; i < NumSets(); i++)
+        _sets[i].SetAssociativity(_associativity);
+    return false;
+}
+
 // Returns the cycles to serve the request.
 template <class SET>
-UINT32 SINGLE_LEVEL_TLB<SET>::Access(ADDRINT addr, ACCESS_TYPE accessType) {
+UINT32 SINGLE_LEVEL_TLB<SET>::Lookup(ADDRINT addr, ACCESS_TYPE accessType) {
     TLB_TAG Tag;
     UINT32 SetIndex;
     bool Hit = 0;
@@ -280,6 +407,7 @@ UINT32 SINGLE_LEVEL_TLB<SET>::Access(ADDRINT addr, ACCESS_TYPE accessType) {
         Set.Replace(Tag);
         cycles = _latencies[MISS];
     }
+    _lastPage = addr >> LineShift();
 
     return cycles;
 }
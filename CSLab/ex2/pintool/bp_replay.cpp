@@ -0,0 +1,155 @@
+/**
+ * Standalone branch predictor evaluation, built without Pin.
+ *
+ *   bp_replay [-o file] [-format text|json|csv] [-threads N] [-bp spec]...
+ *             trace
+ *
+ * Replays a trace written by cslab_branch_trace through the predictors, BTBs
+ * and RASes given with -bp (see predictor_factory.h; the cslab_branch
+ * default set if none), and reports them exactly as cslab_branch would.
+ * The trace is memory-mapped once and shared: the structures are split
+ * round robin among the worker threads, each of which decodes the whole
+ * trace and feeds its own shard.
+ **/
+#include "../../common/pin_shim.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <fstream>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "branch_trace.h"
+#include "predictor_factory.h"
+
+struct Worker {
+    pthread_t thread;
+    PredictorBank *bank;
+    const UINT8 *begin, *end;
+    UINT32 version;
+    UINT64 records;
+};
+
+static void *Replay(void *arg) {
+    Worker *w = (Worker *)arg;
+    BranchTraceDecoder decoder(w->begin, w->end, w->version);
+    BranchRecord r;
+
+    w->records = 0;
+    while (decoder.next(r)) {
+        w->bank->branch(r.kind, r.ip, r.target, r.taken, r.ins_size);
+        w->records++;
+    }
+    return NULL;
+}
+
+static int Usage() {
+    cerr << "usage: bp_replay [-o file] [-format text|json|csv] "
+            "[-threads N] [-bp spec]... trace"
+         << endl;
+    return 1;
+}
+
+static double Seconds(const timespec &start) {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) * 1e-9;
+}
+
+int main(int argc, char *argv[]) {
+    string output = "cslab_branch.out", format = "text", path;
+    std::vector<string> specs;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "-o" && i + 1 < argc)
+            output = argv[++i];
+        else if (arg == "-format" && i + 1 < argc)
+            format = argv[++i];
+        else if (arg == "-threads" && i + 1 < argc)
+            threads = atol(argv[++i]);
+        else if (arg == "-bp" && i + 1 < argc)
+            specs.push_back(argv[++i]);
+        else if (arg[0] != '-' && path.empty())
+            path = arg;
+        else
+            return Usage();
+    }
+    if (path.empty() || threads < 1)
+        return Usage();
+
+    // Map the trace
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 ||
+        size_t(st.st_size) < sizeof(BranchTraceHeader)) {
+        cerr << "Could not read trace " << path << endl;
+        return 1;
+    }
+    const UINT8 *data = (const UINT8 *)mmap(NULL, st.st_size, PROT_READ,
+                                            MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        cerr << "Could not map trace " << path << endl;
+        return 1;
+    }
+    madvise((void *)data, st.st_size, MADV_SEQUENTIAL);
+    BranchTraceHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (!header.valid()) {
+        cerr << path << " is not a branch trace" << endl;
+        return 1;
+    }
+
+    // No more shards than structures
+    if (specs.empty())
+        specs = PredictorSet::defaultSpecs();
+    if (size_t(threads) > specs.size())
+        threads = specs.size();
+    PredictorSet predictors(threads);
+    for (size_t i = 0; i < specs.size(); i++) {
+        if (!predictors.add(specs[i])) {
+            cerr << "Unknown predictor spec " << specs[i] << endl;
+            return 1;
+        }
+    }
+
+    timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    std::vector<Worker> workers(threads);
+    for (long t = 0; t < threads; t++) {
+        workers[t].bank = &predictors.bank(t);
+        workers[t].begin = data + sizeof(header);
+        workers[t].end = data + st.st_size;
+        workers[t].version = header.version;
+        pthread_create(&workers[t].thread, NULL, Replay, &workers[t]);
+    }
+    for (long t = 0; t < threads; t++)
+        pthread_join(workers[t].thread, NULL);
+    double seconds = Seconds(start);
+
+    if (workers[0].records != header.records)
+        cerr << "Warning: trace truncated after " << workers[0].records
+             << " of " << header.records << " branches" << endl;
+    cerr << "Replayed " << workers[0].records << " branches in "
+         << fltstr(seconds, 2) << " s with " << threads << " threads ("
+         << fltstr(workers[0].records / seconds / 1e6, 1) << " M/s)" << endl;
+
+    std::ofstream outFile(output.c_str());
+    if (STATS_WRITER::ParseFormat(format) != STATS_WRITER::FORMAT_TEXT) {
+        STATS_WRITER w(STATS_WRITER::ParseFormat(format));
+        predictors.exportStats(w, header.instructions);
+        w.Write(outFile);
+    } else {
+        predictors.printStats(outFile, header.instructions);
+    }
+
+    munmap((void *)data, st.st_size);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,40 @@
+#ifndef BRANCH_KIND_H
+#define BRANCH_KIND_H
+
+/**
+ * What a branch feeds, decided once per static instruction: the analysis
+ * routines, the predictor banks and the branch traces all use these flags.
+ **/
+enum {
+    BRANCH_CONDITIONAL = 1 << 0, // direction predictors
+    BRANCH_BTB = 1 << 1,         // all branches but returns
+    BRANCH_CALL = 1 << 2,        // RAS push
+    BRANCH_RET = 1 << 3,         // RAS pop
+    BRANCH_INDIRECT = 1 << 4     // indirect target predictors
+};
+
+#ifndef PIN_SHIM_H
+// Pin tools only: the kind of `ins`, 0 if it is not a branch
+static inline UINT32 BranchKind(INS ins) {
+    UINT32 kind = 0;
+
+    if (INS_Category(ins) == XED_CATEGORY_COND_BR)
+        kind |= BRANCH_CONDITIONAL;
+    else if (INS_IsCall(ins))
+        kind |= BRANCH_CALL;
+    else if (INS_IsRet(ins))
+        kind |= BRANCH_RET;
+
+    // For BTB we instrument all branches except returns
+    if (INS_IsBranch(ins) && !INS_IsRet(ins))
+        kind |= BRANCH_BTB;
+
+    // Indirect jumps and calls; returns are left to the RAS
+    if (INS_IsIndirectBranchOrCall(ins) && !INS_IsRet(ins))
+        kind |= BRANCH_INDIRECT;
+
+    return kind;
+}
+#endif
+
+#endif
@@ -6,6 +6,8 @@
 #include <cstring> // memset()
 #include <vector>
 
+#include "../../common/snapshot.h"
+
 /**
  * A generic BranchPredictor base class.
  * All predictors can be subclasses with overloaded predict() and update()
@@ -16,12 +18,28 @@ class BranchPredictor
 {
 public:
     BranchPredictor() : correct_predictions(0), incorrect_predictions(0) {};
-    ~BranchPredictor() {};
+    virtual ~BranchPredictor() {};
 
     virtual bool predict(ADDRINT ip, ADDRINT target) = 0;
     virtual void update(bool predicted, bool actual, ADDRINT ip, ADDRINT target) = 0;
     virtual string getName() = 0;
 
+    // Bits of state of the modeled hardware, 0 where not accounted
+    virtual UINT64 getStorageBits() { return 0; }
+
+    // Predicts the branch and trains on its outcome in one call. Predictors
+    // that can look their tables up once for both override it.
+    virtual bool predictAndUpdate(ADDRINT ip, ADDRINT target, bool actual) {
+        bool predicted = predict(ip, target);
+        update(predicted, actual, ip, target);
+        return predicted;
+    }
+
+    // Checkpointing of the predictor tables (not the stats).
+    // Stateless predictors keep the empty defaults.
+    virtual void saveState(SNAPSHOT_WRITER &s) {}
+    virtual void loadState(SNAPSHOT_READER &s) {}
+
     UINT64 getNumCorrectPredictions() { return correct_predictions; }
     UINT64 getNumIncorrectPredictions() { return incorrect_predictions; }
 
@@ -54,31 +72,35 @@ public:
     ~NbitPredictor() { delete TABLE; };
 
     virtual bool predict(ADDRINT ip, ADDRINT target) {
-        unsigned int ip_table_index = ip % table_entries;
-        unsigned long long ip_table_value = TABLE[ip_table_index];
+        unsigned long long ip_table_value = TABLE[tableIndex(ip)];
         unsigned long long prediction = ip_table_value >> (cntr_bits - 1);
         return (prediction != 0);
     };
 
     virtual void update(bool predicted, bool actual, ADDRINT ip, ADDRINT target) {
-        unsigned int ip_table_index = ip % table_entries;
-        if (actual) {
-            if (TABLE[ip_table_index] < COUNTER_MAX)
-                TABLE[ip_table_index]++;
-        } else {
-            if (TABLE[ip_table_index] > 0)
-                TABLE[ip_table_index]--;
-        }
-
+        train(tableIndex(ip), actual);
         updateCounters(predicted, actual);
     };
 
+    virtual bool predictAndUpdate(ADDRINT ip, ADDRINT target, bool actual) {
+        unsigned int ip_table_index = tableIndex(ip);
+        bool predicted = (TABLE[ip_table_index] >> (cntr_bits - 1)) != 0;
+        train(ip_table_index, actual);
+        updateCounters(predicted, actual);
+        return predicted;
+    }
+
     virtual string getName() {
         std::ostringstream stream;
         stream << "Nbit-" << pow(2.0,double(index_bits)) / 1024.0 << "K-" << cntr_bits;
         return stream.str();
     }
 
+    virtual UINT64 getStorageBits() { return UINT64(table_entries) * cntr_bits; }
+
+    virtual void saveState(SNAPSHOT_WRITER &s) { s.PutArray(TABLE, table_entries); }
+    virtual void loadState(SNAPSHOT_READER &s) { s.GetArray(TABLE, table_entries); }
+
 private:
     unsigned int index_bits, cntr_bits;
     unsigned int COUNTER_MAX;
@@ -86,114 +108,56 @@ private:
     /* Make this unsigned long long so as to support big numbers of cntr_bits. */
     unsigned long long *TABLE;
     unsigned int table_entries;
-};
 
-class BTBEntry {
-private:
-    ADDRINT addr;
-    ADDRINT target;
-public:
-    BTBEntry(ADDRINT addr, ADDRINT target) {
-        this->addr = addr;
-        this->target = target;
-    }
-    ADDRINT getAddr() {
-        return this->addr;
-    }
-    ADDRINT getTarget() {
-        return this->target;
+    /* table_entries is a power of 2, so masking is ip % table_entries */
+    unsigned int tableIndex(ADDRINT ip) { return ip & (table_entries - 1); }
+
+    void train(unsigned int ip_table_index, bool actual) {
+        if (actual) {
+            if (TABLE[ip_table_index] < COUNTER_MAX)
+                TABLE[ip_table_index]++;
+        } else {
+            if (TABLE[ip_table_index] > 0)
+                TABLE[ip_table_index]--;
+        }
     }
 };
 
-// Fill in the BTB implementation ...
-class BTBPredictor : public BranchPredictor
+/**
+ * Target predictor for indirect jumps and calls (not returns). Those with
+ * global history also see the outcome of every conditional branch.
+ **/
+class IndirectPredictor
 {
 public:
-	BTBPredictor(int btb_lines, int btb_assoc)
-	     : BranchPredictor(), table_lines(btb_lines), table_assoc(btb_assoc), correct_target(0)
-	{
-		entries = new std::vector<BTBEntry>[table_lines];
-	}
+    IndirectPredictor() : correct_predictions(0), incorrect_predictions(0) {};
+    virtual ~IndirectPredictor() {};
 
-	~BTBPredictor() {
-        delete [] entries;
-	}
+    // Predicts the target and trains on the actual one; true if correct
+    virtual bool predictAndUpdate(ADDRINT ip, ADDRINT target) = 0;
+    virtual void conditional(ADDRINT ip, bool taken) {}
+    virtual string getName() = 0;
 
-    virtual bool predict(ADDRINT ip, ADDRINT target) {
-		/* ... fill me ... */
-        BTBEntry entry(ip, target);
-        return (this->find(entry) != 0);
-	}
+    virtual UINT64 getStorageBits() { return 0; }
 
-    virtual void update(bool predicted, bool actual, ADDRINT ip, ADDRINT target) {
-		/* ... fill me ... */
-        if (actual && predicted) {              /* correct prediction */
-            BTBEntry entry(ip, target);
-            ADDRINT predTarget = this->find(entry);
-            if (predTarget == target) {
-                this->correct_target++;
-            }
-        } else if (predicted && !(actual)) {    /* delete from BTB */
-            this->erase(ip);
-        } else if (actual && !(predicted)) {    /* put in BTB */
-            BTBEntry entry(ip, target);
-            this->replace(entry);
-        }
-        updateCounters(predicted, actual);
-	}
+    virtual void saveState(SNAPSHOT_WRITER &s) {}
+    virtual void loadState(SNAPSHOT_READER &s) {}
 
-    virtual string getName() {
-        std::ostringstream stream;
-		stream << "BTB-" << table_lines << "-" << table_assoc;
-		return stream.str();
-	}
+    UINT64 getNumCorrectPredictions() { return correct_predictions; }
+    UINT64 getNumIncorrectPredictions() { return incorrect_predictions; }
 
-    UINT64 getNumCorrectTargetPredictions() {
-		return this->correct_target;
-	}
+protected:
+    bool updateCounters(bool correct) {
+        if (correct)
+            correct_predictions++;
+        else
+            incorrect_predictions++;
+        return correct;
+    };
 
 private:
-
-	unsigned int table_lines, table_assoc;
-    UINT64 correct_target;
-    std::vector<BTBEntry> *entries;
-
-    ADDRINT find(BTBEntry & e) {
-        int index = e.getAddr() % this->table_lines;
-        std::vector<BTBEntry>::iterator it;
-        for (it = entries[index].begin(); it != entries[index].end(); ++it) {
-            if (it->getAddr() == e.getAddr()) {
-                entries[index].erase(it);
-                entries[index].push_back(e);
-                return it->getTarget();
-            }
-        }
-        return 0;
-    }
-
-    void replace(BTBEntry & e) {
-        int index = e.getAddr() % this->table_lines;
-        std::vector<BTBEntry>::iterator it;
-        entries[index].push_back(e);
-        if (entries[index].size() > this->table_assoc) {
-            entries[index].erase(entries[index].begin());
-            return;
-        }
-        return;
-    }
-
-    void erase(ADDRINT addr) {
-        int index = addr % this->table_lines;
-        std::vector<BTBEntry>::iterator it;
-        for (it = entries[index].begin(); it != entries[index].end(); ++it) {
-            if (it->getAddr() == addr) {
-                entries[index].erase(it);
-                return;
-            }
-        }
-        return;
-    }
-
+    UINT64 correct_predictions;
+    UINT64 incorrect_predictions;
 };
 
 class StaticTaken : public BranchPredictor {
@@ -289,32 +253,44 @@ public:
     virtual bool predict(ADDRINT ip, ADDRINT target) {
         unsigned int PHTinx, BHTinx;
 
-        PHTinx = (ip % this->PHTmod) << this->BHTcntr;
-        BHTinx = ip % this->BHTmod;
-
-        /**
-         * 1 << BHTcntr = max number ( + 1) for a BHTentry.
-         * So with mod we restrict the non zero bits we get
-         * from the BHT, which are at most BHTcntr.
-         */
-        PHTinx = PHTinx | (BHT[BHTinx] % (1 << this->BHTcntr));
-
+        indices(ip, PHTinx, BHTinx);
         return ((PHT[PHTinx] >> (this->PHTcntr - 1)) != 0);
     }
 
     virtual void update(bool predicted, bool actual, ADDRINT ip, ADDRINT target) {
         unsigned int PHTinx, BHTinx;
 
-        PHTinx = (ip % this->PHTmod) << this->BHTcntr;
-        BHTinx = ip % this->BHTmod;
+        indices(ip, PHTinx, BHTinx);
+        train(PHTinx, BHTinx, actual);
+        updateCounters(predicted, actual);
+    }
+
+    virtual bool predictAndUpdate(ADDRINT ip, ADDRINT target, bool actual) {
+        unsigned int PHTinx, BHTinx;
+
+        indices(ip, PHTinx, BHTinx);
+        bool predicted = (PHT[PHTinx] >> (this->PHTcntr - 1)) != 0;
+        train(PHTinx, BHTinx, actual);
+        updateCounters(predicted, actual);
+        return predicted;
+    }
+
+private:
+
+    /* PHTmod, BHTmod and 1 << BHTcntr are powers of 2: masks replace mods */
+    void indices(ADDRINT ip, unsigned int &PHTinx, unsigned int &BHTinx) {
+        PHTinx = (ip & (this->PHTmod - 1)) << this->BHTcntr;
+        BHTinx = ip & (this->BHTmod - 1);
 
         /**
          * 1 << BHTcntr = max number ( + 1) for a BHTentry.
          * So with mod we restrict the non zero bits we get
          * from the BHT, which are at most BHTcntr.
          */
-        PHTinx = PHTinx | (BHT[BHTinx] % (1 << this->BHTcntr));
+        PHTinx = PHTinx | (BHT[BHTinx] & ((1 << this->BHTcntr) - 1));
+    }
 
+    void train(unsigned int PHTinx, unsigned int BHTinx, bool actual) {
         /* Shift out oldest outcome */
         BHT[BHTinx] = BHT[BHTinx] << 1;
 
@@ -334,10 +310,10 @@ public:
             if (PHT[PHTinx] > 0)
                 PHT[PHTinx]--;
         }
-
-        updateCounters(predicted, actual);
     }
 
+public:
+
     virtual string getName() {
         std::ostringstream stream;
         stream << "LocalHistoryTwoLevel-"
@@ -346,6 +322,20 @@ public:
         return stream.str();
     }
 
+    virtual UINT64 getStorageBits() {
+        return UINT64(PHTentries) * PHTcntr + UINT64(BHTentries) * BHTcntr;
+    }
+
+    virtual void saveState(SNAPSHOT_WRITER &s) {
+        s.PutArray(PHT, PHTentries);
+        s.PutArray(BHT, BHTentries);
+    }
+
+    virtual void loadState(SNAPSHOT_READER &s) {
+        s.GetArray(PHT, PHTentries);
+        s.GetArray(BHT, BHTentries);
+    }
+
 };
 
 class GlobalHistoryTwoLevel : public BranchPredictor {
@@ -391,32 +381,39 @@ public:
     }
 
     virtual bool predict(ADDRINT ip, ADDRINT target) {
-        unsigned int PHTinx;
-
-        PHTinx = (ip % this->PHTmod) << this->BHRcntr;
+        return ((PHT[index(ip)] >> (this->PHTcntr - 1)) != 0);
+    }
 
-        /**
-         * 1 << BHRcntr = max number ( + 1) for a BHRentry.
-         * So with mod we restrict the non zero bits we get
-         * from the BHR, which are at most BHTcntr.
-         */
-        PHTinx = PHTinx | (BHR % (1 << this->BHRcntr));
+    virtual void update(bool predicted, bool actual, ADDRINT ip, ADDRINT target) {
+        train(index(ip), actual);
+        updateCounters(predicted, actual);
+    }
 
-        return ((PHT[PHTinx] >> (this->PHTcntr - 1)) != 0);
+    virtual bool predictAndUpdate(ADDRINT ip, ADDRINT target, bool actual) {
+        unsigned int PHTinx = index(ip);
+        bool predicted = (PHT[PHTinx] >> (this->PHTcntr - 1)) != 0;
+        train(PHTinx, actual);
+        updateCounters(predicted, actual);
+        return predicted;
     }
 
-    virtual void update(bool predicted, bool actual, ADDRINT ip, ADDRINT target) {
+private:
+
+    /* PHTmod and 1 << BHRcntr are powers of 2: masks replace mods */
+    unsigned int index(ADDRINT ip) {
         unsigned int PHTinx;
 
-        PHTinx = (ip % this->PHTmod) << this->BHRcntr;
+        PHTinx = (ip & (this->PHTmod - 1)) << this->BHRcntr;
 
         /**
          * 1 << BHRcntr = max number ( + 1) for BHR value.
          * So with mod we restrict the non zero bits we get
          * from the BHR, which are at most BHRcntr.
          */
-        PHTinx = PHTinx | (BHR % (1 << this->BHRcntr));
+        return PHTinx | (BHR & ((1 << this->BHRcntr) - 1));
+    }
 
+    void train(unsigned int PHTinx, bool actual) {
         /* Shift out oldest outcome */
         BHR = BHR << 1;
 
@@ -436,10 +433,10 @@ public:
             if (PHT[PHTinx] > 0)
                 PHT[PHTinx]--;
         }
-
-        updateCounters(predicted, actual);
     }
 
+public:
+
     virtual string getName() {
         std::ostringstream stream;
         stream << "GlobalHistoryTwoLevel-"
@@ -448,6 +445,18 @@ public:
         return stream.str();
     }
 
+    virtual UINT64 getStorageBits() { return UINT64(PHTentries) * PHTcntr + BHRcntr; }
+
+    virtual void saveState(SNAPSHOT_WRITER &s) {
+        s.PutArray(PHT, PHTentries);
+        s.Put(BHR);
+    }
+
+    virtual void loadState(SNAPSHOT_READER &s) {
+        s.GetArray(PHT, PHTentries);
+        s.Get(BHR);
+    }
+
 };
 
 class TournamentLocalNbit : public BranchPredictor {
@@ -498,35 +507,70 @@ public:
     virtual bool predict(ADDRINT ip, ADDRINT target) {
         nbitPred = nbit->predict(ip, target);
         localPred = local->predict(ip, target);
-        unsigned int index = ip % this->entries;
-        if ((table[index] >> (this->cntr - 1)) > 0) {
-            return localPred;
-        } else {
-            return nbitPred;
-        }
-        return false;
+        return choose(ip & (this->entries - 1));
     }
 
     virtual void update(bool predicted, bool actual, ADDRINT ip, ADDRINT target) {
         nbit->update(nbitPred, actual, ip, target);
         local->update(localPred, actual, ip, target);
-        /* For meta */
-        unsigned int index = ip % this->entries;
+        train(ip & (this->entries - 1), actual);
+        updateCounters(predicted, actual);
+    }
+
+    /* The components are trained right after predicting, statically bound */
+    virtual bool predictAndUpdate(ADDRINT ip, ADDRINT target, bool actual) {
+        unsigned int index = ip & (this->entries - 1);
+        nbitPred = nbit->NbitPredictor::predictAndUpdate(ip, target, actual);
+        localPred = local->LocalHistoryTwoLevel::predictAndUpdate(ip, target, actual);
+        bool predicted = choose(index);
+        train(index, actual);
+        updateCounters(predicted, actual);
+        return predicted;
+    }
+
+private:
+
+    bool choose(unsigned int index) {
+        if ((table[index] >> (this->cntr - 1)) > 0)
+            return localPred;
+        return nbitPred;
+    }
+
+    /* For meta */
+    void train(unsigned int index, bool actual) {
         if (nbitPred != localPred) {
             if (nbitPred == actual && table[index] > 0)
                 table[index]--;
             else if (localPred == actual && table[index] < COUNTER_MAX)
                 table[index]++;
         }
-        updateCounters(predicted, actual);
     }
 
+public:
+
     virtual string getName() {
         std::ostringstream stream;
         stream << "Tournament-" << nbit->getName() << "-" << local->getName();
         return stream.str();
     }
 
+    virtual UINT64 getStorageBits() {
+        return UINT64(entries) * cntr + nbit->getStorageBits() +
+               local->getStorageBits();
+    }
+
+    virtual void saveState(SNAPSHOT_WRITER &s) {
+        s.PutArray(table, entries);
+        nbit->saveState(s);
+        local->saveState(s);
+    }
+
+    virtual void loadState(SNAPSHOT_READER &s) {
+        s.GetArray(table, entries);
+        nbit->loadState(s);
+        local->loadState(s);
+    }
+
 };
 
 class TournamentGlobalNbit : public BranchPredictor {
@@ -576,35 +620,70 @@ public:
     virtual bool predict(ADDRINT ip, ADDRINT target) {
         nbitPred = nbit->predict(ip, target);
         globalPred = global->predict(ip, target);
-        unsigned int index = ip % this->entries;
-        if ((table[index] >> (this->cntr - 1)) > 0) {
-            return globalPred;
-        } else {
-            return nbitPred;
-        }
-        return false;
+        return choose(ip & (this->entries - 1));
     }
 
     virtual void update(bool predicted, bool actual, ADDRINT ip, ADDRINT target) {
         nbit->update(nbitPred, actual, ip, target);
         global->update(globalPred, actual, ip, target);
-        /* For meta */
-        unsigned int index = ip % this->entries;
+        train(ip & (this->entries - 1), actual);
+        updateCounters(predicted, actual);
+    }
+
+    /* The components are trained right after predicting, statically bound */
+    virtual bool predictAndUpdate(ADDRINT ip, ADDRINT target, bool actual) {
+        unsigned int index = ip & (this->entries - 1);
+        nbitPred = nbit->NbitPredictor::predictAndUpdate(ip, target, actual);
+        globalPred = global->GlobalHistoryTwoLevel::predictAndUpdate(ip, target, actual);
+        bool predicted = choose(index);
+        train(index, actual);
+        updateCounters(predicted, actual);
+        return predicted;
+    }
+
+private:
+
+    bool choose(unsigned int index) {
+        if ((table[index] >> (this->cntr - 1)) > 0)
+            return globalPred;
+        return nbitPred;
+    }
+
+    /* For meta */
+    void train(unsigned int index, bool actual) {
         if (nbitPred != globalPred) {
             if (nbitPred == actual && table[index] > 0)
                 table[index]--;
             else if (globalPred == actual && table[index] < COUNTER_MAX)
                 table[index]++;
         }
-        updateCounters(predicted, actual);
     }
 
+public:
+
     virtual string getName() {
         std::ostringstream stream;
         stream << "Tournament-" << nbit->getName() << "-" << global->getName();
         return stream.str();
     }
 
+    virtual UINT64 getStorageBits() {
+        return UINT64(entries) * cntr + nbit->getStorageBits() +
+               global->getStorageBits();
+    }
+
+    virtual void saveState(SNAPSHOT_WRITER &s) {
+        s.PutArray(table, entries);
+        nbit->saveState(s);
+        global->saveState(s);
+    }
+
+    virtual void loadState(SNAPSHOT_READER &s) {
+        s.GetArray(table, entries);
+        nbit->loadState(s);
+        global->loadState(s);
+    }
+
 };
 
 #endif
@@ -0,0 +1,118 @@
+#ifndef BRANCH_RING_H
+#define BRANCH_RING_H
+
+#ifdef PIN_SHIM_H
+#include <sched.h> // sched_yield()
+#endif
+
+#include "branch_trace.h"
+
+/**
+ * Single-producer ring of branch records, where every consumer sees every
+ * record: the application thread appends the branches and each worker
+ * thread feeds all of them to its own shard of predictors. Several
+ * application threads must serialize push(), flush() and drain(): racing
+ * producers would move `published` backwards, past the consumers.
+ *
+ * The producer publishes its position every PUBLISH_BATCH records (and on
+ * flush()), so that consumers polling it do not steal its cache line on
+ * each branch. It only waits when the slowest consumer is a whole ring
+ * behind.
+ **/
+class BranchRing {
+  public:
+    BranchRing(unsigned numConsumers, unsigned capacityBits = 16)
+        : capacity(size_t(1) << capacityBits), mask(capacity - 1), head(0),
+          published(0), slowest(0), consumers(numConsumers) {
+        slots = new BranchRecord[capacity];
+        tails = new Cursor[consumers];
+        for (unsigned i = 0; i < consumers; i++)
+            tails[i].value = 0;
+    }
+
+    ~BranchRing() {
+        delete[] slots;
+        delete[] tails;
+    }
+
+    // Producer side
+
+    void push(const BranchRecord &r) {
+        if (head - slowest == capacity)
+            waitForRoom();
+        slots[head & mask] = r;
+        head++;
+        if ((head & (PUBLISH_BATCH - 1)) == 0)
+            __atomic_store_n(&published, head, __ATOMIC_RELEASE);
+    }
+
+    void flush() { __atomic_store_n(&published, head, __ATOMIC_RELEASE); }
+
+    // Returns once every consumer has processed every record pushed so far
+    void drain() {
+        flush();
+        for (unsigned i = 0; i < consumers; i++)
+            while (__atomic_load_n(&tails[i].value, __ATOMIC_ACQUIRE) != head)
+                yield();
+    }
+
+    // Consumer side
+
+    // Hands the records not yet seen by `consumer` to `f(record)`; returns
+    // how many there were
+    template <class F> size_t consume(unsigned consumer, F &f) {
+        size_t tail = tails[consumer].value;
+        size_t end = __atomic_load_n(&published, __ATOMIC_ACQUIRE);
+
+        for (size_t i = tail; i != end; i++)
+            f(slots[i & mask]);
+        if (end != tail)
+            __atomic_store_n(&tails[consumer].value, end, __ATOMIC_RELEASE);
+        return end - tail;
+    }
+
+    static void yield() {
+#ifdef PIN_SHIM_H
+        sched_yield();
+#else
+        PIN_Yield();
+#endif
+    }
+
+  private:
+    static const size_t PUBLISH_BATCH = 64;
+
+    // One cache line per consumer position
+    struct Cursor {
+        size_t value;
+        char pad[64 - sizeof(size_t)];
+    };
+
+    BranchRecord *slots;
+    const size_t capacity, mask;
+
+    size_t head;      // producer only
+    size_t published; // read by the consumers
+    size_t slowest;   // producer's view of the slowest consumer
+
+    Cursor *tails;
+    unsigned consumers;
+
+    void waitForRoom() {
+        flush();
+        for (;;) {
+            size_t min = head;
+            for (unsigned i = 0; i < consumers; i++) {
+                size_t t = __atomic_load_n(&tails[i].value, __ATOMIC_ACQUIRE);
+                if (head - t > head - min)
+                    min = t;
+            }
+            slowest = min;
+            if (head - slowest < capacity)
+                return;
+            yield();
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,185 @@
+#ifndef BRANCH_TRACE_H
+#define BRANCH_TRACE_H
+
+#include <cstdio>
+#include <cstring> // memcmp()
+#include <string>
+
+#include "branch_kind.h"
+
+/**
+ * Branch traces, written by cslab_branch_trace and replayed by bp_replay.
+ *
+ * A trace is a BranchTraceHeader followed by one variable-length record per
+ * executed branch:
+ *   1 byte   kind (BRANCH_* flags, bits 0-4) and taken (bit 7)
+ *   varint   ip - ip of the previous record, zigzag encoded
+ *   varint   target - ip, zigzag encoded
+ *   varint   instructions since the previous record, this branch included
+ *   varint   instruction size, calls only (the RAS pushes ip + size)
+ * Varints are little-endian base 128. Most branches are short jumps close to
+ * the previous one, so a record usually takes 4 to 6 bytes.
+ *
+ * Version 1 traces, without BRANCH_INDIRECT, kept taken in bit 4; they are
+ * still read.
+ **/
+struct BranchTraceHeader {
+    char magic[8];
+    UINT32 version;
+    UINT32 reserved;
+    UINT64 records;
+    UINT64 instructions; // all of them, also those after the last branch
+
+    static const UINT32 VERSION = 2;
+
+    void init() {
+        memcpy(magic, "CSLABBT", 8);
+        version = VERSION;
+        reserved = 0;
+        records = instructions = 0;
+    }
+
+    bool valid() const {
+        return memcmp(magic, "CSLABBT", 8) == 0 &&
+               (version == 1 || version == VERSION);
+    }
+};
+
+struct BranchRecord {
+    ADDRINT ip, target;
+    UINT64 instructions;
+    UINT32 kind, ins_size;
+    bool taken;
+};
+
+class BranchTraceEncoder {
+  public:
+    static const size_t MAX_RECORD_BYTES = 1 + 4 * 10;
+
+    BranchTraceEncoder() : last_ip(0) {}
+
+    // Writes `r` at `out`, returns the end of the record
+    UINT8 *encode(const BranchRecord &r, UINT8 *out) {
+        *out++ = UINT8(r.kind | (r.taken << 7));
+        out = putVarint(out, zigzag(INT64(r.ip - last_ip)));
+        out = putVarint(out, zigzag(INT64(r.target - r.ip)));
+        out = putVarint(out, r.instructions);
+        if (r.kind & BRANCH_CALL)
+            out = putVarint(out, r.ins_size);
+        last_ip = r.ip;
+        return out;
+    }
+
+  private:
+    ADDRINT last_ip;
+
+    static UINT64 zigzag(INT64 v) { return (UINT64(v) << 1) ^ UINT64(v >> 63); }
+
+    static UINT8 *putVarint(UINT8 *out, UINT64 v) {
+        while (v >= 0x80) {
+            *out++ = UINT8(v | 0x80);
+            v >>= 7;
+        }
+        *out++ = UINT8(v);
+        return out;
+    }
+};
+
+class BranchTraceDecoder {
+  public:
+    BranchTraceDecoder(const UINT8 *begin, const UINT8 *end,
+                       UINT32 version = BranchTraceHeader::VERSION)
+        : cur(begin), end(end), last_ip(0), takenShift(version == 1 ? 4 : 7) {}
+
+    // False at the end of the trace, or on a truncated record
+    bool next(BranchRecord &r) {
+        UINT64 ip, target, size = 0;
+
+        if (cur >= end)
+            return false;
+        r.kind = *cur & ((1 << takenShift) - 1);
+        r.taken = (*cur >> takenShift) & 1;
+        cur++;
+        if (!getVarint(ip) || !getVarint(target) ||
+            !getVarint(r.instructions) ||
+            ((r.kind & BRANCH_CALL) && !getVarint(size)))
+            return false;
+        r.ip = last_ip + ADDRINT(unzigzag(ip));
+        r.target = r.ip + ADDRINT(unzigzag(target));
+        r.ins_size = UINT32(size);
+        last_ip = r.ip;
+        return true;
+    }
+
+  private:
+    const UINT8 *cur, *end;
+    ADDRINT last_ip;
+    unsigned takenShift;
+
+    static INT64 unzigzag(UINT64 v) { return INT64(v >> 1) ^ -INT64(v & 1); }
+
+    bool getVarint(UINT64 &v) {
+        v = 0;
+        for (unsigned shift = 0; cur < end && shift < 64; shift += 7) {
+            UINT8 byte = *cur++;
+            v |= UINT64(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return true;
+        }
+        return false;
+    }
+};
+
+/**
+ * Buffers the encoded records and writes them out in large chunks. The
+ * header is rewritten with the final counts on close().
+ **/
+class BranchTraceWriter {
+  public:
+    BranchTraceWriter() : file(NULL), buffer(NULL), fill(0) { header.init(); }
+    ~BranchTraceWriter() { delete[] buffer; }
+
+    bool open(const std::string &path) {
+        file = fopen(path.c_str(), "wb");
+        if (file == NULL)
+            return false;
+        buffer = new UINT8[BUFFER_BYTES];
+        return fwrite(&header, sizeof(header), 1, file) == 1;
+    }
+
+    void write(const BranchRecord &r) {
+        if (fill > BUFFER_BYTES - BranchTraceEncoder::MAX_RECORD_BYTES)
+            flush();
+        fill = encoder.encode(r, buffer + fill) - buffer;
+        header.records++;
+    }
+
+    void close(UINT64 instructions) {
+        if (file == NULL)
+            return;
+        flush();
+        header.instructions = instructions;
+        fseek(file, 0, SEEK_SET);
+        fwrite(&header, sizeof(header), 1, file);
+        fclose(file);
+        file = NULL;
+    }
+
+    UINT64 records() const { return header.records; }
+
+  private:
+    static const size_t BUFFER_BYTES = 1 << 20;
+
+    FILE *file;
+    UINT8 *buffer;
+    size_t fill;
+    BranchTraceHeader header;
+    BranchTraceEncoder encoder;
+
+    void flush() {
+        fwrite(buffer, 1, fill, file);
+        fill = 0;
+    }
+};
+
+#endif
@@ -0,0 +1,262 @@
+#ifndef BTB_H
+#define BTB_H
+
+#include <sstream>
+#include <vector>
+
+#include "branch_kind.h"
+#include "branch_predictor.h"
+
+/**
+ * One set-associative level of a BTB, with tree-PLRU replacement. Sets and
+ * ways must be powers of 2 (at most 64 ways). Each entry is packed in 64
+ * bits:
+ *   bit 63      valid
+ *   bits 61-62  branch type (BTB_TYPE_*)
+ *   bits 48-60  partial tag (13 bits of the address above the index)
+ *   bits 0-47   target - ip, signed
+ * A partial tag may match another branch, which then gets its target.
+ **/
+class BTBLevel {
+  public:
+    enum {
+        BTB_TYPE_CONDITIONAL,
+        BTB_TYPE_JUMP,
+        BTB_TYPE_CALL,
+        BTB_TYPE_INDIRECT
+    };
+
+    BTBLevel(unsigned sets_, unsigned ways_, unsigned latency_)
+        : sets(sets_), ways(ways_), latency(latency_),
+          entries(size_t(sets_) * ways_, 0), plru(sets_, 0) {
+        logSets = 0;
+        while ((1U << logSets) < sets)
+            logSets++;
+        logWays = 0;
+        while ((1U << logWays) < ways)
+            logWays++;
+    }
+
+    bool holds(ADDRINT ip) const {
+        const UINT64 *set = &entries[size_t(ip & (sets - 1)) << logWays];
+        UINT64 key = VALID | (UINT64(tag(ip)) << TAG_SHIFT);
+        for (unsigned w = 0; w < ways; w++)
+            if ((set[w] & KEY_MASK) == key)
+                return true;
+        return false;
+    }
+
+    // True if `ip` hits, its target then in `predicted`. Then trains: a
+    // taken branch is inserted or gets its target fixed, a not taken one
+    // is evicted.
+    bool access(ADDRINT ip, ADDRINT target, bool taken, unsigned type,
+                ADDRINT &predicted) {
+        UINT32 s = ip & (sets - 1);
+        UINT64 *set = &entries[size_t(s) << logWays];
+        UINT64 key = VALID | (UINT64(tag(ip)) << TAG_SHIFT);
+        UINT64 entry = key | (UINT64(type) << TYPE_SHIFT) |
+                       (UINT64(target - ip) & OFFSET_MASK);
+
+        for (unsigned w = 0; w < ways; w++) {
+            if ((set[w] & KEY_MASK) != key)
+                continue;
+            predicted = ip + ADDRINT(INT64(set[w] << 16) >> 16);
+            if (!taken) {
+                set[w] = 0;
+            } else {
+                set[w] = entry;
+                touch(s, w);
+            }
+            return true;
+        }
+
+        if (taken) {
+            unsigned w = victim(s);
+            set[w] = entry;
+            touch(s, w);
+        }
+        return false;
+    }
+
+    unsigned getSets() { return sets; }
+    unsigned getWays() { return ways; }
+    unsigned getLatency() { return latency; }
+
+    UINT64 getStorageBits() {
+        return UINT64(entries.size()) * 64 + UINT64(sets) * (ways - 1);
+    }
+
+    void saveState(SNAPSHOT_WRITER &s) {
+        s.PutVector(entries);
+        s.PutVector(plru);
+    }
+
+    void loadState(SNAPSHOT_READER &s) {
+        s.GetVector(entries);
+        s.GetVector(plru);
+    }
+
+  private:
+    static const UINT64 VALID = UINT64(1) << 63;
+    static const unsigned TYPE_SHIFT = 61, TAG_SHIFT = 48, TAG_BITS = 13;
+    static const UINT64 OFFSET_MASK = (UINT64(1) << 48) - 1;
+    static const UINT64 KEY_MASK = VALID | (((UINT64(1) << TAG_BITS) - 1) << 48);
+
+    unsigned sets, ways, latency;
+    unsigned logSets, logWays;
+    std::vector<UINT64> entries;
+    std::vector<UINT64> plru; /* ways - 1 tree bits per set, node n at bit n-1 */
+
+    UINT32 tag(ADDRINT ip) const {
+        return ((ip >> logSets) ^ (ip >> (logSets + TAG_BITS))) &
+               ((1U << TAG_BITS) - 1);
+    }
+
+    /* An invalid way if there is one, else the PLRU one */
+    unsigned victim(UINT32 s) const {
+        const UINT64 *set = &entries[size_t(s) << logWays];
+        for (unsigned w = 0; w < ways; w++)
+            if (!(set[w] & VALID))
+                return w;
+
+        unsigned node = 1;
+        for (unsigned l = 0; l < logWays; l++)
+            node = 2 * node + ((plru[s] >> (node - 1)) & 1);
+        return node - ways;
+    }
+
+    /* Each node on the way's path points to the other half */
+    void touch(UINT32 s, unsigned way) {
+        unsigned node = 1;
+        for (unsigned l = logWays; l-- > 0;) {
+            unsigned bit = (way >> l) & 1;
+            if (bit)
+                plru[s] &= ~(UINT64(1) << (node - 1));
+            else
+                plru[s] |= UINT64(1) << (node - 1);
+            node = 2 * node + bit;
+        }
+    }
+};
+
+/**
+ * Branch target buffer of one to three levels (L0, L1, L2), each with its
+ * own geometry and latency, in cycles, to deliver a target. A branch is
+ * predicted taken when any level holds it, and the nearest such level
+ * provides the target; the latencies of the providing levels add up to
+ * the front-end bubbles. Every level is trained on every branch: taken
+ * branches are inserted or get their target fixed, not taken ones are
+ * evicted.
+ **/
+class BTBPredictor : public BranchPredictor
+{
+public:
+    BTBPredictor(unsigned lines, unsigned assoc, unsigned latency = 0)
+        : BranchPredictor(), correct_target(0), bubbles(0) {
+        addLevel(lines, assoc, latency);
+    }
+
+    ~BTBPredictor() {
+        for (size_t i = 0; i < levels.size(); i++)
+            delete levels[i];
+    }
+
+    // Adds a level behind the existing ones
+    void addLevel(unsigned lines, unsigned assoc, unsigned latency) {
+        levels.push_back(new BTBLevel(lines, assoc, latency));
+        level_hits.push_back(0);
+    }
+
+    virtual bool predict(ADDRINT ip, ADDRINT target) {
+        for (size_t i = 0; i < levels.size(); i++)
+            if (levels[i]->holds(ip))
+                return true;
+        return false;
+    }
+
+    // Looks the branch up again: the hits drive the replacement
+    virtual void update(bool predicted, bool actual, ADDRINT ip, ADDRINT target) {
+        predictAndUpdate(ip, target, actual, 0);
+    }
+
+    virtual bool predictAndUpdate(ADDRINT ip, ADDRINT target, bool actual) {
+        return BTBPredictor::predictAndUpdate(ip, target, actual, 0);
+    }
+
+    // `kind` (BRANCH_* flags) is recorded as the branch type of the entry
+    bool predictAndUpdate(ADDRINT ip, ADDRINT target, bool actual,
+                          UINT32 kind) {
+        int provider = -1;
+        ADDRINT predicted_target = 0, level_target = 0;
+
+        for (size_t i = 0; i < levels.size(); i++)
+            if (levels[i]->access(ip, target, actual, type(kind),
+                                  level_target) &&
+                provider < 0) {
+                provider = i;
+                predicted_target = level_target;
+            }
+
+        bool predicted = provider >= 0;
+        if (predicted) {
+            level_hits[provider]++;
+            bubbles += levels[provider]->getLatency();
+            if (actual && predicted_target == target)
+                correct_target++;
+        }
+        updateCounters(predicted, actual);
+        return predicted;
+    }
+
+    virtual string getName() {
+        std::ostringstream stream;
+        stream << "BTB";
+        for (size_t i = 0; i < levels.size(); i++) {
+            stream << "-" << levels[i]->getSets() << "-"
+                   << levels[i]->getWays();
+            if (levels.size() > 1)
+                stream << "-" << levels[i]->getLatency();
+        }
+        return stream.str();
+    }
+
+    virtual UINT64 getStorageBits() {
+        UINT64 bits = 0;
+        for (size_t i = 0; i < levels.size(); i++)
+            bits += levels[i]->getStorageBits();
+        return bits;
+    }
+
+    UINT64 getNumCorrectTargetPredictions() { return correct_target; }
+
+    unsigned getNumLevels() { return levels.size(); }
+    UINT64 getLevelHits(unsigned level) { return level_hits[level]; }
+    UINT64 getBubbles() { return bubbles; }
+
+    virtual void saveState(SNAPSHOT_WRITER &s) {
+        for (size_t i = 0; i < levels.size(); i++)
+            levels[i]->saveState(s);
+    }
+
+    virtual void loadState(SNAPSHOT_READER &s) {
+        for (size_t i = 0; i < levels.size(); i++)
+            levels[i]->loadState(s);
+    }
+
+private:
+    std::vector<BTBLevel *> levels;
+    std::vector<UINT64> level_hits;
+    UINT64 correct_target, bubbles;
+
+    static unsigned type(UINT32 kind) {
+        if (kind & BRANCH_CONDITIONAL)
+            return BTBLevel::BTB_TYPE_CONDITIONAL;
+        if (kind & BRANCH_INDIRECT)
+            return BTBLevel::BTB_TYPE_INDIRECT;
+        if (kind & BRANCH_CALL)
+            return BTBLevel::BTB_TYPE_CALL;
+        return BTBLevel::BTB_TYPE_JUMP;
+    }
+};
+
+#endif
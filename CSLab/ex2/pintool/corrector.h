@@ -0,0 +1,360 @@
+#ifndef CORRECTOR_H
+#define CORRECTOR_H
+
+#include <sstream>
+#include <vector>
+
+#include "branch_predictor.h"
+#include "history.h"
+
+/**
+ * Loop predictor: 4-way tagged entries that learn the trip count of loops
+ * with a constant number of iterations, and predict the exit once the same
+ * count has been seen three times in a row. Entries are allocated when the
+ * prediction they would override mispredicts, and replaced once their age
+ * (bumped when they correct that prediction) has decayed to 0.
+ *
+ * An entry is a 10-bit tag, 10-bit trip and iteration counts, 2 bits of
+ * confidence, 3 of age and the direction inside the loop.
+ **/
+class LoopPredictor {
+  public:
+    LoopPredictor(unsigned logEntries)
+        : logSets(logEntries - 2), entries(size_t(1) << logEntries) {
+        for (size_t i = 0; i < entries.size(); i++)
+            free(entries[i]);
+    }
+
+    // Sets hit() and, when confident, valid() and prediction()
+    void lookup(ADDRINT ip) {
+        set = UINT32(ip & ((1U << logSets) - 1)) * WAYS;
+        tag = UINT16((ip >> logSets) & TAG_MASK);
+        way = -1;
+        for (unsigned w = 0; w < WAYS; w++)
+            if (entries[set + w].age && entries[set + w].tag == tag) {
+                way = w;
+                break;
+            }
+        if (way < 0)
+            return;
+        Entry &e = entries[set + way];
+        predicted = e.current + 1 == e.past ? !e.dir : e.dir;
+    }
+
+    bool valid() const {
+        return way >= 0 && entries[set + way].confidence == CONFIDENT;
+    }
+    bool prediction() const { return predicted; }
+
+    // `other` is the prediction the loop predictor would override
+    void train(bool taken, bool other) {
+        if (way < 0) {
+            if (other != taken)
+                allocate(taken);
+            return;
+        }
+
+        Entry &e = entries[set + way];
+        if (valid()) {
+            if (predicted != taken) {
+                free(e);
+                return;
+            }
+            if (predicted != other && e.age < MAX_AGE)
+                e.age++;
+        }
+
+        if (++e.current > MAX_COUNT) {
+            free(e);
+            return;
+        }
+        if (taken != e.dir) {
+            if (e.current == e.past) {
+                if (e.confidence < CONFIDENT)
+                    e.confidence++;
+            } else if (e.past == 0) {
+                e.past = e.current;
+            } else {
+                free(e);
+                return;
+            }
+            e.current = 0;
+        }
+    }
+
+    UINT64 storageBits() const { return UINT64(entries.size()) * 36; }
+
+    void saveState(SNAPSHOT_WRITER &s) { s.PutVector(entries); }
+    void loadState(SNAPSHOT_READER &s) { s.GetVector(entries); }
+
+  private:
+    static const unsigned WAYS = 4, TAG_MASK = 0x3FF, MAX_COUNT = 0x3FF;
+    static const unsigned CONFIDENT = 3, MAX_AGE = 7;
+
+    struct Entry {
+        UINT16 tag, past, current;
+        UINT8 confidence, age, dir;
+    };
+
+    unsigned logSets;
+    std::vector<Entry> entries;
+
+    /* Lookup results, kept for the update */
+    UINT32 set;
+    UINT16 tag;
+    int way;
+    bool predicted;
+
+    static void free(Entry &e) {
+        e.tag = e.past = e.current = 0;
+        e.confidence = e.age = e.dir = 0;
+    }
+
+    void allocate(bool taken) {
+        for (unsigned w = 0; w < WAYS; w++) {
+            Entry &e = entries[set + w];
+            if (e.age == 0) {
+                /* The misprediction is taken to be a loop exit */
+                free(e);
+                e.tag = tag;
+                e.age = MAX_AGE;
+                e.dir = !taken;
+                return;
+            }
+        }
+        for (unsigned w = 0; w < WAYS; w++)
+            entries[set + w].age--;
+    }
+};
+
+/**
+ * Statistical corrector, GEHL style: 6-bit counters in tables indexed by the
+ * address hashed with global histories of 0 to 32 outcomes and with 6 and
+ * 11 outcomes of the branch's own history, plus a bias table indexed by the
+ * address and the prediction being corrected. The sum of the centered
+ * counters reverts that prediction when it disagrees with it by at least an
+ * adaptive threshold.
+ **/
+class StatisticalCorrector {
+  public:
+    StatisticalCorrector(unsigned logEntries_)
+        : logEntries(logEntries_), mask((1U << logEntries_) - 1),
+          counters(size_t(NUM_TABLES) << logEntries_, 0), rows(NUM_TABLES),
+          history(32), localHistories(LOCAL_ENTRIES, 0) {
+        threshold = 5 * NUM_TABLES;
+        thresholdCounter = 0;
+    }
+
+    void lookup(ADDRINT ip, bool other) {
+        static const unsigned globalLengths[NUM_GLOBAL] = {0, 6, 12, 20, 32};
+        static const unsigned localLengths[NUM_LOCAL] = {6, 11};
+        UINT32 local = localHistories[ip & (LOCAL_ENTRIES - 1)];
+        unsigned t = 0;
+
+        rows[t++] = row(0, (ip << 1) | other);
+        for (unsigned i = 0; i < NUM_GLOBAL; i++, t++)
+            rows[t] = row(t, ip ^ fold(history.recent(globalLengths[i])) ^
+                                 (globalLengths[i] << (logEntries / 2)));
+        for (unsigned i = 0; i < NUM_LOCAL; i++, t++)
+            rows[t] = row(t, ip ^ fold(local & ((1U << localLengths[i]) - 1)) ^
+                                 (localLengths[i] << (logEntries / 2)));
+
+        sum = 0;
+        for (t = 0; t < NUM_TABLES; t++)
+            sum += 2 * counters[rows[t]] + 1;
+    }
+
+    // The corrected prediction
+    bool correct(bool other) const {
+        bool sumPred = sum >= 0;
+        return sumPred != other && magnitude() >= threshold ? sumPred : other;
+    }
+
+    void train(ADDRINT ip, bool taken) {
+        bool sumPred = sum >= 0;
+        if (sumPred != taken || magnitude() < threshold)
+            for (unsigned t = 0; t < NUM_TABLES; t++) {
+                INT8 &c = counters[rows[t]];
+                if (taken && c < 31)
+                    c++;
+                else if (!taken && c > -32)
+                    c--;
+            }
+
+        if (sumPred != taken) {
+            if (++thresholdCounter == 63) {
+                threshold++;
+                thresholdCounter = 0;
+            }
+        } else if (magnitude() < threshold) {
+            if (--thresholdCounter == -64) {
+                threshold--;
+                thresholdCounter = 0;
+            }
+        }
+
+        history.push(taken);
+        UINT16 &local = localHistories[ip & (LOCAL_ENTRIES - 1)];
+        local = UINT16(((local << 1) | taken) & 0x7FF);
+    }
+
+    UINT64 storageBits() const {
+        return UINT64(counters.size()) * 6 + LOCAL_ENTRIES * 11 + 32 + 7;
+    }
+
+    void saveState(SNAPSHOT_WRITER &s) {
+        s.PutVector(counters);
+        history.saveState(s);
+        s.PutVector(localHistories);
+        s.Put(threshold);
+        s.Put(thresholdCounter);
+    }
+
+    void loadState(SNAPSHOT_READER &s) {
+        s.GetVector(counters);
+        history.loadState(s);
+        s.GetVector(localHistories);
+        s.Get(threshold);
+        s.Get(thresholdCounter);
+    }
+
+  private:
+    enum { NUM_GLOBAL = 5, NUM_LOCAL = 2, NUM_TABLES = 1 + NUM_GLOBAL + NUM_LOCAL };
+    static const unsigned LOCAL_ENTRIES = 256;
+
+    unsigned logEntries;
+    UINT32 mask;
+    std::vector<INT8> counters; /* table-major */
+    std::vector<UINT32> rows;   /* counters used by the last lookup */
+    GlobalHistory history;
+    std::vector<UINT16> localHistories;
+    INT32 threshold, thresholdCounter;
+    INT32 sum;
+
+    INT32 magnitude() const { return sum < 0 ? -sum : sum; }
+
+    UINT32 fold(UINT64 h) const {
+        UINT32 folded = 0;
+        for (; h; h >>= logEntries)
+            folded ^= UINT32(h);
+        return folded;
+    }
+
+    UINT32 row(unsigned table, ADDRINT hash) const {
+        return (table << logEntries) | (UINT32(hash) & mask);
+    }
+};
+
+/**
+ * Any predictor with a statistical corrector and/or a loop predictor
+ * composed over it, as in TAGE-SC-L: the corrector may revert the
+ * prediction of the base predictor, and the loop predictor overrides the
+ * result when it is confident and has been more accurate than what it
+ * overrides. The base predictor is owned, and trained on every branch
+ * independently of the final prediction.
+ **/
+class CorrectedPredictor : public BranchPredictor {
+
+public:
+    // A log2 size of 0 leaves the component out
+    CorrectedPredictor(BranchPredictor *base_, unsigned scLogEntries,
+                       unsigned loopLogEntries)
+        : BranchPredictor(), base(base_),
+          sc(scLogEntries ? new StatisticalCorrector(scLogEntries) : NULL),
+          loop(loopLogEntries ? new LoopPredictor(loopLogEntries) : NULL),
+          useLoop(-1) {}
+
+    ~CorrectedPredictor() {
+        delete base;
+        delete sc;
+        delete loop;
+    }
+
+    virtual bool predict(ADDRINT ip, ADDRINT target) {
+        basePred = base->predict(ip, target);
+        return combine(ip);
+    }
+
+    virtual void update(bool predicted, bool actual, ADDRINT ip, ADDRINT target) {
+        base->update(basePred, actual, ip, target);
+        train(ip, actual);
+        updateCounters(predicted, actual);
+    }
+
+    virtual bool predictAndUpdate(ADDRINT ip, ADDRINT target, bool actual) {
+        basePred = base->predictAndUpdate(ip, target, actual);
+        bool predicted = combine(ip);
+        train(ip, actual);
+        updateCounters(predicted, actual);
+        return predicted;
+    }
+
+    virtual string getName() {
+        std::ostringstream stream;
+        stream << base->getName() << (sc ? "-SC" : "") << (loop ? "-L" : "");
+        return stream.str();
+    }
+
+    virtual UINT64 getStorageBits() {
+        return base->getStorageBits() + (sc ? sc->storageBits() : 0) +
+               (loop ? loop->storageBits() + 7 : 0);
+    }
+
+    virtual void saveState(SNAPSHOT_WRITER &s) {
+        base->saveState(s);
+        if (sc)
+            sc->saveState(s);
+        if (loop)
+            loop->saveState(s);
+        s.Put(useLoop);
+    }
+
+    virtual void loadState(SNAPSHOT_READER &s) {
+        base->loadState(s);
+        if (sc)
+            sc->loadState(s);
+        if (loop)
+            loop->loadState(s);
+        s.Get(useLoop);
+    }
+
+private:
+    BranchPredictor *base;
+    StatisticalCorrector *sc;
+    LoopPredictor *loop;
+    INT32 useLoop; /* 7-bit, >= 0: the loop predictor may override */
+
+    /* Predictions of the last lookup */
+    bool basePred, correctedPred, finalPred;
+
+    bool combine(ADDRINT ip) {
+        correctedPred = basePred;
+        if (sc) {
+            sc->lookup(ip, basePred);
+            correctedPred = sc->correct(basePred);
+        }
+        finalPred = correctedPred;
+        if (loop) {
+            loop->lookup(ip);
+            if (loop->valid() && useLoop >= 0)
+                finalPred = loop->prediction();
+        }
+        return finalPred;
+    }
+
+    void train(ADDRINT ip, bool taken) {
+        if (sc)
+            sc->train(ip, taken);
+        if (loop) {
+            if (loop->valid() && loop->prediction() != correctedPred) {
+                if (loop->prediction() == taken && useLoop < 63)
+                    useLoop++;
+                else if (loop->prediction() != taken && useLoop > -64)
+                    useLoop--;
+            }
+            loop->train(taken, correctedPred);
+        }
+    }
+};
+
+#endif
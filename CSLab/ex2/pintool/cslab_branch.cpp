@@ -1,35 +1,68 @@
 #include "pin.H"
 
+#include <algorithm> // std::max()
 #include <cassert>
 #include <fstream>
 #include <iostream>
 
-#include "branch_predictor.h"
-#include "pentium_m_predictor/pentium_m_branch_predictor.h"
-#include "ras.h"
+#include "../../common/roi.h"
+#include "../../common/snapshot.h"
+#include "../../common/stats_writer.h"
+#include "branch_kind.h"
+#include "branch_ring.h"
+#include "predictor_factory.h"
 
 /* ===================================================================== */
 /* Commandline Switches                                                  */
 /* ===================================================================== */
 KNOB<string> KnobOutputFile(KNOB_MODE_WRITEONCE, "pintool", "o",
                             "cslab_branch.out", "specify output file name");
+KNOB<string> KnobFormat(KNOB_MODE_WRITEONCE, "pintool", "format", "text",
+                        "output format (text|json|csv)");
+KNOB<string> KnobPredictors(KNOB_MODE_APPEND, "pintool", "bp", "",
+                            "predictor, BTB or RAS to simulate, e.g. "
+                            "nbit:13:4 (repeatable, default set if none)");
+KNOB<UINT32> KnobThreads(KNOB_MODE_WRITEONCE, "pintool", "threads", "0",
+                         "worker threads feeding the predictors (0 to feed "
+                         "them from the application thread)");
+
+// Region of interest
+KNOB<UINT32> KnobRoiMarkers(KNOB_MODE_WRITEONCE, "pintool", "roi", "0",
+                            "Simulate between __parsec_roi_{begin,end}");
+KNOB<UINT64> KnobFastForward(KNOB_MODE_WRITEONCE, "pintool", "ffwd", "0",
+                             "Instructions to skip before simulating");
+KNOB<UINT64> KnobMaxInstructions(KNOB_MODE_WRITEONCE, "pintool", "maxins",
+                                 "0",
+                                 "Instructions to simulate (0 for no limit)");
+
+// Checkpointing
+KNOB<string> KnobCheckpointIn(KNOB_MODE_WRITEONCE, "pintool", "ckpt_in", "",
+                              "restore the predictor state from this file");
+KNOB<string> KnobCheckpointOut(KNOB_MODE_WRITEONCE, "pintool", "ckpt_out", "",
+                               "save the predictor state to this file");
+KNOB<UINT64> KnobCheckpointAt(KNOB_MODE_WRITEONCE, "pintool", "ckpt_at", "0",
+                              "instruction count at which to save the state "
+                              "(0 for the end of the run)");
 /* ===================================================================== */
 
 /* ===================================================================== */
 /* Global Variables                                                      */
 /* ===================================================================== */
-std::vector<BranchPredictor *> branch_predictors;
-typedef std::vector<BranchPredictor *>::iterator bp_iterator_t;
-
-//> BTBs have slightly different interface (they also have target predictions)
-//  so we need to have different vector for them.
-std::vector<BTBPredictor *> btb_predictors;
-typedef std::vector<BTBPredictor *>::iterator btb_iterator_t;
-
-std::vector<RAS *> ras_vec;
-typedef std::vector<RAS *>::iterator ras_vec_iterator_t;
+//> Direction predictors, BTBs and RASes. BTBs have slightly different
+//  interface (they also have target predictions) so they are kept apart.
+PredictorSet *predictors;
+PredictorBank *predictor_bank;
+
+//> With worker threads, the branches go through the ring and each worker
+//  feeds its shard (bank) of the predictor set. The ring has a single
+//  producer, so application threads take ring_lock to push and drain.
+BranchRing *ring;
+PIN_LOCK ring_lock;
+std::vector<PIN_THREAD_UID> worker_uids;
+BOOL workers_stop;
 
 UINT64 total_instructions;
+ROI *roi;
 std::ofstream outFile;
 
 /* ===================================================================== */
@@ -43,68 +76,118 @@ INT32 Usage() {
 
 /* ===================================================================== */
 
-VOID count_instruction() { total_instructions++; }
+VOID SaveCheckpoint() {
+    SNAPSHOT_WRITER snapshot;
 
-VOID call_instruction(ADDRINT ip, ADDRINT target, UINT32 ins_size) {
-    ras_vec_iterator_t ras_it;
+    // One section per structure, keyed by its (geometry-encoding) name
+    for (size_t i = 0; i < predictors->ras.size(); i++) {
+        snapshot.BeginSection(predictors->rasNames[i]);
+        predictors->ras[i]->saveState(snapshot);
+        snapshot.EndSection();
+    }
+    for (size_t i = 0; i < predictors->predictors.size(); i++) {
+        snapshot.BeginSection(predictors->predictorNames[i]);
+        predictors->predictors[i]->saveState(snapshot);
+        snapshot.EndSection();
+    }
+    for (size_t i = 0; i < predictors->btbs.size(); i++) {
+        snapshot.BeginSection("BTB:" + predictors->btbNames[i]);
+        predictors->btbs[i]->saveState(snapshot);
+        snapshot.EndSection();
+    }
+    for (size_t i = 0; i < predictors->indirects.size(); i++) {
+        snapshot.BeginSection("Indirect:" + predictors->indirectNames[i]);
+        predictors->indirects[i]->saveState(snapshot);
+        snapshot.EndSection();
+    }
+    if (!snapshot.Write(KnobCheckpointOut.Value()))
+        cerr << "Could not write checkpoint " << KnobCheckpointOut.Value()
+             << endl;
+}
 
-    for (ras_it = ras_vec.begin(); ras_it != ras_vec.end(); ++ras_it) {
-        RAS *ras = *ras_it;
-        ras->push_addr(ip + ins_size);
+//> Structures missing from the snapshot (or with a mismatching layout) are
+//  reported and left cold.
+template <class T>
+VOID LoadSection(SNAPSHOT_READER &snapshot, const string &key, T *component) {
+    if (!snapshot.OpenSection(key)) {
+        cerr << "Checkpoint: no state for " << key << ", starting cold" << endl;
+        return;
     }
+    component->loadState(snapshot);
+    if (!snapshot.Ok())
+        cerr << "Checkpoint: bad state for " << key << endl;
 }
 
-VOID ret_instruction(ADDRINT ip, ADDRINT target) {
-    ras_vec_iterator_t ras_it;
+BOOL LoadCheckpoint() {
+    SNAPSHOT_READER snapshot;
 
-    for (ras_it = ras_vec.begin(); ras_it != ras_vec.end(); ++ras_it) {
-        RAS *ras = *ras_it;
-        ras->pop_addr(target);
+    if (!snapshot.Read(KnobCheckpointIn.Value())) {
+        cerr << "Could not read checkpoint " << KnobCheckpointIn.Value()
+             << endl;
+        return false;
     }
+    for (size_t i = 0; i < predictors->ras.size(); i++)
+        LoadSection(snapshot, predictors->rasNames[i], predictors->ras[i]);
+    for (size_t i = 0; i < predictors->predictors.size(); i++)
+        LoadSection(snapshot, predictors->predictorNames[i],
+                    predictors->predictors[i]);
+    for (size_t i = 0; i < predictors->btbs.size(); i++)
+        LoadSection(snapshot, "BTB:" + predictors->btbNames[i],
+                    predictors->btbs[i]);
+    for (size_t i = 0; i < predictors->indirects.size(); i++)
+        LoadSection(snapshot, "Indirect:" + predictors->indirectNames[i],
+                    predictors->indirects[i]);
+    return true;
 }
 
-VOID cond_branch_instruction(ADDRINT ip, ADDRINT target, BOOL taken) {
-    bp_iterator_t bp_it;
-    BOOL pred;
-
-    for (bp_it = branch_predictors.begin(); bp_it != branch_predictors.end();
-         ++bp_it) {
-        BranchPredictor *curr_predictor = *bp_it;
-        pred = curr_predictor->predict(ip, target);
-        curr_predictor->update(pred, taken, ip, target);
+VOID count_instruction() {
+    total_instructions++;
+
+    if (total_instructions == KnobCheckpointAt.Value() &&
+        !KnobCheckpointOut.Value().empty()) {
+        if (ring) {
+            PIN_GetLock(&ring_lock, 1);
+            ring->drain();
+            PIN_ReleaseLock(&ring_lock);
+        }
+        SaveCheckpoint();
     }
 }
 
-VOID branch_instruction(ADDRINT ip, ADDRINT target, BOOL taken) {
-    btb_iterator_t btb_it;
-    BOOL pred;
+//> One analysis call per branch feeds everything that predicts it
+VOID branch_instruction(ADDRINT ip, ADDRINT target, BOOL taken, UINT32 kind,
+                        UINT32 ins_size) {
+    predictor_bank->branch(kind, ip, target, taken, ins_size);
+}
 
-    for (btb_it = btb_predictors.begin(); btb_it != btb_predictors.end();
-         ++btb_it) {
-        BTBPredictor *curr_predictor = *btb_it;
-        pred = curr_predictor->predict(ip, target);
-        curr_predictor->update(pred, taken, ip, target);
-    }
+//> Same, handing the branch to the worker threads
+VOID branch_record(ADDRINT ip, ADDRINT target, BOOL taken, UINT32 kind,
+                   UINT32 ins_size) {
+    BranchRecord r;
+
+    r.ip = ip;
+    r.target = target;
+    r.instructions = 0;
+    r.kind = kind;
+    r.ins_size = ins_size;
+    r.taken = taken;
+    PIN_GetLock(&ring_lock, 1);
+    ring->push(r);
+    PIN_ReleaseLock(&ring_lock);
 }
 
 VOID Instruction(INS ins, void *v) {
-    if (INS_Category(ins) == XED_CATEGORY_COND_BR)
-        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)cond_branch_instruction,
+    if (!roi->Simulating())
+        return;
+
+    UINT32 kind = BranchKind(ins);
+    AFUNPTR analysis =
+        ring ? (AFUNPTR)branch_record : (AFUNPTR)branch_instruction;
+    if (kind != 0)
+        INS_InsertCall(ins, IPOINT_BEFORE, analysis,
                        IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR,
-                       IARG_BRANCH_TAKEN, IARG_END);
-    else if (INS_IsCall(ins))
-        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)call_instruction,
-                       IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR, IARG_UINT32,
+                       IARG_BRANCH_TAKEN, IARG_UINT32, kind, IARG_UINT32,
                        INS_Size(ins), IARG_END);
-    else if (INS_IsRet(ins))
-        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)ret_instruction,
-                       IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR, IARG_END);
-
-    // For BTB we instrument all branches except returns
-    if (INS_IsBranch(ins) && !INS_IsRet(ins))
-        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)branch_instruction,
-                       IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR,
-                       IARG_BRANCH_TAKEN, IARG_END);
 
     // Count each and every instruction
     INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)count_instruction, IARG_END);
@@ -112,113 +195,111 @@ VOID Instruction(INS ins, void *v) {
 
 /* ===================================================================== */
 
-VOID Fini(int code, VOID *v) {
-    bp_iterator_t bp_it;
-    btb_iterator_t btb_it;
-    ras_vec_iterator_t ras_it;
-
-    // Report total instructions and total cycles
-    outFile << "Total Instructions: " << total_instructions << "\n";
-    outFile << "\n";
-
-    outFile << "RAS: (Correct - Incorrect)\n";
-    for (ras_it = ras_vec.begin(); ras_it != ras_vec.end(); ++ras_it) {
-        RAS *ras = *ras_it;
-        outFile << ras->getNameAndStats() << "\n";
+struct ShardFeeder {
+    PredictorBank *bank;
+
+    void operator()(const BranchRecord &r) {
+        bank->branch(r.kind, r.ip, r.target, r.taken, r.ins_size);
     }
-    outFile << "\n";
-
-    outFile << "Branch Predictors: (Name - Correct - Incorrect)\n";
-    for (bp_it = branch_predictors.begin(); bp_it != branch_predictors.end();
-         ++bp_it) {
-        BranchPredictor *curr_predictor = *bp_it;
-        outFile << "  " << curr_predictor->getName() << ": "
-                << curr_predictor->getNumCorrectPredictions() << " "
-                << curr_predictor->getNumIncorrectPredictions() << "\n";
+};
+
+//> Internal thread feeding shard `arg` until the workers are stopped
+VOID Worker(VOID *arg) {
+    UINT32 shard = (UINT32)(ADDRINT)arg;
+    ShardFeeder feeder = {&predictors->bank(shard)};
+
+    // Stopping follows a drain, so nothing is left behind
+    for (;;) {
+        if (ring->consume(shard, feeder) != 0)
+            continue;
+        if (__atomic_load_n(&workers_stop, __ATOMIC_ACQUIRE))
+            return;
+        BranchRing::yield();
     }
-    outFile << "\n";
-
-    outFile << "BTB Predictors: (Name - Correct - Incorrect - TargetCorrect)\n";
-    for (btb_it = btb_predictors.begin(); btb_it != btb_predictors.end();
-         ++btb_it) {
-        BTBPredictor *curr_predictor = *btb_it;
-        outFile << "  " << curr_predictor->getName() << ": "
-                << curr_predictor->getNumCorrectPredictions() << " "
-                << curr_predictor->getNumIncorrectPredictions() << " "
-                << curr_predictor->getNumCorrectTargetPredictions() << "\n";
+}
+
+VOID StartWorkers() {
+    for (UINT32 i = 0; i < predictors->numShards(); i++) {
+        PIN_THREAD_UID uid;
+        if (PIN_SpawnInternalThread(Worker, (VOID *)(ADDRINT)i, 0, &uid) ==
+            INVALID_THREADID) {
+            cerr << "Could not start worker thread " << i << endl;
+            PIN_ExitProcess(-1);
+        }
+        worker_uids.push_back(uid);
     }
+}
+
+//> Every branch pushed so far has been predicted once this returns
+VOID StopWorkers() {
+    if (!ring)
+        return;
+    PIN_GetLock(&ring_lock, 1);
+    ring->drain();
+    PIN_ReleaseLock(&ring_lock);
+    __atomic_store_n(&workers_stop, true, __ATOMIC_RELEASE);
+}
+
+VOID PrepareForFini(INT32 code, VOID *v) {
+    StopWorkers();
+    for (size_t i = 0; i < worker_uids.size(); i++)
+        PIN_WaitForThreadTermination(worker_uids[i], PIN_INFINITE_TIMEOUT,
+                                     NULL);
+}
+
+VOID ExportStatistics() {
+    STATS_WRITER w(STATS_WRITER::ParseFormat(KnobFormat.Value()));
+
+    predictors->exportStats(w, total_instructions);
+    w.Write(outFile);
+}
+
+//> Without -ckpt_at, -ckpt_out saves the state at the end of the run
+VOID FiniCheckpoint() {
+    if (KnobCheckpointOut.Value().empty())
+        return;
+    if (KnobCheckpointAt.Value() == 0)
+        SaveCheckpoint();
+    else if (total_instructions < KnobCheckpointAt.Value())
+        cerr << "Checkpoint: only " << total_instructions
+             << " instructions ran, " << KnobCheckpointOut.Value()
+             << " not written" << endl;
+}
 
+VOID Fini(int code, VOID *v) {
+    // Also reached at the end of the ROI, without PrepareForFini
+    StopWorkers();
+    FiniCheckpoint();
+
+    if (STATS_WRITER::ParseFormat(KnobFormat.Value()) !=
+        STATS_WRITER::FORMAT_TEXT) {
+        ExportStatistics();
+        outFile.close();
+        return;
+    }
+
+    predictors->printStats(outFile, total_instructions);
     outFile.close();
 }
 
 /* ===================================================================== */
 
-VOID InitPredictors() {
-    /* 4.2 - 4.3 - 4.4 */
-
-    // for (int i=1; i <= 7; i++) {
-    //     NbitPredictor *nbitPred = new NbitPredictor(14, i);
-    //     branch_predictors.push_back(nbitPred);
-    // }
-    // NbitPredictor *nbitPred = new NbitPredictor(15, 1);
-    // branch_predictors.push_back(nbitPred);
-    // nbitPred = new NbitPredictor(14, 2);
-    // branch_predictors.push_back(nbitPred);
-    // nbitPred = new NbitPredictor(13, 4);
-    // branch_predictors.push_back(nbitPred);
-    //
-    // for (int i = 1; i <=8; i*=2) {
-    //     BTBPredictor *btbPred = new BTBPredictor(512 / i, i);
-    //     btb_predictors.push_back(btbPred);
-    // }
-
-    /* 4.5 */
-
-    StaticTaken *staticT = new StaticTaken();
-    BTFNT *btfnt = new BTFNT();
-    NbitPredictor *nbit = new NbitPredictor(13, 4);
-    PentiumMBranchPredictor *pentium = new PentiumMBranchPredictor();
-    LocalHistoryTwoLevel *local1 = new LocalHistoryTwoLevel(13, 2, 11, 8);
-    LocalHistoryTwoLevel *local2 = new LocalHistoryTwoLevel(13, 2, 12, 4);
-    GlobalHistoryTwoLevel *global1 = new GlobalHistoryTwoLevel(14, 2, 4);
-    GlobalHistoryTwoLevel *global2 = new GlobalHistoryTwoLevel(14, 2, 8);
-    GlobalHistoryTwoLevel *global3 = new GlobalHistoryTwoLevel(13, 4, 4);
-    GlobalHistoryTwoLevel *global4 = new GlobalHistoryTwoLevel(13, 4, 8);
-    TournamentLocalNbit *tour1 =
-        new TournamentLocalNbit(9, 2, 12, 4, 12, 2, 11, 4);
-    TournamentLocalNbit *tour2 =
-        new TournamentLocalNbit(9, 2, 13, 2, 11, 4, 11, 4);
-    TournamentGlobalNbit *tour3 =
-        new TournamentGlobalNbit(9, 2, 12, 4, 13, 2, 4);
-    TournamentGlobalNbit *tour4 =
-        new TournamentGlobalNbit(9, 2, 13, 2, 13, 2, 4);
-
-    branch_predictors.push_back(staticT);
-    branch_predictors.push_back(btfnt);
-    branch_predictors.push_back(nbit);
-    branch_predictors.push_back(pentium);
-    branch_predictors.push_back(local1);
-    branch_predictors.push_back(local2);
-    branch_predictors.push_back(global1);
-    branch_predictors.push_back(global2);
-    branch_predictors.push_back(global3);
-    branch_predictors.push_back(global4);
-    branch_predictors.push_back(tour1);
-    branch_predictors.push_back(tour2);
-    branch_predictors.push_back(tour3);
-    branch_predictors.push_back(tour4);
-
-    // Pentium-M predictor
-    // PentiumMBranchPredictor *pentiumPredictor = new
-    // PentiumMBranchPredictor(); branch_predictors.push_back(pentiumPredictor);
-}
-
-VOID InitRas() {
-    for (UINT32 i = 1; i <= 128; i *= 2) {
-        if (i == 8 || i == 32)
-            continue;
-        ras_vec.push_back(new RAS(i));
+BOOL InitPredictors() {
+    predictors = new PredictorSet(std::max(KnobThreads.Value(), 1U));
+    predictor_bank = &predictors->bank();
+
+    // The knob's empty default may show up as a value
+    for (UINT32 i = 0; i < KnobPredictors.NumberOfValues(); i++) {
+        const string spec = KnobPredictors.Value(i);
+        if (!spec.empty() && !predictors->add(spec)) {
+            cerr << "Unknown predictor spec " << spec << endl;
+            return false;
+        }
     }
+    if (predictors->predictors.empty() && predictors->btbs.empty() &&
+        predictors->ras.empty())
+        predictors->addDefaults();
+    return true;
 }
 
 int main(int argc, char *argv[]) {
@@ -231,10 +312,23 @@ int main(int argc, char *argv[]) {
     outFile.open(KnobOutputFile.Value().c_str());
 
     // Initialize predictors and RAS vector
-    InitPredictors();
-    InitRas();
+    if (!InitPredictors())
+        return Usage();
+
+    if (!KnobCheckpointIn.Value().empty() && !LoadCheckpoint())
+        return -1;
+
+    if (KnobThreads.Value() > 0) {
+        PIN_InitLock(&ring_lock);
+        ring = new BranchRing(predictors->numShards());
+        StartWorkers();
+        PIN_AddPrepareForFiniFunction(PrepareForFini, 0);
+    }
 
-    // Instrument function calls in order to catch __parsec_roi_{begin,end}
+    // Only BBL counting runs outside the region of interest (ROI)
+    roi = new ROI(KnobFastForward.Value(), KnobMaxInstructions.Value(),
+                  KnobRoiMarkers.Value(), Fini);
+    roi->Instrument();
     INS_AddInstrumentFunction(Instruction, 0);
 
     // Called when the instrumented application finishes its execution
@@ -0,0 +1,116 @@
+#include "pin.H"
+
+#include <iostream>
+
+#include "../../common/roi.h"
+#include "branch_kind.h"
+#include "branch_trace.h"
+
+/* ===================================================================== */
+/* Commandline Switches                                                  */
+/* ===================================================================== */
+KNOB<string> KnobOutputFile(KNOB_MODE_WRITEONCE, "pintool", "o",
+                            "cslab_branch.trace", "specify trace file name");
+
+// Region of interest
+KNOB<UINT32> KnobRoiMarkers(KNOB_MODE_WRITEONCE, "pintool", "roi", "0",
+                            "Simulate between __parsec_roi_{begin,end}");
+KNOB<UINT64> KnobFastForward(KNOB_MODE_WRITEONCE, "pintool", "ffwd", "0",
+                             "Instructions to skip before simulating");
+KNOB<UINT64> KnobMaxInstructions(KNOB_MODE_WRITEONCE, "pintool", "maxins",
+                                 "0",
+                                 "Instructions to simulate (0 for no limit)");
+/* ===================================================================== */
+
+/* ===================================================================== */
+/* Global Variables                                                      */
+/* ===================================================================== */
+BranchTraceWriter trace;
+
+UINT64 total_instructions;
+UINT64 last_branch_instructions; // total_instructions at the last record
+ROI *roi;
+
+/* ===================================================================== */
+
+INT32 Usage() {
+    cerr << "This tool records the branches of the application in a trace "
+            "for bp_replay.\n\n";
+    cerr << KNOB_BASE::StringKnobSummary();
+    cerr << endl;
+    return -1;
+}
+
+/* ===================================================================== */
+
+VOID count_instruction() { total_instructions++; }
+
+// Called before the branch is counted, as in cslab_branch
+VOID branch_instruction(ADDRINT ip, ADDRINT target, BOOL taken, UINT32 kind,
+                        UINT32 ins_size) {
+    BranchRecord r;
+
+    r.ip = ip;
+    r.target = target;
+    r.taken = taken;
+    r.kind = kind;
+    r.ins_size = ins_size;
+    r.instructions = total_instructions + 1 - last_branch_instructions;
+    last_branch_instructions = total_instructions + 1;
+    trace.write(r);
+}
+
+VOID Instruction(INS ins, void *v) {
+    if (!roi->Simulating())
+        return;
+
+    UINT32 kind = BranchKind(ins);
+    if (kind != 0)
+        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)branch_instruction,
+                       IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR,
+                       IARG_BRANCH_TAKEN, IARG_UINT32, kind, IARG_UINT32,
+                       INS_Size(ins), IARG_END);
+
+    // Count each and every instruction
+    INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)count_instruction, IARG_END);
+}
+
+/* ===================================================================== */
+
+VOID Fini(int code, VOID *v) {
+    trace.close(total_instructions);
+    cerr << "Traced " << trace.records() << " branches in "
+         << total_instructions << " instructions" << endl;
+}
+
+/* ===================================================================== */
+
+int main(int argc, char *argv[]) {
+    PIN_InitSymbols();
+
+    if (PIN_Init(argc, argv))
+        return Usage();
+
+    if (!trace.open(KnobOutputFile.Value())) {
+        cerr << "Could not open " << KnobOutputFile.Value() << endl;
+        return -1;
+    }
+
+    // Only BBL counting runs outside the region of interest (ROI)
+    roi = new ROI(KnobFastForward.Value(), KnobMaxInstructions.Value(),
+                  KnobRoiMarkers.Value(), Fini);
+    roi->Instrument();
+    INS_AddInstrumentFunction(Instruction, 0);
+
+    // Called when the instrumented application finishes its execution
+    PIN_AddFiniFunction(Fini, 0);
+
+    // Never returns
+    PIN_StartProgram();
+
+    return 0;
+}
+
+/* ===================================================================== */
+/* eof */
+/* ===================================================================== */
@@ -0,0 +1,349 @@
+#ifndef GLOBAL_PREDICTORS_H
+#define GLOBAL_PREDICTORS_H
+
+#include <cmath> // pow()
+#include <sstream>
+#include <vector>
+
+#include "branch_predictor.h"
+#include "history.h"
+
+/**
+ * Global history predictors that hash the address with the history instead
+ * of concatenating them (GlobalHistoryTwoLevel is gselect). They all take
+ * `indexBits` for their pattern tables, `historyLength` (at most 64)
+ * outcomes of global history and `counterBits`-bit counters; this class
+ * holds the history and the shared index computation.
+ **/
+class GlobalHashedPredictor : public BranchPredictor {
+
+public:
+    GlobalHashedPredictor(unsigned indexBits_, unsigned historyLength_,
+                          unsigned counterBits_)
+        : BranchPredictor(), indexBits(indexBits_),
+          historyLength(historyLength_), counterBits(counterBits_),
+          mask((1U << indexBits_) - 1), history(historyLength_) {}
+
+    virtual void saveState(SNAPSHOT_WRITER &s) { history.saveState(s); }
+    virtual void loadState(SNAPSHOT_READER &s) { history.loadState(s); }
+
+protected:
+    unsigned indexBits, historyLength, counterBits;
+    UINT32 mask;
+    GlobalHistory history;
+
+    // The history XOR-folded into the index width
+    UINT32 foldedHistory() const {
+        UINT64 h = history.recent(historyLength);
+        UINT32 folded = 0;
+        for (; h; h >>= indexBits)
+            folded ^= UINT32(h);
+        return folded & mask;
+    }
+
+    UINT32 addressIndex(ADDRINT ip) const { return ip & mask; }
+    UINT32 gshareIndex(ADDRINT ip) const { return (ip ^ foldedHistory()) & mask; }
+
+    string describe(const char *kind) {
+        std::ostringstream stream;
+        stream << kind << "-PHT-" << pow(2.0, double(indexBits)) / 1024.0
+               << "K-" << counterBits << "-GHR-" << historyLength;
+        return stream.str();
+    }
+};
+
+/**
+ * gshare: one counter table indexed by the address XOR the history.
+ **/
+class GsharePredictor : public GlobalHashedPredictor {
+
+public:
+    GsharePredictor(unsigned indexBits, unsigned historyLength,
+                    unsigned counterBits)
+        : GlobalHashedPredictor(indexBits, historyLength, counterBits),
+          pht(1 << indexBits, counterBits, 0) {}
+
+    virtual bool predict(ADDRINT ip, ADDRINT target) {
+        return pht.taken(gshareIndex(ip));
+    }
+
+    virtual void update(bool predicted, bool actual, ADDRINT ip, ADDRINT target) {
+        train(gshareIndex(ip), actual);
+        updateCounters(predicted, actual);
+    }
+
+    virtual bool predictAndUpdate(ADDRINT ip, ADDRINT target, bool actual) {
+        UINT32 index = gshareIndex(ip);
+        bool predicted = pht.taken(index);
+        train(index, actual);
+        updateCounters(predicted, actual);
+        return predicted;
+    }
+
+    virtual string getName() { return describe("Gshare"); }
+
+    virtual UINT64 getStorageBits() {
+        return pht.storageBits() + historyLength;
+    }
+
+    virtual void saveState(SNAPSHOT_WRITER &s) {
+        GlobalHashedPredictor::saveState(s);
+        pht.saveState(s);
+    }
+
+    virtual void loadState(SNAPSHOT_READER &s) {
+        GlobalHashedPredictor::loadState(s);
+        pht.loadState(s);
+    }
+
+private:
+    CounterTable pht;
+
+    void train(UINT32 index, bool actual) {
+        pht.train(index, actual);
+        history.push(actual);
+    }
+};
+
+/**
+ * Bi-mode: an address-indexed choice table picks one of two gshare-indexed
+ * direction tables, one for mostly taken and one for mostly not taken
+ * branches, so that branches of opposite bias do not alias in the same
+ * counters. Only the chosen table is trained, and the choice is not trained
+ * when it was wrong but the chosen table was right.
+ **/
+class BiModePredictor : public GlobalHashedPredictor {
+
+public:
+    BiModePredictor(unsigned indexBits, unsigned historyLength,
+                    unsigned counterBits)
+        : GlobalHashedPredictor(indexBits, historyLength, counterBits),
+          choice(1 << indexBits, counterBits, 1 << (counterBits - 1)),
+          takenPht(1 << indexBits, counterBits, 1 << (counterBits - 1)),
+          notTakenPht(1 << indexBits, counterBits, (1 << (counterBits - 1)) - 1) {}
+
+    virtual bool predict(ADDRINT ip, ADDRINT target) {
+        UINT32 c = addressIndex(ip);
+        return (choice.taken(c) ? takenPht : notTakenPht).taken(gshareIndex(ip));
+    }
+
+    virtual void update(bool predicted, bool actual, ADDRINT ip, ADDRINT target) {
+        train(addressIndex(ip), gshareIndex(ip), actual);
+        updateCounters(predicted, actual);
+    }
+
+    virtual bool predictAndUpdate(ADDRINT ip, ADDRINT target, bool actual) {
+        UINT32 c = addressIndex(ip), d = gshareIndex(ip);
+        bool predicted = (choice.taken(c) ? takenPht : notTakenPht).taken(d);
+        train(c, d, actual);
+        updateCounters(predicted, actual);
+        return predicted;
+    }
+
+    virtual string getName() { return describe("BiMode"); }
+
+    virtual UINT64 getStorageBits() {
+        return choice.storageBits() + takenPht.storageBits() +
+               notTakenPht.storageBits() + historyLength;
+    }
+
+    virtual void saveState(SNAPSHOT_WRITER &s) {
+        GlobalHashedPredictor::saveState(s);
+        choice.saveState(s);
+        takenPht.saveState(s);
+        notTakenPht.saveState(s);
+    }
+
+    virtual void loadState(SNAPSHOT_READER &s) {
+        GlobalHashedPredictor::loadState(s);
+        choice.loadState(s);
+        takenPht.loadState(s);
+        notTakenPht.loadState(s);
+    }
+
+private:
+    CounterTable choice, takenPht, notTakenPht;
+
+    void train(UINT32 c, UINT32 d, bool actual) {
+        bool chosen = choice.taken(c);
+        CounterTable &pht = chosen ? takenPht : notTakenPht;
+        bool direction = pht.taken(d);
+
+        pht.train(d, actual);
+        if (!(chosen != actual && direction == actual))
+            choice.train(c, actual);
+        history.push(actual);
+    }
+};
+
+/**
+ * YAGS: an address-indexed choice table gives each branch its bias, and two
+ * tagged caches, indexed like gshare, hold only the exceptions: the
+ * taken cache the instances where a not taken biased branch is taken, and
+ * vice versa. Tags are 8 address bits. An exception is cached when the
+ * choice mispredicts and the cache missed; the choice is trained as in
+ * bi-mode.
+ **/
+class YAGSPredictor : public GlobalHashedPredictor {
+
+public:
+    YAGSPredictor(unsigned indexBits, unsigned historyLength,
+                  unsigned counterBits)
+        : GlobalHashedPredictor(indexBits, historyLength, counterBits),
+          choice(1 << indexBits, counterBits, 1 << (counterBits - 1)),
+          takenCache(1 << indexBits, counterBits, 0),
+          notTakenCache(1 << indexBits, counterBits, 0),
+          takenTags(1 << indexBits, 0), notTakenTags(1 << indexBits, 0) {}
+
+    virtual bool predict(ADDRINT ip, ADDRINT target) {
+        return lookup(addressIndex(ip), gshareIndex(ip), tag(ip));
+    }
+
+    virtual void update(bool predicted, bool actual, ADDRINT ip, ADDRINT target) {
+        train(addressIndex(ip), gshareIndex(ip), tag(ip), actual);
+        updateCounters(predicted, actual);
+    }
+
+    virtual bool predictAndUpdate(ADDRINT ip, ADDRINT target, bool actual) {
+        UINT32 c = addressIndex(ip), d = gshareIndex(ip);
+        UINT8 t = tag(ip);
+        bool predicted = lookup(c, d, t);
+        train(c, d, t, actual);
+        updateCounters(predicted, actual);
+        return predicted;
+    }
+
+    virtual string getName() { return describe("YAGS"); }
+
+    virtual UINT64 getStorageBits() {
+        return choice.storageBits() + takenCache.storageBits() +
+               notTakenCache.storageBits() +
+               UINT64(takenTags.size() + notTakenTags.size()) * 8 +
+               historyLength;
+    }
+
+    virtual void saveState(SNAPSHOT_WRITER &s) {
+        GlobalHashedPredictor::saveState(s);
+        choice.saveState(s);
+        takenCache.saveState(s);
+        notTakenCache.saveState(s);
+        s.PutVector(takenTags);
+        s.PutVector(notTakenTags);
+    }
+
+    virtual void loadState(SNAPSHOT_READER &s) {
+        GlobalHashedPredictor::loadState(s);
+        choice.loadState(s);
+        takenCache.loadState(s);
+        notTakenCache.loadState(s);
+        s.GetVector(takenTags);
+        s.GetVector(notTakenTags);
+    }
+
+private:
+    CounterTable choice, takenCache, notTakenCache;
+    std::vector<UINT8> takenTags, notTakenTags;
+
+    UINT8 tag(ADDRINT ip) const { return UINT8(ip >> indexBits); }
+
+    bool lookup(UINT32 c, UINT32 d, UINT8 t) {
+        /* A taken biased branch looks for its not taken exceptions */
+        if (choice.taken(c))
+            return notTakenTags[d] == t ? notTakenCache.taken(d) : true;
+        return takenTags[d] == t ? takenCache.taken(d) : false;
+    }
+
+    void train(UINT32 c, UINT32 d, UINT8 t, bool actual) {
+        bool bias = choice.taken(c);
+        CounterTable &cache = bias ? notTakenCache : takenCache;
+        std::vector<UINT8> &tags = bias ? notTakenTags : takenTags;
+        bool hit = tags[d] == t;
+
+        if (hit) {
+            bool cached = cache.taken(d);
+            cache.train(d, actual);
+            if (!(bias != actual && cached == actual))
+                choice.train(c, actual);
+        } else {
+            if (bias != actual) {
+                tags[d] = t;
+                cache.reset(d, actual);
+            }
+            choice.train(c, actual);
+        }
+        history.push(actual);
+    }
+};
+
+/**
+ * Agree: a bias bit per address, set by the first outcome of the branch,
+ * and a gshare-indexed table predicting whether the branch agrees with its
+ * bias. Branches aliasing in the table mostly agree with their own biases,
+ * so they push the shared counter the same way.
+ **/
+class AgreePredictor : public GlobalHashedPredictor {
+
+public:
+    AgreePredictor(unsigned indexBits, unsigned historyLength,
+                   unsigned counterBits)
+        : GlobalHashedPredictor(indexBits, historyLength, counterBits),
+          agree(1 << indexBits, counterBits, 1 << (counterBits - 1)),
+          bias(1 << indexBits, BIAS_UNSET) {}
+
+    virtual bool predict(ADDRINT ip, ADDRINT target) {
+        return direction(addressIndex(ip), gshareIndex(ip));
+    }
+
+    virtual void update(bool predicted, bool actual, ADDRINT ip, ADDRINT target) {
+        train(addressIndex(ip), gshareIndex(ip), actual);
+        updateCounters(predicted, actual);
+    }
+
+    virtual bool predictAndUpdate(ADDRINT ip, ADDRINT target, bool actual) {
+        UINT32 b = addressIndex(ip), d = gshareIndex(ip);
+        bool predicted = direction(b, d);
+        train(b, d, actual);
+        updateCounters(predicted, actual);
+        return predicted;
+    }
+
+    virtual string getName() { return describe("Agree"); }
+
+    // The bias bits and their valid bits
+    virtual UINT64 getStorageBits() {
+        return agree.storageBits() + UINT64(bias.size()) * 2 + historyLength;
+    }
+
+    virtual void saveState(SNAPSHOT_WRITER &s) {
+        GlobalHashedPredictor::saveState(s);
+        agree.saveState(s);
+        s.PutVector(bias);
+    }
+
+    virtual void loadState(SNAPSHOT_READER &s) {
+        GlobalHashedPredictor::loadState(s);
+        agree.loadState(s);
+        s.GetVector(bias);
+    }
+
+private:
+    enum { BIAS_NOT_TAKEN = 0, BIAS_TAKEN = 1, BIAS_UNSET = 2 };
+
+    CounterTable agree;
+    std::vector<UINT8> bias;
+
+    /* An unseen branch is predicted taken, as agreeing with a taken bias */
+    bool direction(UINT32 b, UINT32 d) {
+        bool biasTaken = bias[b] != BIAS_NOT_TAKEN;
+        return agree.taken(d) ? biasTaken : !biasTaken;
+    }
+
+    void train(UINT32 b, UINT32 d, bool actual) {
+        if (bias[b] == BIAS_UNSET)
+            bias[b] = actual ? BIAS_TAKEN : BIAS_NOT_TAKEN;
+        agree.train(d, actual == (bias[b] == BIAS_TAKEN));
+        history.push(actual);
+    }
+};
+
+#endif
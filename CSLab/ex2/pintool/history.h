@@ -0,0 +1,250 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <cmath> // pow()
+#include <vector>
+
+#include "../../common/snapshot.h"
+
+/**
+ * Global branch history of up to `maxLength` outcomes, in a circular buffer:
+ * pushing is O(1) and so is reading the outcome of n branches ago, which is
+ * what folded histories need to drop the outcome leaving their window.
+ **/
+class GlobalHistory {
+  public:
+    GlobalHistory(unsigned maxLength) : head(0), last64(0) {
+        unsigned size = 1;
+        while (size < maxLength + 1)
+            size <<= 1;
+        bits.assign(size, 0);
+        mask = size - 1;
+    }
+
+    void push(bool taken) {
+        head = (head - 1) & mask;
+        bits[head] = taken;
+        last64 = (last64 << 1) | taken;
+    }
+
+    // Outcome of the n-th most recent branch (0 for the last one)
+    unsigned operator[](unsigned n) const { return bits[(head + n) & mask]; }
+
+    // The most recent `length` (at most 64) outcomes, the last one in bit 0
+    UINT64 recent(unsigned length) const {
+        return length >= 64 ? last64 : last64 & ((UINT64(1) << length) - 1);
+    }
+
+    void saveState(SNAPSHOT_WRITER &s) {
+        s.Put(head);
+        s.Put(last64);
+        s.PutVector(bits);
+    }
+
+    void loadState(SNAPSHOT_READER &s) {
+        s.Get(head);
+        s.Get(last64);
+        s.GetVector(bits);
+    }
+
+  private:
+    std::vector<UINT8> bits;
+    unsigned head, mask;
+    UINT64 last64;
+};
+
+/**
+ * The last `length` outcomes of a GlobalHistory XOR-folded into `width`
+ * bits, kept up to date in O(1) per branch however long the history is.
+ * update() must follow every push() of the history.
+ **/
+struct FoldedHistory {
+    UINT32 value;
+    unsigned length, width, outpoint;
+
+    void init(unsigned length_, unsigned width_) {
+        value = 0;
+        length = length_;
+        width = width_;
+        outpoint = length % width;
+    }
+
+    void update(const GlobalHistory &h) {
+        value = (value << 1) | h[0];
+        value ^= h[length] << outpoint;
+        value ^= value >> width;
+        value &= (1U << width) - 1;
+    }
+};
+
+/**
+ * Table of `bits`-bit saturating counters; the top bit is the prediction.
+ **/
+class CounterTable {
+  public:
+    CounterTable(unsigned entries, unsigned bits_, UINT8 initial)
+        : counters(entries, initial), bits(bits_), max((1 << bits_) - 1) {}
+
+    bool taken(UINT32 i) const { return counters[i] >> (bits - 1); }
+
+    void train(UINT32 i, bool taken) {
+        if (taken && counters[i] < max)
+            counters[i]++;
+        else if (!taken && counters[i] > 0)
+            counters[i]--;
+    }
+
+    // Weakest value on the side of `taken`
+    void reset(UINT32 i, bool taken) {
+        counters[i] = UINT8((1 << (bits - 1)) - (taken ? 0 : 1));
+    }
+
+    UINT64 storageBits() const { return UINT64(counters.size()) * bits; }
+
+    void saveState(SNAPSHOT_WRITER &s) { s.PutVector(counters); }
+    void loadState(SNAPSHOT_READER &s) { s.GetVector(counters); }
+
+  private:
+    std::vector<UINT8> counters;
+    unsigned bits;
+    UINT8 max;
+};
+
+/**
+ * Path history: one address bit per branch, the last `length` (at most 32)
+ * branches.
+ **/
+class PathHistory {
+  public:
+    PathHistory(unsigned length = 16)
+        : value(0), mask(length >= 32 ? ~0U : (1U << length) - 1) {}
+
+    void push(ADDRINT ip) { value = ((value << 1) ^ UINT32(ip & 1)) & mask; }
+
+    UINT32 recent(unsigned length) const {
+        return length >= 32 ? value : value & ((1U << length) - 1);
+    }
+
+    void saveState(SNAPSHOT_WRITER &s) { s.Put(value); }
+    void loadState(SNAPSHOT_READER &s) { s.Get(value); }
+
+  private:
+    UINT32 value, mask;
+};
+
+/**
+ * Indexing shared by the TAGE-like predictors: `numTables` tagged tables of
+ * 2^logEntries entries, indexed and tagged with global histories of
+ * geometrically increasing lengths, from `minHistory` to `maxHistory`
+ * outcomes, folded in O(1) per branch. Longer tables get longer tags, from
+ * `minTagBits` to `maxTagBits`. push() must follow every history bit.
+ **/
+class GeometricHistories {
+  public:
+    GeometricHistories(unsigned numTables_, unsigned logEntries_,
+                       unsigned minHistory, unsigned maxHistory,
+                       unsigned minTagBits, unsigned maxTagBits, UINT32 seed_)
+        : numTables(numTables_), logEntries(logEntries_), history(maxHistory),
+          lengths(numTables_), widths(numTables_), foldedIndex(numTables_),
+          foldedTag0(numTables_), foldedTag1(numTables_), indices(numTables_),
+          tags(numTables_), seed(seed_) {
+        for (unsigned i = 0; i < numTables; i++) {
+            double ratio = numTables > 1 ? double(i) / (numTables - 1) : 0;
+            lengths[i] = unsigned(
+                minHistory * pow(double(maxHistory) / minHistory, ratio) + 0.5);
+            widths[i] = numTables > 1
+                            ? minTagBits +
+                                  ((maxTagBits - minTagBits) * i) / (numTables - 1)
+                            : (minTagBits + maxTagBits) / 2;
+            foldedIndex[i].init(lengths[i], logEntries);
+            foldedTag0[i].init(lengths[i], widths[i]);
+            foldedTag1[i].init(lengths[i], widths[i] - 1);
+        }
+    }
+
+    // Index and tag of every table for `ip`, the index also hashed with up
+    // to 16 bits of `path` when given
+    void lookup(ADDRINT ip, const PathHistory *path = NULL) {
+        for (unsigned i = 0; i < numTables; i++) {
+            unsigned h = path ? path->recent(lengths[i] < 16 ? lengths[i] : 16)
+                              : 0;
+            indices[i] = (ip ^ (ip >> (logEntries - i % logEntries)) ^
+                          foldedIndex[i].value ^ h ^ (h >> logEntries)) &
+                         ((1U << logEntries) - 1);
+            tags[i] = (ip ^ foldedTag0[i].value ^ (foldedTag1[i].value << 1)) &
+                      ((1U << widths[i]) - 1);
+        }
+    }
+
+    // The longest table whose entry matches its tag (`provider`) and the
+    // next one (`alternate`), -1 for none. `tagOf` reads the tag of an
+    // entry.
+    template <class E, class TagOf>
+    void match(const std::vector<std::vector<E> > &tables, TagOf tagOf,
+               int &provider, int &alternate) const {
+        provider = alternate = -1;
+        for (int i = numTables - 1; i >= 0; i--) {
+            if (tagOf(tables[i][indices[i]]) != tags[i])
+                continue;
+            if (provider < 0) {
+                provider = i;
+            } else {
+                alternate = i;
+                break;
+            }
+        }
+    }
+
+    // First table to allocate in after `provider` mispredicted, sometimes
+    // skipping one to spread the allocations
+    unsigned allocationStart(int provider) {
+        unsigned start = provider + 1;
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        if ((seed & 1) && start + 1 < numTables)
+            start++;
+        return start;
+    }
+
+    void push(bool bit) {
+        history.push(bit);
+        for (unsigned i = 0; i < numTables; i++) {
+            foldedIndex[i].update(history);
+            foldedTag0[i].update(history);
+            foldedTag1[i].update(history);
+        }
+    }
+
+    UINT32 index(unsigned table) const { return indices[table]; }
+    UINT32 tag(unsigned table) const { return tags[table]; }
+    unsigned tagBits(unsigned table) const { return widths[table]; }
+
+    void saveState(SNAPSHOT_WRITER &s) {
+        history.saveState(s);
+        s.PutVector(foldedIndex);
+        s.PutVector(foldedTag0);
+        s.PutVector(foldedTag1);
+        s.Put(seed);
+    }
+
+    void loadState(SNAPSHOT_READER &s) {
+        history.loadState(s);
+        s.GetVector(foldedIndex);
+        s.GetVector(foldedTag0);
+        s.GetVector(foldedTag1);
+        s.Get(seed);
+    }
+
+  private:
+    unsigned numTables, logEntries;
+    GlobalHistory history;
+    std::vector<unsigned> lengths, widths;
+    std::vector<FoldedHistory> foldedIndex, foldedTag0, foldedTag1;
+
+    /* Last lookup */
+    std::vector<UINT32> indices, tags;
+    UINT32 seed; /* allocation randomization */
+};
+
+#endif
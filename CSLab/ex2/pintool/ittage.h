@@ -0,0 +1,192 @@
+#ifndef ITTAGE_H
+#define ITTAGE_H
+
+#include <cmath> // pow()
+#include <sstream>
+#include <vector>
+
+#include "branch_predictor.h"
+#include "history.h"
+
+/**
+ * ITTAGE: TAGE for indirect branch targets. A target table indexed by the
+ * address provides the default, and `numTables` tagged tables indexed with
+ * geometric global histories (from `minHistory` to `maxHistory` bits)
+ * override it, the longest matching one first. The history holds the
+ * outcome of every conditional branch and two hashed target bits of every
+ * indirect one.
+ *
+ * Each entry has a target, a 2-bit confidence counter (a wrong target is
+ * only replaced at confidence 0) and a useful bit, set when the entry was
+ * right and the alternate prediction wrong. A misprediction allocates an
+ * entry in a longer table whose useful bit is clear, or clears the useful
+ * bits of the candidates when none is; all of them are cleared every 2^16
+ * indirect branches. Storage counts 32-bit targets.
+ **/
+class ITTAGEPredictor : public IndirectPredictor {
+
+public:
+    ITTAGEPredictor(unsigned numTables_, unsigned logEntries_,
+                    unsigned minHistory_, unsigned maxHistory_)
+        : IndirectPredictor(), numTables(numTables_), logEntries(logEntries_),
+          minHistory(minHistory_), maxHistory(maxHistory_),
+          base(size_t(1) << logEntries_), tables(numTables_),
+          geometry(numTables_, logEntries_, minHistory_, maxHistory_, 9, 15,
+                   0x87654321) {
+        for (unsigned i = 0; i < numTables; i++)
+            tables[i].resize(size_t(1) << logEntries);
+        tick = 0;
+    }
+
+    virtual bool predictAndUpdate(ADDRINT ip, ADDRINT target) {
+        lookup(ip);
+        bool correct = predicted == target;
+        train(ip, target);
+        return updateCounters(correct);
+    }
+
+    virtual void conditional(ADDRINT ip, bool taken) {
+        push(taken);
+    }
+
+    virtual string getName() {
+        std::ostringstream stream;
+        stream << "ITTAGE-" << numTables << "x"
+               << pow(2.0, double(logEntries)) / 1024.0 << "K-" << minHistory
+               << "-" << maxHistory;
+        return stream.str();
+    }
+
+    virtual UINT64 getStorageBits() {
+        UINT64 bits = UINT64(32 + 2) << logEntries;
+        for (unsigned i = 0; i < numTables; i++)
+            bits += UINT64(32 + 2 + 1 + geometry.tagBits(i)) << logEntries;
+        return bits + maxHistory;
+    }
+
+    virtual void saveState(SNAPSHOT_WRITER &s) {
+        s.PutVector(base);
+        for (unsigned i = 0; i < numTables; i++)
+            s.PutVector(tables[i]);
+        geometry.saveState(s);
+        s.Put(tick);
+    }
+
+    virtual void loadState(SNAPSHOT_READER &s) {
+        s.GetVector(base);
+        for (unsigned i = 0; i < numTables; i++)
+            s.GetVector(tables[i]);
+        geometry.loadState(s);
+        s.Get(tick);
+    }
+
+private:
+    struct Entry {
+        ADDRINT target;
+        UINT16 tag;
+        UINT8 ctr, useful;
+
+        Entry() : target(0), tag(0), ctr(0), useful(0) {}
+    };
+
+    struct TagOf {
+        unsigned operator()(const Entry &e) const { return e.tag; }
+    };
+
+    unsigned numTables, logEntries;
+    unsigned minHistory, maxHistory;
+
+    std::vector<Entry> base; /* tags unused */
+    std::vector<std::vector<Entry> > tables;
+    GeometricHistories geometry;
+
+    UINT32 tick; /* indirect branches since the useful bits were cleared */
+
+    /* Lookup results, kept for the update */
+    int provider, alternate;
+    ADDRINT predicted, altPredicted;
+
+    Entry &baseEntry(ADDRINT ip) {
+        return base[ip & ((1U << logEntries) - 1)];
+    }
+
+    Entry &entry(unsigned table) {
+        return tables[table][geometry.index(table)];
+    }
+
+    Entry &alternateEntry(ADDRINT ip) {
+        return alternate >= 0 ? entry(alternate) : baseEntry(ip);
+    }
+
+    void lookup(ADDRINT ip) {
+        geometry.lookup(ip);
+        geometry.match(tables, TagOf(), provider, alternate);
+
+        altPredicted = alternateEntry(ip).target;
+        predicted = altPredicted;
+        if (provider >= 0) {
+            /* A new entry yields to its alternate until confirmed */
+            Entry &e = entry(provider);
+            if (e.ctr > 0 || altPredicted == 0)
+                predicted = e.target;
+        }
+    }
+
+    static void trainEntry(Entry &e, ADDRINT target) {
+        if (e.target == target) {
+            if (e.ctr < 3)
+                e.ctr++;
+        } else if (e.ctr > 0) {
+            e.ctr--;
+        } else {
+            e.target = target;
+        }
+    }
+
+    void train(ADDRINT ip, ADDRINT target) {
+        if (predicted != target && provider < int(numTables) - 1)
+            allocate(target);
+
+        if (provider >= 0) {
+            Entry &e = entry(provider);
+            if (e.target == target && altPredicted != target)
+                e.useful = 1;
+            else if (e.target != target && altPredicted == target)
+                e.useful = 0;
+            if (e.ctr == 0)
+                trainEntry(alternateEntry(ip), target);
+            trainEntry(e, target);
+        } else {
+            trainEntry(baseEntry(ip), target);
+        }
+
+        if ((++tick & ((1 << 16) - 1)) == 0)
+            for (unsigned i = 0; i < numTables; i++)
+                for (size_t j = 0; j < tables[i].size(); j++)
+                    tables[i][j].useful = 0;
+
+        /* Two bits of the target, each folding in some higher ones */
+        push(((target >> 2) ^ (target >> 5) ^ (target >> 8)) & 1);
+        push(((target >> 3) ^ (target >> 6) ^ (target >> 9)) & 1);
+    }
+
+    void allocate(ADDRINT target) {
+        unsigned start = geometry.allocationStart(provider);
+
+        for (unsigned i = start; i < numTables; i++) {
+            Entry &e = entry(i);
+            if (!e.useful) {
+                e.target = target;
+                e.tag = UINT16(geometry.tag(i));
+                e.ctr = 0;
+                return;
+            }
+        }
+        for (unsigned i = start; i < numTables; i++)
+            entry(i).useful = 0;
+    }
+
+    void push(bool bit) { geometry.push(bit); }
+};
+
+#endif
@@ -84,6 +84,28 @@ public:
 		m_ways[lru_way].m_lru[index] = m_lru_use_count++;
 	}
 
+	virtual void saveState(SNAPSHOT_WRITER &s)
+	{
+		s.Put(m_lru_use_count);
+		for (unsigned int w = 0 ; w < m_num_ways ; ++w ) {
+			s.PutVector(m_ways[w].m_valid);
+			s.PutVector(m_ways[w].m_tags);
+			s.PutVector(m_ways[w].m_predictors);
+			s.PutVector(m_ways[w].m_lru);
+		}
+	}
+
+	virtual void loadState(SNAPSHOT_READER &s)
+	{
+		s.Get(m_lru_use_count);
+		for (unsigned int w = 0 ; w < m_num_ways ; ++w ) {
+			s.GetVector(m_ways[w].m_valid);
+			s.GetVector(m_ways[w].m_tags);
+			s.GetVector(m_ways[w].m_predictors);
+			s.GetVector(m_ways[w].m_lru);
+		}
+	}
+
 private:
    class Way
    {
@@ -0,0 +1,92 @@
+#ifndef IBTB_H
+#define IBTB_H
+
+#include <vector>
+
+#include "../branch_predictor.h"
+#include "branch_predictor_return_value.h"
+
+// Direct-mapped target buffer for indirect branches, indexed and tagged with
+// the branch address hashed with the path history (PIR): the same branch
+// gets one entry per path, so it can predict several targets. The index
+// folds the whole PIR, so that paths differing only in older branches do
+// not keep evicting each other from one entry.
+class IndirectBranchTargetBuffer
+{
+
+public:
+
+   IndirectBranchTargetBuffer(UINT32 entries, UINT32 tag_bitwidth)
+      : m_index_mask(entries - 1)
+      , m_tag_bitwidth(tag_bitwidth)
+      , m_valid(entries, 0)
+      , m_tags(entries, 0)
+      , m_targets(entries, 0)
+   {}
+
+   BranchPredictorReturnValue lookup(ADDRINT ip, ADDRINT pir)
+   {
+      UINT32 index, tag;
+      BranchPredictorReturnValue ret = { 0, 0, 0, BranchPredictorReturnValue::IndirectBranch };
+
+      gen_index_tag(ip, pir, index, tag);
+
+      if (m_valid[index] && m_tags[index] == tag)
+      {
+         ret.hit = 1;
+         ret.prediction = 1;
+         ret.target = m_targets[index];
+      }
+
+      return ret;
+   }
+
+   // (Re)allocates the entry: the last target seen on this path
+   void update(ADDRINT ip, ADDRINT pir, ADDRINT target)
+   {
+      UINT32 index, tag;
+
+      gen_index_tag(ip, pir, index, tag);
+
+      m_valid[index] = 1;
+      m_tags[index] = tag;
+      m_targets[index] = target;
+   }
+
+   // Tag, valid bit and a 32-bit target per entry
+   UINT64 getStorageBits()
+   {
+      return UINT64(m_targets.size()) * (m_tag_bitwidth + 1 + 32);
+   }
+
+   void saveState(SNAPSHOT_WRITER &s)
+   {
+      s.PutVector(m_valid);
+      s.PutVector(m_tags);
+      s.PutVector(m_targets);
+   }
+
+   void loadState(SNAPSHOT_READER &s)
+   {
+      s.GetVector(m_valid);
+      s.GetVector(m_tags);
+      s.GetVector(m_targets);
+   }
+
+private:
+
+   void gen_index_tag(ADDRINT ip, ADDRINT pir, UINT32& index, UINT32 &tag)
+   {
+      index = ((ip >> 4) ^ pir ^ (pir >> 8)) & m_index_mask;
+      tag = ((ip >> 4) ^ (pir >> 8)) & ((1 << m_tag_bitwidth) - 1);
+   }
+
+   UINT32 m_index_mask;
+   UINT32 m_tag_bitwidth;
+   std::vector<UINT8> m_valid;
+   std::vector<UINT32> m_tags;
+   std::vector<ADDRINT> m_targets;
+
+};
+
+#endif /* IBTB_H */
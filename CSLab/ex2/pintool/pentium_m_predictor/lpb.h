@@ -234,6 +234,36 @@ public:
 
    }
 
+   void saveState(SNAPSHOT_WRITER &s)
+   {
+      s.Put(m_lru_use_count);
+      for (UINT32 w = 0 ; w < m_num_ways ; ++w )
+      {
+         s.PutVector(m_ways[w].m_tags);
+         s.PutVector(m_ways[w].m_previous_actual);
+         s.PutVector(m_ways[w].m_enabled);
+         s.PutVector(m_ways[w].m_predictors);
+         s.PutVector(m_ways[w].m_lru);
+         s.PutVector(m_ways[w].m_count);
+         s.PutVector(m_ways[w].m_limit);
+      }
+   }
+
+   void loadState(SNAPSHOT_READER &s)
+   {
+      s.Get(m_lru_use_count);
+      for (UINT32 w = 0 ; w < m_num_ways ; ++w )
+      {
+         s.GetVector(m_ways[w].m_tags);
+         s.GetVector(m_ways[w].m_previous_actual);
+         s.GetVector(m_ways[w].m_enabled);
+         s.GetVector(m_ways[w].m_predictors);
+         s.GetVector(m_ways[w].m_lru);
+         s.GetVector(m_ways[w].m_count);
+         s.GetVector(m_ways[w].m_limit);
+      }
+   }
+
 private:
 
    class Way
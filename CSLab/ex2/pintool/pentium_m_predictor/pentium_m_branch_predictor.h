@@ -7,6 +7,7 @@
 #include "pentium_m_branch_target_buffer.h"
 #include "pentium_m_bimodal_table.h"
 #include "pentium_m_loop_branch_predictor.h"
+#include "pentium_m_indirect_branch_target_buffer.h"
 
 #include <vector>
 
@@ -19,8 +20,18 @@ public:
 
     virtual bool predict(ADDRINT ip, ADDRINT target);
     virtual void update(bool predicted, bool actual, ADDRINT ip, ADDRINT target);
+    virtual bool predictAndUpdate(ADDRINT ip, ADDRINT target, bool actual);
     virtual string getName()  { return "Pentium-M"; }
 
+    // Indirect jumps and calls: the iBTB predicts the target from the PIR,
+    // which the target then updates, and the BTB its last target when the
+    // iBTB misses. True if the target was predicted.
+    bool predictIndirect(ADDRINT ip, ADDRINT target);
+    UINT64 getIndirectStorageBits() { return m_ibtb.getStorageBits(); }
+
+    virtual void saveState(SNAPSHOT_WRITER &s);
+    virtual void loadState(SNAPSHOT_READER &s);
+
 private:
 
 	void update_pir(bool actual, ADDRINT ip, ADDRINT target,
@@ -31,6 +42,7 @@ private:
 	PentiumMBranchTargetBuffer m_btb;
 	PentiumMBimodalTable m_bimodal_table;
 	PentiumMLoopBranchPredictor m_lpb;
+	PentiumMIndirectBranchTargetBuffer m_ibtb;
 
 	ADDRINT m_pir;
 
@@ -79,11 +91,55 @@ void PentiumMBranchPredictor::update(bool predicted, bool actual,
 	if (predicted != actual)
 		m_global_predictor.update(predicted, actual, ip, target, m_pir);
 
-	// TODO FIXME: Properly propagate the branch type information from the 
-	//             decoder (IndirectBranch information)
+	// Indirect branches update the PIR through predictIndirect()
 	update_pir(actual, ip, target, BranchPredictorReturnValue::ConditionalBranch);
 }
 
+bool PentiumMBranchPredictor::predictIndirect(ADDRINT ip, ADDRINT target)
+{
+	BranchPredictorReturnValue ibtb_out = m_ibtb.lookup(ip, m_pir);
+	BranchPredictorReturnValue btb_out = m_btb.lookup(ip, target);
+	bool btb_correct = btb_out.hit && btb_out.target == target;
+
+	bool correct = ibtb_out.hit ? ibtb_out.target == target : btb_correct;
+
+	// Monomorphic branches stay in the BTB: only those whose last target
+	// mispredicted take iBTB entries
+	if (ibtb_out.hit || !btb_correct)
+		m_ibtb.update(ip, m_pir, target);
+	m_btb.update_target(ip, target);
+	update_pir(true, ip, target, BranchPredictorReturnValue::IndirectBranch);
+	return correct;
+}
+
+bool PentiumMBranchPredictor::predictAndUpdate(ADDRINT ip, ADDRINT target,
+                                               bool actual)
+{
+	bool predicted = PentiumMBranchPredictor::predict(ip, target);
+	PentiumMBranchPredictor::update(predicted, actual, ip, target);
+	return predicted;
+}
+
+void PentiumMBranchPredictor::saveState(SNAPSHOT_WRITER &s)
+{
+	m_global_predictor.saveState(s);
+	m_btb.saveState(s);
+	m_bimodal_table.saveState(s);
+	m_lpb.saveState(s);
+	m_ibtb.saveState(s);
+	s.Put(m_pir);
+}
+
+void PentiumMBranchPredictor::loadState(SNAPSHOT_READER &s)
+{
+	m_global_predictor.loadState(s);
+	m_btb.loadState(s);
+	m_bimodal_table.loadState(s);
+	m_lpb.loadState(s);
+	m_ibtb.loadState(s);
+	s.Get(m_pir);
+}
+
 void PentiumMBranchPredictor::update_pir(bool actual, ADDRINT ip, ADDRINT target,
                             BranchPredictorReturnValue::BranchType branch_type)
 {
@@ -100,4 +156,23 @@ void PentiumMBranchPredictor::update_pir(bool actual, ADDRINT ip, ADDRINT target
 	m_pir = ((m_pir << 2) ^ rhs) & 0x7fff;
 }
 
+// The iBTB of a Pentium-M, reported as an indirect predictor. It is fed
+// through the Pentium-M, whose PIR it shares, and owns nothing.
+class PentiumMIndirectPredictor : public IndirectPredictor
+{
+public:
+	PentiumMIndirectPredictor(PentiumMBranchPredictor *pentium_m)
+	    : IndirectPredictor(), m_pentium_m(pentium_m) {};
+
+	virtual bool predictAndUpdate(ADDRINT ip, ADDRINT target)
+	{
+		return updateCounters(m_pentium_m->predictIndirect(ip, target));
+	}
+	virtual string getName() { return "Pentium-M-iBTB"; }
+	virtual UINT64 getStorageBits() { return m_pentium_m->getIndirectStorageBits(); }
+
+private:
+	PentiumMBranchPredictor *m_pentium_m;
+};
+
 #endif
@@ -24,10 +24,12 @@ class PentiumMBranchTargetBuffer : BranchPredictor
       Way()
          : m_tag_offset(NUM_ENTRIES, 0)
          , m_plru(NUM_ENTRIES, 0)
+         , m_target(NUM_ENTRIES, 0)
       {}
 
       std::vector<UINT32> m_tag_offset; // tag and offset data
       std::vector<UINT64> m_plru; // Should be pseudo-LRU, using LRU instead
+      std::vector<ADDRINT> m_target; // last target, kept for indirect branches
    };
 
 public:
@@ -41,26 +43,65 @@ public:
       return false;
    }
 
+   // On a hit, the target is the last one stored by update_target()
    BranchPredictorReturnValue lookup(ADDRINT ip, ADDRINT target)
    {
-      bool hit = false;
+      BranchPredictorReturnValue ret = { false, false, 0, BranchPredictorReturnValue::InvalidBranch };
       UINT32 tag_offset = IP_TO_TAGOFF(ip);
       UINT32 index = IP_TO_INDEX(ip);
       for (UINT32 i = 0 ; i < NUM_WAYS ; i++)
       {
          if (m_ways[i].m_tag_offset[index] == tag_offset)
          {
-            hit = true;
+            ret.hit = true;
+            ret.target = m_ways[i].m_target[index];
             break;
          }
       }
 
-      BranchPredictorReturnValue ret = { false, hit, 0, BranchPredictorReturnValue::InvalidBranch };
-
       return ret;
    }
 
    virtual void update(bool predicted, bool actual, ADDRINT ip, ADDRINT target)
+   {
+      allocate(ip);
+   }
+
+   // Indirect branches: (re)allocates the entry with the last target
+   void update_target(ADDRINT ip, ADDRINT target)
+   {
+      m_ways[allocate(ip)].m_target[IP_TO_INDEX(ip)] = target;
+   }
+
+   virtual string getName() { return "BTB"; }
+
+   virtual void saveState(SNAPSHOT_WRITER &s)
+   {
+      s.Put(m_lru_use_count);
+      for (UINT32 w = 0 ; w < NUM_WAYS ; w++)
+      {
+         s.PutVector(m_ways[w].m_tag_offset);
+         s.PutVector(m_ways[w].m_plru);
+         s.PutVector(m_ways[w].m_target);
+      }
+   }
+
+   virtual void loadState(SNAPSHOT_READER &s)
+   {
+      s.Get(m_lru_use_count);
+      for (UINT32 w = 0 ; w < NUM_WAYS ; w++)
+      {
+         s.GetVector(m_ways[w].m_tag_offset);
+         s.GetVector(m_ways[w].m_plru);
+         s.GetVector(m_ways[w].m_target);
+      }
+   }
+private:
+   std::vector<Way> m_ways;
+   UINT64 m_lru_use_count;
+
+   // The way of `ip`, allocated in the LRU way on a miss
+   UINT32 allocate(ADDRINT ip)
    {
       // Start with way 0 as the least recently used
       UINT32 lru_way = 0;
@@ -74,7 +115,7 @@ public:
             m_ways[w].m_plru[index] = m_lru_use_count++;
             // Once we have a tag match and have updated the LRU information,
             // we can return
-            return;
+            return w;
          }
 
          // Keep track of the LRU in case we do not have a tag match
@@ -89,13 +130,10 @@ public:
       // appropriately
       m_ways[lru_way].m_tag_offset[index] = tag_offset;
       m_ways[lru_way].m_plru[index] = m_lru_use_count++;
+      m_ways[lru_way].m_target[index] = 0;
+      return lru_way;
    }
 
-   virtual string getName() { return "BTB"; }
-private:
-   std::vector<Way> m_ways;
-   UINT64 m_lru_use_count;
-
 };
 
 #endif /* PENTIUM_M_BRANCH_TARGET_BUFFER_H */
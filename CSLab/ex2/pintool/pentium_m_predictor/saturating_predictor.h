@@ -21,7 +21,7 @@ class SaturatingPredictor {
 
 public:
 
-   SaturatingPredictor(UINT32 initial_value)
+   SaturatingPredictor(UINT32 initial_value = 0)
    {
       m_counter = initial_value;
    }
@@ -42,6 +42,9 @@ public:
 
    virtual string getName() { return "SimpleBimodal"; }
 
+   virtual void saveState(SNAPSHOT_WRITER &s) { s.PutVector(m_table); }
+   virtual void loadState(SNAPSHOT_READER &s) { s.GetVector(m_table); }
+
    void reset()
    {
       for (unsigned int i = 0 ; i < m_num_entries ; i++) {
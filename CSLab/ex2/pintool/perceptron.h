@@ -0,0 +1,211 @@
+#ifndef PERCEPTRON_H
+#define PERCEPTRON_H
+
+#include <sstream>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "branch_predictor.h"
+
+/**
+ * Hashed perceptron: the global history is cut into `numTables` segments of
+ * 16 outcomes, and table i holds rows of 16 int8 weights, one per outcome of
+ * segment i. Table 0 is indexed by the branch address and table i by the
+ * address hashed with the i more recent segments, so each row sees its
+ * segment in one context. The prediction is the sign of a per-address bias
+ * plus the sum over the tables of w * (taken ? 1 : -1).
+ *
+ * Training happens on a misprediction or when |sum| is not above theta,
+ * which adapts as in O-GEHL: a 7-bit counter goes up on mispredictions and
+ * down on correct low-confidence predictions, and moves theta when it
+ * saturates.
+ *
+ * A row is 16 bytes, so both the sum and the update are one SSE2 operation
+ * per table; without SSE2 the same arithmetic is done lane by lane.
+ **/
+class HashedPerceptron : public BranchPredictor {
+
+public:
+    static const unsigned SEGMENT = 16;
+
+    HashedPerceptron(unsigned numTables_, unsigned logEntries_)
+        : BranchPredictor(), numTables(numTables_), logEntries(logEntries_),
+          segments(numTables_, 0), rows(numTables_) {
+        weights.assign(size_t(numTables) * SEGMENT << logEntries, 0);
+        bias.assign(size_t(1) << (logEntries + 2), 0);
+        theta = int(1.93 * numTables * SEGMENT + 14);
+        thetaCounter = 0;
+    }
+
+    virtual bool predict(ADDRINT ip, ADDRINT target) {
+        lookup(ip);
+        return sum >= 0;
+    }
+
+    virtual void update(bool predicted, bool actual, ADDRINT ip, ADDRINT target) {
+        train(ip, actual);
+        updateCounters(predicted, actual);
+    }
+
+    virtual bool predictAndUpdate(ADDRINT ip, ADDRINT target, bool actual) {
+        lookup(ip);
+        bool predicted = sum >= 0;
+        train(ip, actual);
+        updateCounters(predicted, actual);
+        return predicted;
+    }
+
+    virtual string getName() {
+        std::ostringstream stream;
+        stream << "HashedPerceptron-" << numTables << "x"
+               << double(1 << logEntries) / 1024.0 << "K-"
+               << numTables * SEGMENT;
+        return stream.str();
+    }
+
+    // int8 weights, the history and the 7-bit threshold counter
+    virtual UINT64 getStorageBits() {
+        return UINT64(weights.size() + bias.size()) * 8 +
+               numTables * SEGMENT + 7;
+    }
+
+    virtual void saveState(SNAPSHOT_WRITER &s) {
+        s.PutVector(weights);
+        s.PutVector(bias);
+        s.PutVector(segments);
+        s.Put(theta);
+        s.Put(thetaCounter);
+    }
+
+    virtual void loadState(SNAPSHOT_READER &s) {
+        s.GetVector(weights);
+        s.GetVector(bias);
+        s.GetVector(segments);
+        s.Get(theta);
+        s.Get(thetaCounter);
+    }
+
+private:
+    unsigned numTables, logEntries;
+
+    std::vector<INT8> weights; /* table-major, SEGMENT weights per row */
+    std::vector<INT8> bias;
+    std::vector<UINT16> segments; /* segments[0] holds the last 16 outcomes */
+    INT32 theta, thetaCounter;
+
+    /* Lookup results, kept for the update */
+    std::vector<INT8 *> rows;
+    INT32 sum;
+
+    unsigned biasIndex(ADDRINT ip) {
+        return ip & (bias.size() - 1);
+    }
+
+    void lookup(ADDRINT ip) {
+        UINT32 mask = (1U << logEntries) - 1;
+        UINT32 h = UINT32(ip ^ (ip >> logEntries));
+        for (unsigned i = 0; i < numTables; i++) {
+            if (i > 0)
+                h = (h << 3 | h >> 29) ^ segments[i - 1] ^ (i << 16);
+            rows[i] = &weights[(size_t(i) << logEntries | (h & mask)) * SEGMENT];
+        }
+        sum = bias[biasIndex(ip)] + dot();
+    }
+
+    void train(ADDRINT ip, bool taken) {
+        bool mispredicted = (sum >= 0) != taken;
+        INT32 magnitude = sum < 0 ? -sum : sum;
+
+        if (mispredicted || magnitude <= theta) {
+            INT8 &b = bias[biasIndex(ip)];
+            if (taken && b < 127)
+                b++;
+            else if (!taken && b > -128)
+                b--;
+            for (unsigned i = 0; i < numTables; i++)
+                trainRow(rows[i], segments[i], taken);
+        }
+
+        if (mispredicted) {
+            if (++thetaCounter == 63) {
+                theta++;
+                thetaCounter = 0;
+            }
+        } else if (magnitude <= theta) {
+            if (--thetaCounter == -64) {
+                theta--;
+                thetaCounter = 0;
+            }
+        }
+
+        /* Shift the outcome in, each segment passing its oldest to the next */
+        UINT16 carry = taken;
+        for (unsigned i = 0; i < numTables; i++) {
+            UINT16 out = segments[i] >> (SEGMENT - 1);
+            segments[i] = UINT16(segments[i] << 1 | carry);
+            carry = out;
+        }
+    }
+
+#ifdef __SSE2__
+    /* 0xFF in lane j if bit j of the segment is set */
+    static __m128i expand(UINT16 segment) {
+        const __m128i select = _mm_set_epi8(
+            -128, 64, 32, 16, 8, 4, 2, 1, -128, 64, 32, 16, 8, 4, 2, 1);
+        __m128i bytes = _mm_set_epi8(
+            segment >> 8, segment >> 8, segment >> 8, segment >> 8,
+            segment >> 8, segment >> 8, segment >> 8, segment >> 8,
+            segment, segment, segment, segment,
+            segment, segment, segment, segment);
+        return _mm_cmpeq_epi8(_mm_and_si128(bytes, select), select);
+    }
+
+    /* Sum of the rows, each weight negated (saturating) for a not taken */
+    INT32 dot() {
+        const __m128i bias128 = _mm_set1_epi8(-128);
+        __m128i total = _mm_setzero_si128();
+        for (unsigned i = 0; i < numTables; i++) {
+            __m128i w = _mm_loadu_si128((const __m128i *)rows[i]);
+            __m128i notTaken = _mm_xor_si128(expand(segments[i]),
+                                             _mm_set1_epi8(-1));
+            __m128i x = _mm_subs_epi8(_mm_xor_si128(w, notTaken), notTaken);
+            /* Offset to unsigned and add the lanes up with a SAD */
+            x = _mm_xor_si128(x, bias128);
+            total = _mm_add_epi64(total, _mm_sad_epu8(x, _mm_setzero_si128()));
+        }
+        total = _mm_add_epi64(total, _mm_srli_si128(total, 8));
+        return _mm_cvtsi128_si32(total) - INT32(numTables * SEGMENT * 128);
+    }
+
+    /* Saturating +1 on the weights agreeing with the outcome, -1 elsewhere */
+    static void trainRow(INT8 *row, UINT16 segment, bool taken) {
+        __m128i agree = expand(taken ? segment : UINT16(~segment));
+        __m128i delta = _mm_sub_epi8(_mm_and_si128(agree, _mm_set1_epi8(2)),
+                                     _mm_set1_epi8(1));
+        __m128i w = _mm_loadu_si128((const __m128i *)row);
+        _mm_storeu_si128((__m128i *)row, _mm_adds_epi8(w, delta));
+    }
+#else
+    INT32 dot() {
+        INT32 total = 0;
+        for (unsigned i = 0; i < numTables; i++)
+            for (unsigned j = 0; j < SEGMENT; j++) {
+                INT32 w = rows[i][j];
+                total += (segments[i] >> j & 1) ? w : (w == -128 ? 127 : -w);
+            }
+        return total;
+    }
+
+    static void trainRow(INT8 *row, UINT16 segment, bool taken) {
+        for (unsigned j = 0; j < SEGMENT; j++) {
+            INT32 w = row[j] + (bool(segment >> j & 1) == taken ? 1 : -1);
+            row[j] = INT8(w > 127 ? 127 : (w < -128 ? -128 : w));
+        }
+    }
+#endif
+};
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef PREDICTOR_BANK_H
+#define PREDICTOR_BANK_H
+
+#include <vector>
+
+#include "branch_kind.h"
+#include "branch_predictor.h"
+#include "btb.h"
+#include "corrector.h"
+#include "global_predictors.h"
+#include "ittage.h"
+#include "pentium_m_predictor/pentium_m_branch_predictor.h"
+#include "perceptron.h"
+#include "ras.h"
+#include "tage.h"
+
+/**
+ * The predictors of one concrete type. Calls are qualified with the type, so
+ * they are bound statically (and inlined) instead of going through the
+ * vtable. P must be the exact type of the members: a subclass of P added
+ * here would run P's code.
+ **/
+template <class P> class PredictorGroup {
+  public:
+    void add(P *predictor) { members.push_back(predictor); }
+
+    void predictAndUpdate(ADDRINT ip, ADDRINT target, bool actual) {
+        for (size_t i = 0; i < members.size(); i++)
+            members[i]->P::predictAndUpdate(ip, target, actual);
+    }
+
+  private:
+    std::vector<P *> members;
+};
+
+// Predictors of a type the bank does not know: one virtual call each
+template <>
+inline void PredictorGroup<BranchPredictor>::predictAndUpdate(ADDRINT ip,
+                                                              ADDRINT target,
+                                                              bool actual) {
+    for (size_t i = 0; i < members.size(); i++)
+        members[i]->predictAndUpdate(ip, target, actual);
+}
+
+/**
+ * All the simulated direction predictors, BTBs and RASes, with the
+ * predictors grouped by their concrete type. add() picks the group from the
+ * static type of its argument, so predictors must be added through a pointer
+ * to their own class. Every predictor is fed exactly as the
+ * predict()/update() pair would feed it.
+ **/
+class PredictorBank {
+  public:
+    void add(StaticTaken *p) { staticTaken.add(p); }
+    void add(BTFNT *p) { btfnt.add(p); }
+    void add(NbitPredictor *p) { nbit.add(p); }
+    void add(PentiumMBranchPredictor *p) { pentiumM.add(p); }
+    void add(LocalHistoryTwoLevel *p) { local.add(p); }
+    void add(GlobalHistoryTwoLevel *p) { global.add(p); }
+    void add(TournamentLocalNbit *p) { tournamentLocal.add(p); }
+    void add(TournamentGlobalNbit *p) { tournamentGlobal.add(p); }
+    void add(GsharePredictor *p) { gshare.add(p); }
+    void add(BiModePredictor *p) { biMode.add(p); }
+    void add(YAGSPredictor *p) { yags.add(p); }
+    void add(AgreePredictor *p) { agree.add(p); }
+    void add(TAGEPredictor *p) { tage.add(p); }
+    void add(HashedPerceptron *p) { perceptron.add(p); }
+    void add(CorrectedPredictor *p) { corrected.add(p); }
+    void add(BranchPredictor *p) { others.add(p); }
+
+    void add(BTBPredictor *p) { btbs.push_back(p); }
+    void add(RAS *r) { rases.add(r); }
+    void add(IndirectPredictor *p) { indirects.push_back(p); }
+
+    // One branch of the given kind (BRANCH_* flags)
+    void branch(UINT32 kind, ADDRINT ip, ADDRINT target, bool taken,
+                UINT32 ins_size) {
+        if (kind & BRANCH_CONDITIONAL)
+            predictDirection(ip, target, taken);
+        if (kind & BRANCH_BTB)
+            predictTarget(ip, target, taken, kind);
+        if (kind & BRANCH_INDIRECT)
+            predictIndirect(ip, target);
+        if (kind & BRANCH_CALL)
+            rases.push_addr(ip + ins_size);
+        else if (kind & BRANCH_RET)
+            rases.pop_addr(target);
+    }
+
+    // Conditional branches
+    void predictDirection(ADDRINT ip, ADDRINT target, bool taken) {
+        staticTaken.predictAndUpdate(ip, target, taken);
+        btfnt.predictAndUpdate(ip, target, taken);
+        nbit.predictAndUpdate(ip, target, taken);
+        pentiumM.predictAndUpdate(ip, target, taken);
+        local.predictAndUpdate(ip, target, taken);
+        global.predictAndUpdate(ip, target, taken);
+        tournamentLocal.predictAndUpdate(ip, target, taken);
+        tournamentGlobal.predictAndUpdate(ip, target, taken);
+        gshare.predictAndUpdate(ip, target, taken);
+        biMode.predictAndUpdate(ip, target, taken);
+        yags.predictAndUpdate(ip, target, taken);
+        agree.predictAndUpdate(ip, target, taken);
+        tage.predictAndUpdate(ip, target, taken);
+        perceptron.predictAndUpdate(ip, target, taken);
+        corrected.predictAndUpdate(ip, target, taken);
+        others.predictAndUpdate(ip, target, taken);
+        for (size_t i = 0; i < indirects.size(); i++)
+            indirects[i]->conditional(ip, taken);
+    }
+
+    // All branches but returns
+    void predictTarget(ADDRINT ip, ADDRINT target, bool taken,
+                       UINT32 kind = 0) {
+        for (size_t i = 0; i < btbs.size(); i++)
+            btbs[i]->BTBPredictor::predictAndUpdate(ip, target, taken, kind);
+    }
+
+    // Indirect jumps and calls, few enough for virtual calls
+    void predictIndirect(ADDRINT ip, ADDRINT target) {
+        for (size_t i = 0; i < indirects.size(); i++)
+            indirects[i]->predictAndUpdate(ip, target);
+    }
+
+  private:
+    PredictorGroup<StaticTaken> staticTaken;
+    PredictorGroup<BTFNT> btfnt;
+    PredictorGroup<NbitPredictor> nbit;
+    PredictorGroup<PentiumMBranchPredictor> pentiumM;
+    PredictorGroup<LocalHistoryTwoLevel> local;
+    PredictorGroup<GlobalHistoryTwoLevel> global;
+    PredictorGroup<TournamentLocalNbit> tournamentLocal;
+    PredictorGroup<TournamentGlobalNbit> tournamentGlobal;
+    PredictorGroup<GsharePredictor> gshare;
+    PredictorGroup<BiModePredictor> biMode;
+    PredictorGroup<YAGSPredictor> yags;
+    PredictorGroup<AgreePredictor> agree;
+    PredictorGroup<TAGEPredictor> tage;
+    PredictorGroup<HashedPerceptron> perceptron;
+    PredictorGroup<CorrectedPredictor> corrected;
+    PredictorGroup<BranchPredictor> others;
+
+    std::vector<BTBPredictor *> btbs;
+    RASGroup rases;
+    std::vector<IndirectPredictor *> indirects;
+};
+
+#endif
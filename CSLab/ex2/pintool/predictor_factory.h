@@ -0,0 +1,434 @@
+#ifndef PREDICTOR_FACTORY_H
+#define PREDICTOR_FACTORY_H
+
+#include <cstdlib> // strtoul()
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../../common/stats_writer.h"
+#include "predictor_bank.h"
+
+/**
+ * The predictors, BTBs and RASes of a run, created from specs of the form
+ * "name:arg:arg...":
+ *
+ *   static-taken
+ *   btfnt
+ *   nbit:<index bits>:<counter bits>
+ *   pentium-m
+ *   local:<PHT index bits>:<PHT counter bits>:<BHT index bits>:<BHT bits>
+ *   global:<PHT index bits>:<PHT counter bits>:<BHR bits>
+ *   tournament-local:<meta index>:<meta cntr>:<nbit args (2)>:<local args (4)>
+ *   tournament-global:<meta index>:<meta cntr>:<nbit args (2)>:<global (3)>
+ *   gselect:<index bits>:<history length>:<counter bits>
+ *   gshare, bimode, yags, agree: same arguments as gselect
+ *   tage:<tagged tables>:<log2 entries per table>:<min history>:<max history>
+ *     (up to 16 tables of up to 2^20 entries, up to 65536 outcomes)
+ *   perceptron:<tables (16 history bits each)>:<log2 rows per table>
+ *     (up to 16 tables of up to 2^20 rows)
+ *   ittage:<tagged tables>:<log2 entries per table>:<min history>:<max history>
+ *     (bounded as tage)
+ *   btb:<lines>:<associativity>
+ *   btb:<L0 lines>:<L0 assoc>:<L0 latency>:<L1 (3)>[:<L2 (3)>]
+ *   ras:<entries>[:<repeat counter bits, up to 16>]
+ *
+ * A direction predictor spec may be followed by "+sc[:<log2 entries>]"
+ * (default 10) and/or "+loop[:<log2 entries>]" (default 6) to compose a
+ * statistical corrector and/or a loop predictor over it, e.g.
+ * "tage:7:10:4:640+sc+loop" (see corrector.h).
+ *
+ * pentium-m also adds its iBTB to the indirect predictors.
+ *
+ * The vectors keep the order of creation, used for reporting and
+ * checkpoints. Each structure is also added to one of `numShards` banks,
+ * round robin, so that shards can be fed by different threads.
+ **/
+class PredictorSet {
+  public:
+    PredictorSet(unsigned numShards = 1)
+        : banks(numShards), next(0), rasBank(-1), scLogEntries(0),
+          loopLogEntries(0) {}
+
+    ~PredictorSet() {
+        for (size_t i = 0; i < predictors.size(); i++)
+            delete predictors[i];
+        for (size_t i = 0; i < btbs.size(); i++)
+            delete btbs[i];
+        for (size_t i = 0; i < ras.size(); i++)
+            delete ras[i];
+        for (size_t i = 0; i < indirects.size(); i++)
+            delete indirects[i];
+    }
+
+    // False if the spec names no known structure or has the wrong arguments
+    bool add(const string &spec) {
+        size_t plus = spec.find('+');
+        if (plus != string::npos && !parseCorrections(spec.substr(plus + 1)))
+            return false;
+
+        std::vector<unsigned> a;
+        string name = parse(spec.substr(0, plus), a);
+
+        if ((scLogEntries || loopLogEntries) &&
+            (name == "btb" || name == "ras" || name == "ittage"))
+            name = "";
+
+        if (name == "static-taken" && a.size() == 0)
+            addPredictor(new StaticTaken());
+        else if (name == "btfnt" && a.size() == 0)
+            addPredictor(new BTFNT());
+        else if (name == "nbit" && a.size() == 2)
+            addPredictor(new NbitPredictor(a[0], a[1]));
+        else if (name == "pentium-m" && a.size() == 0)
+            addPentiumM(new PentiumMBranchPredictor());
+        else if (name == "local" && a.size() == 4)
+            addPredictor(new LocalHistoryTwoLevel(a[0], a[1], a[2], a[3]));
+        else if (name == "global" && a.size() == 3)
+            addPredictor(new GlobalHistoryTwoLevel(a[0], a[1], a[2]));
+        else if (name == "tournament-local" && a.size() == 8)
+            addPredictor(new TournamentLocalNbit(a[0], a[1], a[2], a[3], a[4],
+                                                 a[5], a[6], a[7]));
+        else if (name == "tournament-global" && a.size() == 7)
+            addPredictor(new TournamentGlobalNbit(a[0], a[1], a[2], a[3],
+                                                  a[4], a[5], a[6]));
+        else if (name == "gselect" && a.size() == 3 && a[1] <= a[0])
+            addPredictor(new GlobalHistoryTwoLevel(a[0], a[2], a[1]));
+        else if (isGlobalHashed(name) && a.size() == 3 && a[0] > 0 &&
+                 a[0] <= 24 && a[1] <= 64 && a[2] > 0 && a[2] <= 8)
+            addGlobalHashed(name, a[0], a[1], a[2]);
+        else if (name == "tage" && validTagged(a))
+            addPredictor(new TAGEPredictor(a[0], a[1], a[2], a[3]));
+        else if (name == "perceptron" && a.size() == 2 && a[0] > 0 &&
+                 a[0] <= 16 && a[1] > 0 && a[1] <= 20)
+            addPredictor(new HashedPerceptron(a[0], a[1]));
+        else if (name == "ittage" && validTagged(a))
+            addIndirect(new ITTAGEPredictor(a[0], a[1], a[2], a[3]),
+                        nextBank());
+        else if (name == "btb" && (a.size() == 2 || a.size() == 6 ||
+                                   a.size() == 9) && validBTB(a))
+            addBTB(a);
+        else if (name == "ras" && (a.size() == 1 || a.size() == 2) &&
+                 a[0] > 0 && (a.size() == 1 || a[1] <= 16))
+            addRas(new RAS(a[0], a.size() > 1 ? a[1] : 0));
+        else
+            name = "";
+
+        scLogEntries = loopLogEntries = 0;
+        return !name.empty();
+    }
+
+    // The set simulated when no specs are given
+    static std::vector<string> defaultSpecs() {
+        /* 4.2 - 4.3 - 4.4: nbit:14:1 ... nbit:14:7, nbit:15:1, nbit:14:2,
+         * nbit:13:4 and btb:512:1, btb:256:2, btb:128:4, btb:64:8 */
+
+        /* 4.5 */
+        static const char *specs[] = {
+            "static-taken",
+            "btfnt",
+            "nbit:13:4",
+            "pentium-m",
+            "local:13:2:11:8",
+            "local:13:2:12:4",
+            "global:14:2:4",
+            "global:14:2:8",
+            "global:13:4:4",
+            "global:13:4:8",
+            "tournament-local:9:2:12:4:12:2:11:4",
+            "tournament-local:9:2:13:2:11:4:11:4",
+            "tournament-global:9:2:12:4:13:2:4",
+            "tournament-global:9:2:13:2:13:2:4",
+            "ras:1",
+            "ras:2",
+            "ras:4",
+            "ras:16",
+            "ras:64",
+            "ras:128"};
+
+        return std::vector<string>(specs,
+                                   specs + sizeof(specs) / sizeof(specs[0]));
+    }
+
+    void addDefaults() {
+        std::vector<string> specs = defaultSpecs();
+        for (size_t i = 0; i < specs.size(); i++)
+            add(specs[i]);
+    }
+
+    unsigned numShards() { return banks.size(); }
+    PredictorBank &bank(unsigned shard = 0) { return banks[shard]; }
+
+    VOID printStats(std::ostream &out, UINT64 total_instructions) {
+        // Report total instructions and total cycles
+        out << "Total Instructions: " << total_instructions << "\n";
+        out << "\n";
+
+        out << "RAS: (Correct - Incorrect)\n";
+        for (size_t i = 0; i < ras.size(); i++)
+            out << ras[i]->getNameAndStats() << "\n";
+        out << "\n";
+
+        out << "Branch Predictors: (Name - Correct - Incorrect)\n";
+        for (size_t i = 0; i < predictors.size(); i++)
+            out << "  " << predictorNames[i] << ": "
+                << predictors[i]->getNumCorrectPredictions() << " "
+                << predictors[i]->getNumIncorrectPredictions() << "\n";
+        out << "\n";
+
+        out << "BTB Predictors: (Name - Correct - Incorrect - TargetCorrect)\n";
+        for (size_t i = 0; i < btbs.size(); i++)
+            out << "  " << btbNames[i] << ": "
+                << btbs[i]->getNumCorrectPredictions() << " "
+                << btbs[i]->getNumIncorrectPredictions() << " "
+                << btbs[i]->getNumCorrectTargetPredictions() << "\n";
+
+        bool hierarchies = false;
+        for (size_t i = 0; i < btbs.size(); i++)
+            hierarchies |= btbs[i]->getNumLevels() > 1;
+        if (hierarchies) {
+            out << "\n";
+            out << "BTB Hierarchies: (Name - Hits per level - Bubbles)\n";
+            for (size_t i = 0; i < btbs.size(); i++) {
+                if (btbs[i]->getNumLevels() < 2)
+                    continue;
+                out << "  " << btbNames[i] << ":";
+                for (unsigned l = 0; l < btbs[i]->getNumLevels(); l++)
+                    out << " " << btbs[i]->getLevelHits(l);
+                out << " " << btbs[i]->getBubbles() << "\n";
+            }
+        }
+
+        if (!indirects.empty()) {
+            out << "\n";
+            out << "Indirect Predictors: (Name - Correct - Incorrect - MPKI)\n";
+            for (size_t i = 0; i < indirects.size(); i++)
+                out << "  " << indirectNames[i] << ": "
+                    << indirects[i]->getNumCorrectPredictions() << " "
+                    << indirects[i]->getNumIncorrectPredictions() << " "
+                    << fltstr(mpki(indirects[i], total_instructions), 3)
+                    << "\n";
+        }
+
+        out << "\n";
+        out << "Predictor Storage: (Name - KB)\n";
+        for (size_t i = 0; i < predictors.size(); i++)
+            if (predictors[i]->getStorageBits())
+                out << "  " << predictorNames[i] << ": "
+                    << fltstr(predictors[i]->getStorageBits() / 8192.0, 2)
+                    << "\n";
+        for (size_t i = 0; i < indirects.size(); i++)
+            out << "  " << indirectNames[i] << ": "
+                << fltstr(indirects[i]->getStorageBits() / 8192.0, 2) << "\n";
+    }
+
+    VOID exportStats(STATS_WRITER &w, UINT64 total_instructions) {
+        w.Add("", "Total-Instructions", total_instructions);
+        for (size_t i = 0; i < ras.size(); i++) {
+            w.Add(rasNames[i].c_str(), "Correct", ras[i]->getNumCorrect());
+            w.Add(rasNames[i].c_str(), "Incorrect", ras[i]->getNumIncorrect());
+        }
+        for (size_t i = 0; i < predictors.size(); i++) {
+            BranchPredictor *bp = predictors[i];
+            w.Add(predictorNames[i].c_str(), "Correct",
+                  bp->getNumCorrectPredictions());
+            w.Add(predictorNames[i].c_str(), "Incorrect",
+                  bp->getNumIncorrectPredictions());
+            w.Add(predictorNames[i].c_str(), "Storage-Bits",
+                  bp->getStorageBits());
+        }
+        for (size_t i = 0; i < btbs.size(); i++) {
+            BTBPredictor *btb = btbs[i];
+            w.Add(btbNames[i].c_str(), "Correct",
+                  btb->getNumCorrectPredictions());
+            w.Add(btbNames[i].c_str(), "Incorrect",
+                  btb->getNumIncorrectPredictions());
+            w.Add(btbNames[i].c_str(), "TargetCorrect",
+                  btb->getNumCorrectTargetPredictions());
+            if (btb->getNumLevels() < 2)
+                continue;
+            // The writer keeps the field pointers: up to 3 levels (see add())
+            static const char *levelFields[] = {"L0-Hits", "L1-Hits",
+                                                "L2-Hits"};
+            for (unsigned l = 0; l < btb->getNumLevels(); l++)
+                w.Add(btbNames[i].c_str(), levelFields[l],
+                      btb->getLevelHits(l));
+            w.Add(btbNames[i].c_str(), "Bubbles", btb->getBubbles());
+        }
+        for (size_t i = 0; i < indirects.size(); i++) {
+            IndirectPredictor *ip = indirects[i];
+            w.Add(indirectNames[i].c_str(), "Correct",
+                  ip->getNumCorrectPredictions());
+            w.Add(indirectNames[i].c_str(), "Incorrect",
+                  ip->getNumIncorrectPredictions());
+            w.Add(indirectNames[i].c_str(), "MPKI",
+                  mpki(ip, total_instructions));
+            w.Add(indirectNames[i].c_str(), "Storage-Bits",
+                  ip->getStorageBits());
+        }
+    }
+
+    std::vector<BranchPredictor *> predictors;
+    std::vector<BTBPredictor *> btbs;
+    std::vector<RAS *> ras;
+    std::vector<IndirectPredictor *> indirects;
+
+    //> Names used as column groups for structured output, computed once
+    std::vector<string> predictorNames, btbNames, rasNames, indirectNames;
+
+  private:
+    std::vector<PredictorBank> banks;
+    unsigned next;
+    int rasBank; /* the bank of all the RASes, -1 before the first one */
+
+    //> Corrections requested by the spec being added, 0 for none
+    unsigned scLogEntries, loopLogEntries;
+
+    PredictorBank &nextBank() { return banks[next++ % banks.size()]; }
+
+    // The bank needs the concrete type of the predictor
+    template <class P> PredictorBank &addPredictor(P *p) {
+        if (scLogEntries || loopLogEntries) {
+            CorrectedPredictor *c =
+                new CorrectedPredictor(p, scLogEntries, loopLogEntries);
+            scLogEntries = loopLogEntries = 0;
+            return addPredictor(c);
+        }
+        predictors.push_back(p);
+        predictorNames.push_back(p->getName());
+        PredictorBank &bank = nextBank();
+        bank.add(p);
+        return bank;
+    }
+
+    // The iBTB shares the PIR of its Pentium-M, so it goes in the same bank
+    void addPentiumM(PentiumMBranchPredictor *p) {
+        PredictorBank &bank = addPredictor(p);
+        addIndirect(new PentiumMIndirectPredictor(p), bank);
+    }
+
+    void addIndirect(IndirectPredictor *p, PredictorBank &bank) {
+        indirects.push_back(p);
+        indirectNames.push_back(p->getName());
+        bank.add(p);
+    }
+
+    static double mpki(IndirectPredictor *p, UINT64 total_instructions) {
+        return total_instructions
+                   ? p->getNumIncorrectPredictions() * 1000.0 / total_instructions
+                   : 0.0;
+    }
+
+    static bool isGlobalHashed(const string &name) {
+        return name == "gshare" || name == "bimode" || name == "yags" ||
+               name == "agree";
+    }
+
+    // <tables>:<log2 entries>:<min history>:<max history> of a TAGE-like
+    // predictor, bounded so that its masks and allocations stay valid
+    static bool validTagged(const std::vector<unsigned> &a) {
+        return a.size() == 4 && a[0] > 0 && a[0] <= 16 && a[1] > 0 &&
+               a[1] <= 20 && a[2] > 0 && a[2] <= a[3] && a[3] <= 65536;
+    }
+
+    void addGlobalHashed(const string &name, unsigned index, unsigned history,
+                         unsigned cntr) {
+        if (name == "gshare")
+            addPredictor(new GsharePredictor(index, history, cntr));
+        else if (name == "bimode")
+            addPredictor(new BiModePredictor(index, history, cntr));
+        else if (name == "yags")
+            addPredictor(new YAGSPredictor(index, history, cntr));
+        else
+            addPredictor(new AgreePredictor(index, history, cntr));
+    }
+
+    // Powers of 2, up to 64 ways
+    static bool validBTB(const std::vector<unsigned> &a) {
+        for (size_t i = 0; i < a.size(); i++) {
+            bool geometry = a.size() == 2 || i % 3 != 2;
+            if (geometry && (a[i] == 0 || (a[i] & (a[i] - 1)) != 0))
+                return false;
+            if (geometry && i % (a.size() == 2 ? 2 : 3) == 1 && a[i] > 64)
+                return false;
+        }
+        return true;
+    }
+
+    void addBTB(const std::vector<unsigned> &a) {
+        BTBPredictor *btb =
+            new BTBPredictor(a[0], a[1], a.size() > 2 ? a[2] : 0);
+        for (size_t i = 3; i < a.size(); i += 3)
+            btb->addLevel(a[i], a[i + 1], a[i + 2]);
+        addBTB(btb);
+    }
+
+    void addBTB(BTBPredictor *btb) {
+        btbs.push_back(btb);
+        btbNames.push_back(btb->getName());
+        nextBank().add(btb);
+    }
+
+    // All in one bank, whose RASGroup updates them together
+    void addRas(RAS *r) {
+        std::ostringstream stream;
+        stream << "RAS-" << r->getNumEntries();
+        if (r->getRepeatBits())
+            stream << "-R" << r->getRepeatBits();
+        ras.push_back(r);
+        rasNames.push_back(stream.str());
+        if (rasBank < 0)
+            rasBank = next++ % banks.size();
+        banks[rasBank].add(r);
+    }
+
+    // Parses "sc[:n]+loop[:n]" into the pending corrections
+    bool parseCorrections(const string &spec) {
+        size_t start = 0;
+        for (;;) {
+            size_t plus = spec.find('+', start);
+            std::vector<unsigned> a;
+            string name = parse(spec.substr(start, plus == string::npos
+                                                       ? string::npos
+                                                       : plus - start),
+                                a);
+            if (name == "sc" && a.size() <= 1)
+                scLogEntries = a.empty() ? 10 : a[0];
+            else if (name == "loop" && a.size() <= 1)
+                loopLogEntries = a.empty() ? 6 : a[0];
+            else
+                break;
+            if (scLogEntries > 20 || (loopLogEntries &&
+                                      (loopLogEntries < 2 || loopLogEntries > 16)))
+                break;
+            if (plus == string::npos)
+                return scLogEntries || loopLogEntries;
+            start = plus + 1;
+        }
+        scLogEntries = loopLogEntries = 0;
+        return false;
+    }
+
+    // Splits "name:arg:arg..."; a malformed argument empties the name
+    static string parse(const string &spec, std::vector<unsigned> &args) {
+        size_t colon = spec.find(':');
+        string name = spec.substr(0, colon);
+
+        while (colon != string::npos) {
+            size_t start = colon + 1;
+            colon = spec.find(':', start);
+            string arg = spec.substr(start, colon == string::npos
+                                                ? string::npos
+                                                : colon - start);
+            char *end;
+            unsigned long value = strtoul(arg.c_str(), &end, 10);
+            if (arg.empty() || *end != '\0')
+                return "";
+            args.push_back(value);
+        }
+        return name;
+    }
+};
+
+#endif
@@ -1,47 +1,282 @@
 #ifndef RAS_H
 #define RAS_H
 
+#include <sstream>
 #include <vector>
 
-class RAS {
+#include "../../common/snapshot.h"
+
+/**
+ * Circular buffer of return addresses, each with a repeat count. Only the
+ * top is tracked here: how many entries below it are valid is up to each
+ * RAS using the buffer.
+ **/
+class ReturnStack {
   public:
-    RAS(UINT32 num_entries)
-        : max_entries(num_entries), correct(0), incorrect(0){};
-    ~RAS(){};
+    ReturnStack(UINT32 capacity) : addrs(capacity, 0), repeats(capacity, 0),
+                                   top(0) {}
 
-    void push_addr(ADDRINT addr) {
-        addr_vec.push_back(addr);
-        if (addr_vec.size() > max_entries)
-            addr_vec.erase(addr_vec.begin());
+    void resize(UINT32 capacity) {
+        addrs.assign(capacity, 0);
+        repeats.assign(capacity, 0);
+        top = 0;
     }
 
-    void pop_addr(ADDRINT target) {
-        if (addr_vec.empty()) {
-            incorrect++;
+    // Overwrites the oldest entry once full
+    void push(ADDRINT addr) {
+        if (++top == addrs.size())
+            top = 0;
+        addrs[top] = addr;
+        repeats[top] = 0;
+    }
+
+    void pop() { top = (top ? top : addrs.size()) - 1; }
+
+    // Position of the entry `n` below the top
+    UINT32 below(UINT32 n) const {
+        return (top + addrs.size() - n % addrs.size()) % addrs.size();
+    }
+
+    std::vector<ADDRINT> addrs;
+    std::vector<UINT16> repeats;
+    UINT32 top;
+};
+
+/**
+ * Return address stack of `num_entries` entries, kept in a circular buffer:
+ * a call beyond the capacity overwrites the oldest entry, and a return
+ * with no entry left is mispredicted. With `repeat_bits`, a call that
+ * pushes the address already on top (direct recursion) bumps a repeat
+ * counter of that many bits instead of taking a new entry.
+ *
+ * push_addr() and pop() may run speculatively: checkpoint() records the
+ * top of stack (its position and entry) and restore() repairs it after a
+ * misspeculation. Deeper entries overwritten on the wrong path are not
+ * recovered. Once added to a RASGroup without repeat counters, the RAS
+ * shares the group's buffer: only the group may update, checkpoint and
+ * restore it then.
+ **/
+class RAS {
+    friend class RASGroup;
+
+  public:
+    struct Checkpoint {
+        UINT32 top, depth;
+        ADDRINT addr;
+        UINT16 repeat;
+    };
+
+    RAS(UINT32 num_entries, UINT32 num_repeat_bits = 0)
+        : max_entries(num_entries), repeat_bits(num_repeat_bits),
+          max_repeat((1U << num_repeat_bits) - 1),
+          stack(new ReturnStack(num_entries)), shared(false), depth(0),
+          correct(0), incorrect(0){};
+    ~RAS() {
+        if (!shared)
+            delete stack;
+    };
+
+    void push_addr(ADDRINT addr) {
+        ASSERT(!shared, "a shared RAS is updated by its RASGroup");
+        UINT32 top = stack->top;
+        if (depth && stack->addrs[top] == addr &&
+            stack->repeats[top] < max_repeat) {
+            stack->repeats[top]++;
             return;
         }
+        stack->push(addr);
+        if (depth < max_entries)
+            depth++;
+    }
 
-        ADDRINT ras_ip = *(addr_vec.end() - 1);
-        addr_vec.pop_back();
+    // The predicted return address, 0 when empty
+    ADDRINT pop() {
+        ASSERT(!shared, "a shared RAS is updated by its RASGroup");
+        if (!depth)
+            return 0;
+        UINT32 top = stack->top;
+        ADDRINT addr = stack->addrs[top];
+        if (stack->repeats[top]) {
+            stack->repeats[top]--;
+        } else {
+            stack->pop();
+            depth--;
+        }
+        return addr;
+    }
 
-        if (ras_ip == target)
+    void pop_addr(ADDRINT target) {
+        bool hit = depth && stack->addrs[stack->top] == target;
+        pop();
+        if (hit)
             correct++;
         else
             incorrect++;
     }
 
+    Checkpoint checkpoint() const {
+        ASSERT(!shared, "a shared RAS is checkpointed by its RASGroup");
+        Checkpoint c = {stack->top, depth, stack->addrs[stack->top],
+                        stack->repeats[stack->top]};
+        return c;
+    }
+
+    void restore(const Checkpoint &c) {
+        ASSERT(!shared, "a shared RAS is restored by its RASGroup");
+        stack->top = c.top;
+        stack->addrs[c.top] = c.addr;
+        stack->repeats[c.top] = c.repeat;
+        depth = c.depth;
+    }
+
+    // The valid entries, oldest first
+    void saveState(SNAPSHOT_WRITER &s) {
+        std::vector<ADDRINT> addrs(depth);
+        std::vector<UINT16> repeats(depth);
+        for (UINT32 i = 0; i < depth; i++) {
+            addrs[depth - 1 - i] = stack->addrs[stack->below(i)];
+            repeats[depth - 1 - i] = stack->repeats[stack->below(i)];
+        }
+        s.PutVector(addrs);
+        if (max_repeat)
+            s.PutVector(repeats);
+    }
+
+    // Rewrites the entries below the current top: a buffer shared with
+    // other RASes gets the same ones from each
+    void loadState(SNAPSHOT_READER &s) {
+        std::vector<ADDRINT> addrs;
+        std::vector<UINT16> repeats;
+        s.GetVector(addrs);
+        if (max_repeat)
+            s.GetVector(repeats);
+        depth = addrs.size() < max_entries ? addrs.size() : max_entries;
+        for (UINT32 i = 0; i < depth; i++) {
+            UINT32 pos = stack->below(i);
+            stack->addrs[pos] = addrs[addrs.size() - 1 - i];
+            stack->repeats[pos] =
+                i < repeats.size() ? repeats[repeats.size() - 1 - i] : 0;
+        }
+    }
+
+    UINT32 getNumEntries() { return max_entries; }
+    UINT32 getRepeatBits() { return repeat_bits; }
+    UINT64 getNumCorrect() { return correct; }
+    UINT64 getNumIncorrect() { return incorrect; }
+
     string getNameAndStats() {
         std::ostringstream stream;
-        stream << "RAS (" << max_entries << " entries): " << correct << " "
-               << incorrect;
+        stream << "RAS (" << max_entries << " entries";
+        if (repeat_bits)
+            stream << ", " << repeat_bits << "-bit repeats";
+        stream << "): " << correct << " " << incorrect;
         return stream.str();
     };
 
   private:
-    UINT32 max_entries;
-    std::vector<ADDRINT> addr_vec;
+    UINT32 max_entries, repeat_bits, max_repeat;
+    ReturnStack *stack;
+    bool shared; /* stack owned by a RASGroup */
+    UINT32 depth;
 
     unsigned long long correct, incorrect;
+
+    void share(ReturnStack *s) {
+        if (!shared)
+            delete stack;
+        stack = s;
+        shared = true;
+    }
+};
+
+/**
+ * RASes of any sizes, updated together on each call and return. Those
+ * without repeat counters hold the top entries of the same stack of
+ * returns, so they share one buffer as large as the largest of them: a
+ * call is written once and a return compared once, and each RAS only
+ * moves its depth. RASes with repeat counters merge calls depending on
+ * their own contents, so they are updated one by one.
+ *
+ * checkpoint() and restore() repair the group after speculative calls and
+ * returns: the top of the shared buffer and the depth of each RAS sharing
+ * it, and the checkpoint of each other RAS. A RAS sharing the buffer then
+ * repairs more than it would on its own: wrong-path calls go to the
+ * buffer of the largest RAS, so an N-entry RAS keeps the oldest entries
+ * that more than N - depth wrong-path calls would have overwritten in
+ * its own circular buffer. Without speculation, it predicts exactly as
+ * on its own.
+ **/
+class RASGroup {
+  public:
+    struct Checkpoint {
+        UINT32 top;
+        ADDRINT addr;
+        std::vector<UINT32> depths;
+        std::vector<RAS::Checkpoint> repeating;
+    };
+
+    RASGroup() : stack(1) {}
+
+    // Before any call or return: the shared buffer is cleared as it grows
+    void add(RAS *r) {
+        if (r->max_repeat) {
+            repeating.push_back(r);
+            return;
+        }
+        if (r->max_entries > stack.addrs.size())
+            stack.resize(r->max_entries);
+        r->share(&stack);
+        plain.push_back(r);
+    }
+
+    void push_addr(ADDRINT addr) {
+        stack.push(addr);
+        for (size_t i = 0; i < plain.size(); i++)
+            if (plain[i]->depth < plain[i]->max_entries)
+                plain[i]->depth++;
+        for (size_t i = 0; i < repeating.size(); i++)
+            repeating[i]->push_addr(addr);
+    }
+
+    void pop_addr(ADDRINT target) {
+        bool hit = stack.addrs[stack.top] == target;
+        stack.pop();
+        for (size_t i = 0; i < plain.size(); i++) {
+            RAS *r = plain[i];
+            if (r->depth && hit)
+                r->correct++;
+            else
+                r->incorrect++;
+            if (r->depth)
+                r->depth--;
+        }
+        for (size_t i = 0; i < repeating.size(); i++)
+            repeating[i]->pop_addr(target);
+    }
+
+    Checkpoint checkpoint() const {
+        Checkpoint c;
+        c.top = stack.top;
+        c.addr = stack.addrs[stack.top];
+        for (size_t i = 0; i < plain.size(); i++)
+            c.depths.push_back(plain[i]->depth);
+        for (size_t i = 0; i < repeating.size(); i++)
+            c.repeating.push_back(repeating[i]->checkpoint());
+        return c;
+    }
+
+    void restore(const Checkpoint &c) {
+        stack.top = c.top;
+        stack.addrs[c.top] = c.addr;
+        for (size_t i = 0; i < plain.size(); i++)
+            plain[i]->depth = c.depths[i];
+        for (size_t i = 0; i < repeating.size(); i++)
+            repeating[i]->restore(c.repeating[i]);
+    }
+
+  private:
+    ReturnStack stack;
+    std::vector<RAS *> plain, repeating;
 };
 
 #endif
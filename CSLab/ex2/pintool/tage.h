@@ -0,0 +1,242 @@
+#ifndef TAGE_H
+#define TAGE_H
+
+#include <cmath> // pow()
+#include <sstream>
+#include <vector>
+
+#include "branch_predictor.h"
+#include "history.h"
+
+/**
+ * TAGE (TAgged GEometric history length) predictor: a bimodal base table and
+ * `numTables` tagged tables indexed with global histories of geometrically
+ * increasing lengths, from `minHistory` to `maxHistory` outcomes.
+ *
+ * The longest matching table provides the prediction, unless its entry is
+ * newly allocated (weak) and the alternate prediction has proven better. A
+ * misprediction allocates an entry in a longer table whose useful bits are
+ * clear, or ages the useful bits of the candidates when none is. All the
+ * useful bits are halved every 2^18 branches.
+ *
+ * Tagged entries are packed in 16 bits: a 3-bit counter, 2 useful bits and a
+ * tag of 7 to 11 bits (longer tables get longer tags). The bimodal table
+ * packs four 2-bit counters per byte. Indices and tags are computed from
+ * folded histories, in O(1) whatever the history length.
+ **/
+class TAGEPredictor : public BranchPredictor {
+
+public:
+    TAGEPredictor(unsigned numTables_, unsigned logEntries_,
+                  unsigned minHistory_, unsigned maxHistory_)
+        : BranchPredictor(), numTables(numTables_), logEntries(logEntries_),
+          minHistory(minHistory_), maxHistory(maxHistory_),
+          geometry(numTables_, logEntries_, minHistory_, maxHistory_, 7, 11,
+                   0x12345678),
+          tables(numTables_) {
+        logBimodal = logEntries + 2;
+        bimodal.assign(1 << (logBimodal - 2), 0x55); // weakly not taken
+
+        for (unsigned i = 0; i < numTables; i++)
+            tables[i].assign(1 << logEntries, 0);
+
+        useAltOnNa = 8;
+        tick = 0;
+    }
+
+    virtual bool predict(ADDRINT ip, ADDRINT target) {
+        lookup(ip);
+        return finalPred;
+    }
+
+    virtual void update(bool predicted, bool actual, ADDRINT ip, ADDRINT target) {
+        train(ip, actual);
+        updateCounters(predicted, actual);
+    }
+
+    virtual bool predictAndUpdate(ADDRINT ip, ADDRINT target, bool actual) {
+        lookup(ip);
+        bool predicted = finalPred;
+        train(ip, actual);
+        updateCounters(predicted, actual);
+        return predicted;
+    }
+
+    virtual string getName() {
+        std::ostringstream stream;
+        stream << "TAGE-" << numTables << "x"
+               << pow(2.0, double(logEntries)) / 1024.0 << "K-" << minHistory
+               << "-" << maxHistory;
+        return stream.str();
+    }
+
+    // Bits of the modeled tables and histories
+    virtual UINT64 getStorageBits() {
+        UINT64 bits = UINT64(2) << logBimodal;
+        for (unsigned i = 0; i < numTables; i++)
+            bits += UINT64(5 + geometry.tagBits(i)) << logEntries;
+        return bits + maxHistory + 16 + 4;
+    }
+
+    virtual void saveState(SNAPSHOT_WRITER &s) {
+        s.PutVector(bimodal);
+        for (unsigned i = 0; i < numTables; i++)
+            s.PutVector(tables[i]);
+        geometry.saveState(s);
+        path.saveState(s);
+        s.Put(useAltOnNa);
+        s.Put(tick);
+    }
+
+    virtual void loadState(SNAPSHOT_READER &s) {
+        s.GetVector(bimodal);
+        for (unsigned i = 0; i < numTables; i++)
+            s.GetVector(tables[i]);
+        geometry.loadState(s);
+        path.loadState(s);
+        s.Get(useAltOnNa);
+        s.Get(tick);
+    }
+
+private:
+    /* Tagged entry: counter in bits 0-2, useful in bits 3-4, tag above */
+    static unsigned ctr(UINT16 e) { return e & 7; }
+    static unsigned useful(UINT16 e) { return (e >> 3) & 3; }
+    static unsigned tag(UINT16 e) { return e >> 5; }
+    struct TagOf {
+        unsigned operator()(UINT16 e) const { return tag(e); }
+    };
+    static UINT16 pack(unsigned ctr, unsigned u, unsigned tag) {
+        return UINT16(ctr | (u << 3) | (tag << 5));
+    }
+
+    unsigned numTables, logEntries, logBimodal;
+    unsigned minHistory, maxHistory;
+
+    std::vector<UINT8> bimodal;
+    GeometricHistories geometry;
+    PathHistory path;
+
+    std::vector<std::vector<UINT16> > tables;
+
+    INT32 useAltOnNa; /* 4-bit, >= 8: trust the alternate over weak entries */
+    UINT32 tick;      /* branches since the last useful bits aging */
+
+    /* Lookup results, kept for the update */
+    int provider, alternate;
+    bool providerPred, altPred, finalPred, providerWeak;
+
+    unsigned bimodalIndex(ADDRINT ip) {
+        return ip & ((1U << logBimodal) - 1);
+    }
+
+    bool bimodalPred(ADDRINT ip) {
+        unsigned i = bimodalIndex(ip);
+        return (bimodal[i >> 2] >> ((i & 3) * 2)) & 2;
+    }
+
+    void bimodalTrain(ADDRINT ip, bool taken) {
+        unsigned i = bimodalIndex(ip), shift = (i & 3) * 2;
+        unsigned c = (bimodal[i >> 2] >> shift) & 3;
+        if (taken && c < 3)
+            c++;
+        else if (!taken && c > 0)
+            c--;
+        bimodal[i >> 2] = UINT8((bimodal[i >> 2] & ~(3 << shift)) | (c << shift));
+    }
+
+    UINT16 &entry(unsigned table) {
+        return tables[table][geometry.index(table)];
+    }
+
+    void lookup(ADDRINT ip) {
+        geometry.lookup(ip, &path);
+        geometry.match(tables, TagOf(), provider, alternate);
+
+        altPred = alternate >= 0 ? ctr(entry(alternate)) >= 4
+                                 : bimodalPred(ip);
+        if (provider < 0) {
+            finalPred = altPred;
+            return;
+        }
+        unsigned c = ctr(entry(provider));
+        providerPred = c >= 4;
+        providerWeak = (c == 3 || c == 4);
+        finalPred = (providerWeak && useAltOnNa >= 8) ? altPred : providerPred;
+    }
+
+    void train(ADDRINT ip, bool taken) {
+        if (provider >= 0 && providerWeak && providerPred != altPred) {
+            if (altPred == taken && useAltOnNa < 15)
+                useAltOnNa++;
+            else if (altPred != taken && useAltOnNa > 0)
+                useAltOnNa--;
+        }
+
+        if (finalPred != taken && provider < int(numTables) - 1)
+            allocate(taken);
+
+        if (provider >= 0) {
+            UINT16 &e = entry(provider);
+            /* A newly allocated entry also trains its alternate */
+            if (useful(e) == 0) {
+                if (alternate >= 0)
+                    trainTagged(entry(alternate), taken);
+                else
+                    bimodalTrain(ip, taken);
+            }
+            trainTagged(e, taken);
+            if (providerPred != altPred) {
+                unsigned u = useful(e);
+                if (providerPred == taken && u < 3)
+                    u++;
+                else if (providerPred != taken && u > 0)
+                    u--;
+                e = pack(ctr(e), u, tag(e));
+            }
+        } else {
+            bimodalTrain(ip, taken);
+        }
+
+        if ((++tick & ((1 << 18) - 1)) == 0)
+            ageUseful();
+
+        geometry.push(taken);
+        path.push(ip);
+    }
+
+    static void trainTagged(UINT16 &e, bool taken) {
+        unsigned c = ctr(e);
+        if (taken && c < 7)
+            c++;
+        else if (!taken && c > 0)
+            c--;
+        e = pack(c, useful(e), tag(e));
+    }
+
+    void allocate(bool taken) {
+        unsigned start = geometry.allocationStart(provider);
+
+        for (unsigned i = start; i < numTables; i++) {
+            UINT16 &e = entry(i);
+            if (useful(e) == 0) {
+                e = pack(taken ? 4 : 3, 0, geometry.tag(i));
+                return;
+            }
+        }
+        for (unsigned i = start; i < numTables; i++) {
+            UINT16 &e = entry(i);
+            e = pack(ctr(e), useful(e) - 1, tag(e));
+        }
+    }
+
+    void ageUseful() {
+        for (unsigned i = 0; i < numTables; i++)
+            for (size_t j = 0; j < tables[i].size(); j++) {
+                UINT16 &e = tables[i][j];
+                e = pack(ctr(e), useful(e) >> 1, tag(e));
+            }
+    }
+};
+
+#endif
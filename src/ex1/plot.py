@@ -39,6 +39,64 @@ def parse_arguments() -> str:
     return args.config
 
 
+def find_structured_stats(outputs: Sequence[str], config: str):
+    """Function to find ipc and mpki from json/csv pintool outputs.
+
+    All outputs are loaded in one dataframe and only the final
+    record of each run is kept.
+
+    Parameters
+    ----------
+
+    outputs: iterable of str
+        The files to open.
+
+    config: str
+        {L1, L2, TLB, Prefetch}.
+
+    Returns
+    -------
+
+    dataframe: pandas DataFrame
+        DataFrame containing IPC MPKI and x-axis labels.
+    """
+    frames = []
+    for output in outputs:
+        if output.endswith(".json"):
+            frames.append(pd.read_json(output, lines=True))
+        else:
+            frames.append(pd.read_csv(output))
+    runs = pd.concat(frames, ignore_index=True)
+    runs = runs[runs["Final"] == 1].reset_index(drop=True)
+    # group of columns containing misses and labels
+    group = {"L1": "L1", "L2": "L2", "TLB": "Tlb", "Prefetch": "L2"}[config]
+    misses = runs[f"{group}.Load-Misses"] + runs[f"{group}.Store-Misses"]
+    results = pd.DataFrame()
+    if config == "Prefetch":
+        results["LABEL"] = runs["L2.Prefetch-Lines"].astype(str)
+    elif config == "TLB":
+        results["LABEL"] = (
+            runs["Tlb.Entries"].astype(str)
+            + "E-"
+            + runs["Tlb.Assoc"].astype(str)
+            + "-"
+            + runs["Tlb.PageSize"].astype(str)
+            + "B"
+        )
+    else:
+        results["LABEL"] = (
+            (runs[f"{group}.Size"] // 1024).astype(str)
+            + "K-"
+            + runs[f"{group}.Assoc"].astype(str)
+            + "-"
+            + runs[f"{group}.Block"].astype(str)
+            + "B"
+        )
+    results["IPC"] = runs["IPC"]
+    results["MPKI"] = misses / (runs["Total-Instructions"] / 1000)
+    return results
+
+
 def find_stats(outputs: Sequence[str], config: str):
     """Function to find ipc and mpki.
 
@@ -57,6 +115,9 @@ def find_stats(outputs: Sequence[str], config: str):
     dataframe: pandas DataFrame
         DataFrame containing IPC MPKI and x-axis labels.
     """
+    outputs = list(outputs)
+    if outputs and all(x.endswith((".json", ".csv")) for x in outputs):
+        return find_structured_stats(outputs, config)
     # dictionary containing x-axis strings
     axis_labels = {
         "L1": "{0}K-{1}-{2}B",
@@ -24,6 +24,9 @@ def parse_arguments():
 
     time: bool
         Whether to time results or not.
+
+    fmt: str
+        Output format of the pintool.
     """
     parser = argparse.ArgumentParser(
         prog="run", description="Run CSLab AdvComparch Exercise 1 Benchmarks."
@@ -37,8 +40,15 @@ def parse_arguments():
     parser.add_argument(
         "--time", help="time each benchmark", action="store_true"
     )
+    parser.add_argument(
+        "--format",
+        help="pintool output format",
+        type=str,
+        choices=["text", "json", "csv"],
+        default="text",
+    )
     args = parser.parse_args()
-    return args.config, args.time
+    return args.config, args.time, args.format
 
 
 def preparation(root, benchmarks):
@@ -110,7 +120,7 @@ def zip_benchmarks_cmds(benchmarks, cmds):
     return ret
 
 
-def configure_options(config):
+def configure_options(config, fmt="text"):
     """Find output names as well as options of this config.
 
     Parameters
@@ -119,6 +129,9 @@ def configure_options(config):
     config: str
         {L1, L2, TLB, Prefetch, 10m}
 
+    fmt: str
+        {text, json, csv}
+
     Returns
     -------
 
@@ -141,7 +154,8 @@ def configure_options(config):
         for x in x:
             new_x.append(f"{x:04d}")
         ret = "-".join(new_x)
-        return f"{ret}.txt"
+        extension = "txt" if fmt == "text" else fmt
+        return f"{ret}.{extension}"
 
     outputs = list(map(convert, outputs))
     options = []
@@ -150,6 +164,8 @@ def configure_options(config):
             lambda x: f"-{x[0]} {x[1]}".split(), config.to_dict().items()
         )
         config = list(it.chain(*config))
+        if fmt != "text":
+            config.extend(["-format", fmt])
         options.append(config)
     return list(zip(outputs, options))
 
@@ -184,7 +200,7 @@ def run_one(option, main, results, cmd, cwd):
     sp.run(main, stdout=sp.DEVNULL, stderr=sp.DEVNULL, cwd=cwd, env=os.environ)
 
 
-def run(root, results, benchmarks, config, time):
+def run(root, results, benchmarks, config, time, fmt):
     """Function to run all benchmarks.
 
     Parameters
@@ -204,6 +220,9 @@ def run(root, results, benchmarks, config, time):
 
     time: bool
         Time or not each benchmark.
+
+    fmt: str
+        Pintool output format.
     """
     pin = os.path.join(root, "pin-3.6", "pin")
     pintool = os.path.join(
@@ -218,7 +237,7 @@ def run(root, results, benchmarks, config, time):
     with open(cmds, "r") as fp:
         cmds = list(map(lambda x: x.strip().split(), fp.readlines()))
     benchmarks = zip_benchmarks_cmds(benchmarks, cmds)
-    options = configure_options(config)
+    options = configure_options(config, fmt)
     main = [pin, "-t", pintool]
     for benchmark, cmd in benchmarks:
         directory = os.path.join(results, benchmark, config)
@@ -240,11 +259,11 @@ def run(root, results, benchmarks, config, time):
 
 
 if __name__ == "__main__":
-    config, time = parse_arguments()
+    config, time, fmt = parse_arguments()
     path = os.path.abspath(os.path.dirname(__file__))
     root = updir(path, 2)
     benchmarks = os.path.join(root, "data", "ex1", "benchmarks.txt")
     with open(benchmarks, "r") as fp:
         benchmarks = list(map(lambda x: x.strip(), fp.readlines()))
     results = preparation(root, benchmarks)
-    run(root, results, benchmarks, config, time)
+    run(root, results, benchmarks, config, time, fmt)